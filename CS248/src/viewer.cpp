@@ -19,6 +19,7 @@ using namespace chrono;
 namespace CS248 {
 
 void checkGLError(const std::string& str);
+bool isGLValidationEnabled();
 
 // HDPI display
 bool Viewer::HDPI;
@@ -83,6 +84,10 @@ void Viewer::init(Renderer *rend) {
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
 #endif
     
+    // a debug context reports GL errors through KHR_debug messages
+    if (isGLValidationEnabled())
+        glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GL_TRUE);
+
     // create window
     string title = renderer ? "CS248: " + renderer->name() : "CS248";
     window = glfwCreateWindow( DEFAULT_W, DEFAULT_H, title.c_str(), NULL, NULL );
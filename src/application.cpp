@@ -8,6 +8,7 @@
 #include "dynamic_scene/spot_light.h"
 #include "dynamic_scene/sphere.h"
 #include "dynamic_scene/mesh.h"
+#include "dynamic_scene/static_batch.h"
 
 #include "CS248/lodepng.h"
 
@@ -49,6 +50,8 @@ void Application::init() {
 
     checkGLError("before OpenGL version detection");
 
+    initGLValidation();
+
     printf("Detected OpenGL version=%s, vendor=%s\n", version, vendor);
     // GLint num_exts;
     // glGetIntegerv(GL_NUM_EXTENSIONS, &num_exts);
@@ -71,8 +74,13 @@ void Application::init() {
     rightDown = false;
     middleDown = false;
     showHUD = true;
+    cpuRenderMillisecondsSum = 0.;
+    cpuRenderFrames = 0;
+    cpuRenderMillisecondsAverage = 0.;
 
     scene = nullptr;
+    pickedObject = DynamicScene::ObjectHandle();
+    pickedDistance = 0.f;
     visualizeShadowMap = false;
     discoModeOn = false;
 
@@ -95,27 +103,38 @@ void Application::init() {
 
 void Application::render() {
 
+    auto renderStart = std::chrono::steady_clock::now();
+
     //printf("Top of application::render\n");
     checkGLError("start of Application::render");
 
-    // Call resize() every time we draw, since it doesn't seem
-    // to get called by the Viewer upon initial window creation
-    // FIXME(kayvonf): look into and fix this
-    GLint view[4];
-    glGetIntegerv(GL_VIEWPORT, view);
-    if (view[2] != screenW || view[3] != screenH) {
-        resize(view[2], view[3]);
+    lastFrameStats = FrameStats::current();
+    FrameStats::current().reset();
+
+    cpuRenderMillisecondsSum += lastFrameStats.cpuRenderMilliseconds;
+    if (++cpuRenderFrames == kCpuTimeWindow) {
+        cpuRenderMillisecondsAverage = cpuRenderMillisecondsSum / kCpuTimeWindow;
+        cpuRenderMillisecondsSum = 0.;
+        cpuRenderFrames = 0;
     }
 
+    // the viewer draws its on-screen text between frames, without going through the resource manager
+    GLResourceManager::instance()->invalidateBindings();
+
     if (discoModeOn) {
       scene->rotateSpotLights();
     }
+
+    // upload the per-frame state shared by all passes (light parameters)
+    scene->beginFrame();
+
     // pass 1, generate shadow map for the spotlights
 
     if (scene->needsShadowPass()) {
         for (int i=0; i<scene->getNumShadowedLights(); i++) {
             scene->renderShadowPass(i);
         }
+        scene->renderShadowLayers();
     }
 
     // pass 2, beauty pass, render the scene (using the shadow map)
@@ -143,6 +162,9 @@ void Application::render() {
 
     //printf("End of application::render\n");
     checkGLError("end of Application::render");
+
+    std::chrono::duration<double, std::milli> renderTime = std::chrono::steady_clock::now() - renderStart;
+    FrameStats::current().cpuRenderMilliseconds = renderTime.count();
 }
 
 
@@ -170,7 +192,11 @@ void Application::load(SceneInfo* sceneInfo) {
     vector<DynamicScene::SceneLight*> lights;
     vector<DynamicScene::SceneObject*> objects;
 
-    vector<Collada::Node>& nodes = sceneInfo->nodes;
+    // static meshes drawn the same way are merged into a few batches, created as one mesh each
+    vector<Collada::Node> nodes = DynamicScene::batchStaticMeshes(sceneInfo->nodes, sceneInfo->groups,
+                                                                  DynamicScene::StaticBatchOptions());
+    // the group placing each object, if any
+    vector<int> objectGroups;
 
     for (size_t i=0; i<nodes.size(); i++) {
         Collada::Node& node = nodes[i];
@@ -196,6 +222,7 @@ void Application::load(SceneInfo* sceneInfo) {
               // printf("Creating mesh\n"); fflush(stdout);  
               objects.push_back(
                   initPolymesh(static_cast<PolymeshInfo&>(*instance), transform));
+              objectGroups.push_back(node.group);
               break;
           }
         default:
@@ -205,8 +232,9 @@ void Application::load(SceneInfo* sceneInfo) {
     }
 
     // create the scene
-    scene = new DynamicScene::Scene(objects, lights, sceneInfo->base_shader_dir);
+    scene = new DynamicScene::Scene(objects, lights, sceneInfo->base_shader_dir, sceneInfo->groups, objectGroups);
     scene->setCamera(&camera);  
+    scene->setShadowColorMaps(visualizeShadowMap);
 
     // given the size of the scene, determine a "canonical" camera position that's
     // outside the bounds of the scene's geometry
@@ -334,6 +362,9 @@ void Application::char_event(unsigned int ch) {
       case 'v':
       case 'V':
         visualizeShadowMap = !visualizeShadowMap;
+        // the shadow passes only draw the color maps shown while visualizing
+        if (scene)
+          scene->setShadowColorMaps(visualizeShadowMap);
         break;
       case 'c':
       case 'C':
@@ -357,6 +388,16 @@ void Application::char_event(unsigned int ch) {
       case 'D':
          discoModeOn = !discoModeOn;
          break;
+      case 'b':
+      case 'B':
+         scene->benchmarkRayQueries();
+         scene->checkGroupTransforms();
+         break;
+      case 'l':
+      case 'L':
+         scene->setLayeredShadows(!scene->getLayeredShadows());
+         printf("Layered shadow pass: %s\n", scene->getLayeredShadows() ? "on" : "off");
+         break;
     }
 }
 
@@ -461,12 +502,25 @@ void Application::mouse2_dragged(float x, float y) {
 }
 
 void Application::mouse_moved(float x, float y) {
-    y = screenH - y;  // Because up is down.
-                      // Converts x from [0, w] to [-1, 1], and similarly for y.
+    // find the object under the cursor, shown by the HUD
+    if (scene) {
+        Vector3D origin, direction;
+        getMouseRay(x, y, &origin, &direction);
+        pickedObject = scene->pickObject(origin, direction, &pickedDistance);
+    }
+}
 
-    // Vector2D p(x * 2 / screenW - 1, y * 2 / screenH - 1);
-    Vector2D p(x, y);
-    //updateCamera();
+void Application::getMouseRay(float x, float y, Vector3D* origin, Vector3D* direction) const {
+    // the ray from the camera through the point of the image plane under the cursor
+    Vector3D viewDir = (camera.getViewPoint() - camera.getPosition()).unit();
+    Vector3D right = cross(viewDir, camera.getUpDir()).unit();
+    Vector3D up = cross(right, viewDir);
+    double tanHalfFov = tan(radians(camera.getVFov()) / 2);
+    double u = (x * 2 / screenW - 1) * tanHalfFov * camera.getAspectRatio();
+    double v = (1 - y * 2 / screenH) * tanHalfFov;  // y is upside down
+
+    *origin = camera.getPosition();
+    *direction = (viewDir + u * right + v * up).unit();
 }
 
 /*
@@ -493,7 +547,75 @@ void Application::drawHUD() {
     const int inc = use_hdpi ? 48 : 24;
     float y = y0 + inc - size;
 
+    char cpuTime[64];
+    snprintf(cpuTime, sizeof(cpuTime), "CPU render: %.3f ms", cpuRenderMillisecondsAverage);
+    drawString(x0, y, string(cpuTime) + (isGLValidationEnabled() ? " (validating)" : ""), size, textColor);
+    y += inc;
+    drawString(x0, y, "glGetError calls: " + to_string(lastFrameStats.glErrorQueries), size, textColor);
+    y += inc;
+    drawString(x0, y, "Location queries: " + to_string(lastFrameStats.locationQueries), size, textColor);
+    y += inc;
+    drawString(x0, y, "Param name lookups: " + to_string(lastFrameStats.parameterNameLookups), size, textColor);
+    y += inc;
+    drawString(x0, y, "Uniform uploads: " + to_string(lastFrameStats.uniformUploads) +
+               " (skipped " + to_string(lastFrameStats.uniformUploadsSkipped) + ")", size, textColor);
+    y += inc;
+    drawString(x0, y, "VAO binds: " + to_string(lastFrameStats.vertexArrayBinds) +
+               ", attrib pointers: " + to_string(lastFrameStats.vertexAttribPointerCalls), size, textColor);
+    y += inc;
+    drawString(x0, y, "Binds: " + to_string(lastFrameStats.bindsIssued) +
+               " (elided " + to_string(lastFrameStats.bindsElided) + ")", size, textColor);
+    y += inc;
+    drawString(x0, y, "Draw calls: " + to_string(lastFrameStats.drawCalls) +
+               " (" + to_string(lastFrameStats.instancesDrawn) + " instances)", size, textColor);
+    y += inc;
+    drawString(x0, y, "Vertices: " + to_string(lastFrameStats.verticesDrawn) +
+               " (" + to_string(lastFrameStats.vertexBytesFetched / 1024) + " KB fetched)", size, textColor);
+    y += inc;
+    drawString(x0, y, "Transform groups updated: " + to_string(lastFrameStats.transformNodesUpdated), size, textColor);
+    y += inc;
+    drawString(x0, y, "Transform chunks uploaded: " + to_string(lastFrameStats.transformChunksUploaded), size, textColor);
+    y += inc;
+    if (scene->needsShadowPass()) {
+        drawString(x0, y, "Shadow passes: " + to_string(lastFrameStats.shadowPassesRendered) + " rendered (" +
+                   to_string(lastFrameStats.staticShadowMapsRendered) + " static maps), " +
+                   to_string(lastFrameStats.shadowPassesSkipped) + " skipped", size, textColor);
+        y += inc;
+        drawString(x0, y, "Layered shadow passes: " + to_string(lastFrameStats.layeredShadowPasses) +
+                   (scene->getLayeredShadows() ? "" : " (off)"), size, textColor);
+        y += inc;
+        const DynamicScene::ShadowAtlas& atlas = scene->getShadowAtlas();
+        long long atlasTexels = (long long)atlas.getSize() * atlas.getSize();
+        drawString(x0, y, "Shadow atlas: " + to_string(atlas.getUsedTexels() * 100 / atlasTexels) + "% used, " +
+                   to_string(lastFrameStats.shadowTilesMoved) + " tiles moved", size, textColor);
+        y += inc;
+    }
+    if (pickedObject.isValid()) {
+        char picked[96];
+        Vector3D position = scene->getObject(pickedObject)->getPosition();
+        snprintf(picked, sizeof(picked), "Under cursor: object %d at (%.1f, %.1f, %.1f), %.1f away",
+                 pickedObject.id, position.x, position.y, position.z, pickedDistance);
+        drawString(x0, y, picked, size, textColor);
+        y += inc;
+    }
+    drawString(x0, y, "Culling tree nodes visited: " + to_string(lastFrameStats.cullingNodesVisited), size, textColor);
+    y += inc;
+    drawString(x0, y, "Culling dispatches: " + to_string(lastFrameStats.computeDispatches) + ", indirect commands: " +
+               to_string(lastFrameStats.indirectCommandsDrawn), size, textColor);
+    y += inc;
+    drawString(x0, y, "Camera pass: " + to_string(lastFrameStats.objectsVisible[0]) + " drawn, " +
+               to_string(lastFrameStats.objectsCulled[0]) + " culled", size, textColor);
+    y += inc;
+    for (int i = 1; i < FrameStats::kMaxCullingPasses; i++) {
+        if (lastFrameStats.objectsVisible[i] + lastFrameStats.objectsCulled[i] == 0)
+            continue;
+        drawString(x0, y, "Shadow pass " + to_string(i - 1) + ": " + to_string(lastFrameStats.objectsVisible[i]) +
+                   " drawn, " + to_string(lastFrameStats.objectsCulled[i]) + " culled", size, textColor);
+        y += inc;
+    }
+
     textManager.render();
+    GLResourceManager::instance()->invalidateBindings();
 
     checkGLError("end Application::drawHUD");
 }
@@ -23,6 +23,7 @@
 #include "dynamic_scene/scene.h"
 
 #include "camera.h"
+#include "frame_stats.h"
 
 using namespace std;
 
@@ -126,6 +127,13 @@ class Application : public Renderer {
 
     // HUD //
     bool showHUD;
+    FrameStats lastFrameStats;  // counters of the previously rendered frame
+    // CPU render time averaged over windows of kCpuTimeWindow frames, to compare e.g. runs
+    // with and without GL validation
+    static const int kCpuTimeWindow = 64;
+    double cpuRenderMillisecondsSum;
+    int    cpuRenderFrames;
+    double cpuRenderMillisecondsAverage;
     void drawHUD();
     inline void drawString(float x, float y, string str, size_t size, const Color& c);
 
@@ -133,6 +141,13 @@ class Application : public Renderer {
     // going through the origin, and returns the intersecting position
     Vector3D getMouseProjection(double dist=std::numeric_limits<double>::infinity());
 
+    // the world space ray through the pixel at x, y in screen coordinates (direction normalized)
+    void getMouseRay(float x, float y, Vector3D* origin, Vector3D* direction) const;
+
+    // the object under the cursor (see Scene::pickObject), or NULL, and its distance
+    DynamicScene::ObjectHandle pickedObject;
+    float pickedDistance;
+
 };  // class Application
 
 }  // namespace CS248
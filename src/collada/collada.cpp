@@ -130,6 +130,47 @@ string wstring_to_string(const wstring& str)
     return ret;
 }
 
+// The texture coordinate transforms of a mesh entry of a scene JSON file, as a string. The
+// vertex data of entries with the same mesh file and transforms is identical.
+string texcoord_transforms_key(JSONObject& mesh_json_object) {
+  const wchar_t* transforms[] = { L"texcoord_u_scale", L"texcoord_v_scale", L"texcoord_u_flip",
+                                  L"texcoord_v_flip", L"texcoord_v_wrap" };
+  stringstream key;
+  for (const wchar_t* transform : transforms) {
+    auto found = mesh_json_object.find(transform);
+    if (found == mesh_json_object.end()) {
+      key << "|";
+    } else if (found->second->IsNumber()) {
+      key << "|" << setprecision(17) << found->second->AsNumber();
+    } else if (found->second->IsString()) {
+      key << "|" << wstring_to_string(found->second->AsString());
+    }
+  }
+  return key.str();
+}
+
+// Reads a 3-vector member of a JSON object into `v`, if it is present
+void read_json_vector(JSONObject& json_object, const wchar_t* name, Vector3D& v) {
+  if (json_object.find(name) != json_object.end() && json_object[name]->IsArray()) {
+    JSONArray json_array = json_object[name]->AsArray();
+    if (json_array.size() == 3) {
+      v.x = json_array[0]->AsNumber();
+      v.y = json_array[1]->AsNumber();
+      v.z = json_array[2]->AsNumber();
+    }
+  }
+}
+
+// static
+vector<Matrix4x4> GroupInfo::groupsToWorld(const vector<GroupInfo>& groups) {
+  vector<Matrix4x4> toWorld(groups.size());
+  for (size_t i = 0; i < groups.size(); ++i) {
+    const GroupInfo& group = groups[i];
+    toWorld[i] = group.parent < 0 ? group.transform : toWorld[group.parent] * group.transform;
+  }
+  return toWorld;
+}
+
 int ColladaParser::load(const char* filename, SceneInfo* sceneInfo) {
   ifstream in(filename);
   if (!in.is_open()) {
@@ -356,8 +397,54 @@ int ColladaParser::load(const char* filename, SceneInfo* sceneInfo) {
 		}
     }
 
+    // groups place the meshes that name them as their "group", and the groups that name them
+    // as their "parent" (which must come first)
+    map<string, int> group_indices;
+    auto find_group = [&](JSONObject& json_object, const wchar_t* key) {
+      if (json_object.find(key) == json_object.end() || !json_object[key]->IsString())
+        return -1;
+      string name = wstring_to_string(json_object[key]->AsString());
+      auto found = group_indices.find(name);
+      if (found == group_indices.end()) {
+        cerr << "Warning: unknown group " << name << endl;
+        return -1;
+      }
+      return found->second;
+    };
+
+    if (root.find(L"groups") != root.end() && root[L"groups"]->IsArray()) {
+      JSONArray group_json_array = root[L"groups"]->AsArray();
+      for (int i = 0; i < group_json_array.size(); ++i) {
+        if (!group_json_array[i]->IsObject()) continue;
+        JSONObject group_json_object = group_json_array[i]->AsObject();
+        GroupInfo group;
+        if (group_json_object.find(L"name") != group_json_object.end() && group_json_object[L"name"]->IsString()) {
+          group.name = wstring_to_string(group_json_object[L"name"]->AsString());
+        }
+        Vector3D group_translate(0,0,0);
+        Vector3D group_rotation(0,0,0);  // in degrees, around X, then Y, then Z
+        Vector3D group_scale(1,1,1);
+        read_json_vector(group_json_object, L"translate", group_translate);
+        read_json_vector(group_json_object, L"rotation", group_rotation);
+        read_json_vector(group_json_object, L"scale", group_scale);
+        group.transform = Matrix4x4::translation(group_translate) *
+                          Matrix4x4::rotation(radians(group_rotation.x), Matrix4x4::Axis::X) *
+                          Matrix4x4::rotation(radians(group_rotation.y), Matrix4x4::Axis::Y) *
+                          Matrix4x4::rotation(radians(group_rotation.z), Matrix4x4::Axis::Z) *
+                          Matrix4x4::scaling(group_scale);
+        group.parent = find_group(group_json_object, L"parent");
+        group_indices[group.name] = scene->groups.size();
+        scene->groups.push_back(group);
+      }
+    }
+
     if (root.find(L"meshes") != root.end() && root[L"meshes"]->IsArray()) {
         JSONArray mesh_json_array = root[L"meshes"]->AsArray();
+
+        // the meshes whose OBJ file was parsed, by material file, OBJ file and texture coordinate
+        // transforms. Later entries with the same key share their vertex data instead of parsing it again.
+        map<string, PolymeshInfo*> parsed_meshes;
+
 		for(int i = 0; i < mesh_json_array.size(); ++i) {
 			if(!mesh_json_array[i]->IsObject()) continue;
 			JSONObject mesh_json_object = mesh_json_array[i]->AsObject();
@@ -371,6 +458,8 @@ int ColladaParser::load(const char* filename, SceneInfo* sceneInfo) {
             polymesh->is_disney = false;
             polymesh->is_mirror_brdf = false;
             polymesh->phong_spec_exp = 1.f;
+            polymesh->vertex_format = "auto";
+            string geometry_key;
 
 			if (mesh_json_object.find(L"use_disney") != mesh_json_object.end() && mesh_json_object[L"use_disney"]->IsString()) {
 			    if(L"true" == mesh_json_object[L"use_disney"]->AsString()) {
@@ -403,6 +492,7 @@ int ColladaParser::load(const char* filename, SceneInfo* sceneInfo) {
 
 						polymesh->is_mtl_file = true;
 						in.close();
+						geometry_key = material_filename;
 					}
 				}
 			}
@@ -429,18 +519,25 @@ int ColladaParser::load(const char* filename, SceneInfo* sceneInfo) {
 					mesh_filename = mesh_filename.substr(0, pos);
 					if(mesh_filename.substr(mesh_filename.find_last_of(".") + 1) == "obj"
 							|| mesh_filename.substr(mesh_filename.find_last_of(".") + 1) == "OBJ") {
-						ifstream in(mesh_filename);
-						if (!in.is_open()) {
-							cerr << "Warning: could not open file " << mesh_filename << endl;
-							return -1;
-						}
+						geometry_key += "|" + mesh_filename + texcoord_transforms_key(mesh_json_object);
+						auto parsed = parsed_meshes.find(geometry_key);
+						if (parsed != parsed_meshes.end()) {
+							polymesh->shared_geometry = parsed->second;
+						} else {
+							ifstream in(mesh_filename);
+							if (!in.is_open()) {
+								cerr << "Warning: could not open file " << mesh_filename << endl;
+								return -1;
+							}
  
-						if(!parse_objmesh(in, *polymesh)) {
-							cerr << "Error: bad obj format" << endl;
+							if(!parse_objmesh(in, *polymesh)) {
+								cerr << "Error: bad obj format" << endl;
+								in.close();
+								return -1;
+							}
 							in.close();
-							return -1;
+							parsed_meshes[geometry_key] = polymesh;
 						}
-						in.close();
 					}
 				}
 				pos = string::npos;
@@ -477,6 +574,16 @@ int ColladaParser::load(const char* filename, SceneInfo* sceneInfo) {
           polymesh->is_mirror_brdf = true;
       }
 
+      if (mesh_json_object.find(L"vertex_format") != mesh_json_object.end() && mesh_json_object[L"vertex_format"]->IsString()) {
+        polymesh->vertex_format = wstring_to_string(mesh_json_object[L"vertex_format"]->AsString());
+      }
+
+      if (mesh_json_object.find(L"static") != mesh_json_object.end()) {
+        JSONValue* static_json_value = mesh_json_object[L"static"];
+        polymesh->is_static = (static_json_value->IsBool() && static_json_value->AsBool()) ||
+                              (static_json_value->IsString() && L"true" == static_json_value->AsString());
+      }
+
       if (mesh_json_object.find(L"spec_exp") != mesh_json_object.end() && mesh_json_object[L"spec_exp"]->IsNumber()) {
         double spec_exp = mesh_json_object[L"spec_exp"]->AsNumber();
         polymesh->phong_spec_exp = spec_exp;
@@ -678,7 +785,34 @@ int ColladaParser::load(const char* filename, SceneInfo* sceneInfo) {
 			node.instance = polymesh;
 			//node.transform = Matrix4x4::identity();
       node.transform = Matrix4x4::translation(mesh_translate) * Matrix4x4::scaling(mesh_scale);
-			scene->nodes.push_back(node);
+      node.group = find_group(mesh_json_object, L"group");
+
+      // an "instances" array places one copy of the mesh per element, all sharing the PolymeshInfo.
+      // The copies are in a group placed by the entry's transformation, so they move together.
+      if (mesh_json_object.find(L"instances") != mesh_json_object.end() && mesh_json_object[L"instances"]->IsArray()) {
+        GroupInfo instance_group;  // (unnamed: no other entry names it)
+        instance_group.transform = node.transform;
+        instance_group.parent = node.group;
+        int instance_group_index = scene->groups.size();
+        scene->groups.push_back(instance_group);
+
+        JSONArray instance_json_array = mesh_json_object[L"instances"]->AsArray();
+        for (int j = 0; j < instance_json_array.size(); ++j) {
+          if (!instance_json_array[j]->IsObject()) continue;
+          JSONObject instance_json_object = instance_json_array[j]->AsObject();
+          Vector3D instance_translate(0,0,0);
+          Vector3D instance_scale(1,1,1);
+          read_json_vector(instance_json_object, L"translate", instance_translate);
+          read_json_vector(instance_json_object, L"scale", instance_scale);
+
+          Node instance_node = node;
+          instance_node.group = instance_group_index;
+          instance_node.transform = Matrix4x4::translation(instance_translate) * Matrix4x4::scaling(instance_scale);
+          scene->nodes.push_back(instance_node);
+        }
+      } else {
+        scene->nodes.push_back(node);
+      }
 		}
     }
 
@@ -38,18 +38,35 @@ struct Node {
   string name;
 
   Instance* instance;   ///< instance
-  Matrix4x4 transform;  ///< transformation
+  Matrix4x4 transform;  ///< transformation, relative to the group if there is one
+  int group;            ///< index of the group (in SceneInfo::groups) placing the node, or -1
 
-  Node() : instance(nullptr), transform(Matrix4x4::identity()) {}
+  Node() : instance(nullptr), transform(Matrix4x4::identity()), group(-1) {}
 
 };  // struct Node
 
+/*
+  A group of nodes, placed together by the group's transformation. Groups can be in
+  other groups, which always come before them in SceneInfo::groups.
+*/
+struct GroupInfo {
+  string name;
+  Matrix4x4 transform;  ///< transformation, relative to the parent group if there is one
+  int parent;           ///< index of the parent group, or -1
+
+  GroupInfo() : transform(Matrix4x4::identity()), parent(-1) {}
+
+  // the world space transformation of each of `groups`
+  static vector<Matrix4x4> groupsToWorld(const vector<GroupInfo>& groups);
+};
+
 /*
   The scene that ColladaParser generates and passes to MeshEdit.
 */
 struct SceneInfo {
   std::string base_shader_dir; 
   vector<Node> nodes;
+  vector<GroupInfo> groups;
 };
 
 }  // namespace Collada
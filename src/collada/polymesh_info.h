@@ -52,6 +52,8 @@ struct PolymeshInfo : Instance {
 
   std::string vert_filename;  ///< vertex shader filename
   std::string frag_filename;  ///< fragment shader filename
+  std::string vertex_format;  ///< "auto" (smallest precise enough format), "full" or "compact"
+  bool is_static = false;     ///< never moves, so it may be merged with other static meshes (see batchStaticMeshes)
 
   Vector3D position;  ///< translation part of the transformation
   Vector3D rotation;  ///< rotation part of the transformation
@@ -61,6 +63,13 @@ struct PolymeshInfo : Instance {
   bool is_mtl_file;  ///< mtl file type indicator
 
   bool is_disney;
+
+  // Meshes loaded from the same file with the same texture coordinate transforms share the
+  // vertex data of the first of them, which the others point to (see ColladaParser::load).
+  const PolymeshInfo* shared_geometry = nullptr;
+
+  // the PolymeshInfo holding the vertices, normals, texcoords and polygons of this mesh
+  const PolymeshInfo& geometry() const { return shared_geometry ? *shared_geometry : *this; }
 };  // struct Polymesh
 
 std::ostream& operator<<(std::ostream& os, const PolymeshInfo& polymesh);
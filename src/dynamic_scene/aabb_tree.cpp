@@ -0,0 +1,357 @@
+#include "aabb_tree.h"
+
+namespace CS248 {
+namespace DynamicScene {
+
+namespace {
+
+// buckets of the binned surface area heuristic
+const int kNumSAHBins = 12;
+
+}  // namespace
+
+// static
+float AABBTree::area(const float min[3], const float max[3]) {
+    float dx = max[0] - min[0];
+    float dy = max[1] - min[1];
+    float dz = max[2] - min[2];
+    return 2.f * (dx * dy + dy * dz + dz * dx);
+}
+
+// static
+float AABBTree::unionArea(const Node& a, const Node& b) {
+    float min[3], max[3];
+    for (int axis = 0; axis < 3; axis++) {
+        min[axis] = std::min(a.min[axis], b.min[axis]);
+        max[axis] = std::max(a.max[axis], b.max[axis]);
+    }
+    return area(min, max);
+}
+
+// static
+bool AABBTree::contains(const Node& outer, const BBox& box) {
+    for (int axis = 0; axis < 3; axis++) {
+        if (box.min[axis] < outer.min[axis] || box.max[axis] > outer.max[axis])
+            return false;
+    }
+    return true;
+}
+
+int AABBTree::allocateNode() {
+    int node;
+    if (freeList_ != kNullNode) {
+        node = freeList_;
+        freeList_ = nodes_[node].parent;
+    } else {
+        node = nodes_.size();
+        nodes_.push_back(Node());
+    }
+    Node& n = nodes_[node];
+    n.parent = kNullNode;
+    n.child[0] = n.child[1] = kNullNode;
+    n.height = 0;
+    n.object = -1;
+    return node;
+}
+
+void AABBTree::freeNode(int node) {
+    nodes_[node].parent = freeList_;
+    nodes_[node].height = -1;
+    freeList_ = node;
+}
+
+void AABBTree::setBoxToUnion(int node) {
+    Node& n = nodes_[node];
+    const Node& a = nodes_[n.child[0]];
+    const Node& b = nodes_[n.child[1]];
+    for (int axis = 0; axis < 3; axis++) {
+        n.min[axis] = std::min(a.min[axis], b.min[axis]);
+        n.max[axis] = std::max(a.max[axis], b.max[axis]);
+    }
+    n.height = 1 + std::max(a.height, b.height);
+}
+
+int AABBTree::insert(const BBox& box, int object) {
+    int leaf = allocateNode();
+    Node& n = nodes_[leaf];
+    n.object = object;
+    for (int axis = 0; axis < 3; axis++) {
+        float margin = margin_ * (box.max[axis] - box.min[axis]);
+        n.min[axis] = box.min[axis] - margin;
+        n.max[axis] = box.max[axis] + margin;
+    }
+    insertLeaf(leaf);
+    numLeaves_++;
+    return leaf;
+}
+
+void AABBTree::remove(int proxy) {
+    removeLeaf(proxy);
+    freeNode(proxy);
+    numLeaves_--;
+}
+
+bool AABBTree::update(int proxy, const BBox& box) {
+    if (contains(nodes_[proxy], box))
+        return false;
+
+    int object = nodes_[proxy].object;
+    removeLeaf(proxy);
+    Node& n = nodes_[proxy];
+    for (int axis = 0; axis < 3; axis++) {
+        float margin = margin_ * (box.max[axis] - box.min[axis]);
+        n.min[axis] = box.min[axis] - margin;
+        n.max[axis] = box.max[axis] + margin;
+    }
+    n.object = object;
+    insertLeaf(proxy);
+    return true;
+}
+
+void AABBTree::insertLeaf(int leaf) {
+    if (root_ == kNullNode) {
+        root_ = leaf;
+        nodes_[leaf].parent = kNullNode;
+        return;
+    }
+
+    // descend towards the sibling that minimizes the area added to the tree: at every node,
+    // stop if pairing with the node is cheaper than the cheapest way down
+    int sibling = root_;
+    while (!nodes_[sibling].isLeaf()) {
+        const Node& node = nodes_[sibling];
+        float nodeArea = area(node.min, node.max);
+        float combinedArea = unionArea(node, nodes_[leaf]);
+
+        // the cost of a new parent here, and the area every node below grows by
+        float cost = 2.f * combinedArea;
+        float inheritanceCost = 2.f * (combinedArea - nodeArea);
+
+        float childCosts[2];
+        for (int c = 0; c < 2; c++) {
+            const Node& child = nodes_[node.child[c]];
+            float grown = unionArea(child, nodes_[leaf]);
+            if (child.isLeaf())
+                childCosts[c] = grown + inheritanceCost;
+            else
+                childCosts[c] = grown - area(child.min, child.max) + inheritanceCost;
+        }
+
+        if (cost < childCosts[0] && cost < childCosts[1])
+            break;
+        sibling = childCosts[0] < childCosts[1] ? node.child[0] : node.child[1];
+    }
+
+    // a new parent of the sibling and the leaf takes the sibling's place
+    int oldParent = nodes_[sibling].parent;
+    int newParent = allocateNode();
+    nodes_[newParent].parent = oldParent;
+    nodes_[newParent].child[0] = sibling;
+    nodes_[newParent].child[1] = leaf;
+    nodes_[sibling].parent = newParent;
+    nodes_[leaf].parent = newParent;
+    setBoxToUnion(newParent);
+
+    if (oldParent == kNullNode) {
+        root_ = newParent;
+    } else {
+        Node& parent = nodes_[oldParent];
+        parent.child[parent.child[0] == sibling ? 0 : 1] = newParent;
+    }
+
+    refitAncestors(oldParent);
+}
+
+void AABBTree::removeLeaf(int leaf) {
+    if (leaf == root_) {
+        root_ = kNullNode;
+        return;
+    }
+
+    // the leaf's sibling takes the place of their parent
+    int parent = nodes_[leaf].parent;
+    int grandParent = nodes_[parent].parent;
+    int sibling = nodes_[parent].child[nodes_[parent].child[0] == leaf ? 1 : 0];
+
+    if (grandParent == kNullNode) {
+        root_ = sibling;
+        nodes_[sibling].parent = kNullNode;
+    } else {
+        Node& g = nodes_[grandParent];
+        g.child[g.child[0] == parent ? 0 : 1] = sibling;
+        nodes_[sibling].parent = grandParent;
+    }
+    freeNode(parent);
+    nodes_[leaf].parent = kNullNode;
+
+    refitAncestors(grandParent);
+}
+
+void AABBTree::refitAncestors(int node) {
+    while (node != kNullNode) {
+        node = balance(node);
+        setBoxToUnion(node);
+        node = nodes_[node].parent;
+    }
+}
+
+int AABBTree::balance(int a) {
+    Node& nodeA = nodes_[a];
+    if (nodeA.isLeaf() || nodeA.height < 2)
+        return a;
+
+    int b = nodeA.child[0];
+    int c = nodeA.child[1];
+    int difference = nodes_[c].height - nodes_[b].height;
+    if (difference >= -1 && difference <= 1)
+        return a;
+
+    // rotate the higher child `up` above `a`, and its lower child down in its place
+    int upSide = difference > 1 ? 1 : 0;
+    int up = nodeA.child[upSide];
+    int other = nodeA.child[1 - upSide];
+    Node& nodeUp = nodes_[up];
+    int f = nodeUp.child[0];
+    int g = nodeUp.child[1];
+
+    nodeUp.child[0] = a;
+    nodeUp.parent = nodeA.parent;
+    nodeA.parent = up;
+    if (nodeUp.parent == kNullNode) {
+        root_ = up;
+    } else {
+        Node& parent = nodes_[nodeUp.parent];
+        parent.child[parent.child[0] == a ? 0 : 1] = up;
+    }
+
+    // the higher grandchild stays under `up`, the lower one goes to `a`
+    int keep = nodes_[f].height > nodes_[g].height ? f : g;
+    int give = keep == f ? g : f;
+    nodeUp.child[1] = keep;
+    nodeA.child[upSide] = give;
+    nodeA.child[1 - upSide] = other;
+    nodes_[give].parent = a;
+    setBoxToUnion(a);
+    setBoxToUnion(up);
+    return up;
+}
+
+void AABBTree::rebuild() {
+    std::vector<int> leaves;
+    leaves.reserve(numLeaves_);
+    for (int i = 0; i < (int)nodes_.size(); i++) {
+        Node& node = nodes_[i];
+        if (node.height < 0)
+            continue;
+        if (node.isLeaf())
+            leaves.push_back(i);
+        else
+            freeNode(i);
+    }
+    root_ = leaves.empty() ? kNullNode : buildSAH(leaves, 0, leaves.size());
+    if (root_ != kNullNode)
+        nodes_[root_].parent = kNullNode;
+}
+
+int AABBTree::buildSAH(std::vector<int>& leaves, int first, int last) {
+    if (last - first == 1)
+        return leaves[first];
+
+    // bin the leaves by the centers of their boxes along the longest axis of the centers
+    float centerMin[3] = {INFINITY, INFINITY, INFINITY};
+    float centerMax[3] = {-INFINITY, -INFINITY, -INFINITY};
+    for (int i = first; i < last; i++) {
+        const Node& leaf = nodes_[leaves[i]];
+        for (int axis = 0; axis < 3; axis++) {
+            float center = 0.5f * (leaf.min[axis] + leaf.max[axis]);
+            centerMin[axis] = std::min(centerMin[axis], center);
+            centerMax[axis] = std::max(centerMax[axis], center);
+        }
+    }
+    int axis = 0;
+    for (int a = 1; a < 3; a++) {
+        if (centerMax[a] - centerMin[a] > centerMax[axis] - centerMin[axis])
+            axis = a;
+    }
+    float extent = centerMax[axis] - centerMin[axis];
+
+    int mid = (first + last) / 2;
+    if (extent > 0.f) {
+        struct Bin {
+            float min[3] = {INFINITY, INFINITY, INFINITY};
+            float max[3] = {-INFINITY, -INFINITY, -INFINITY};
+            int count = 0;
+        };
+        Bin bins[kNumSAHBins];
+        auto binOf = [&](const Node& leaf) {
+            float center = 0.5f * (leaf.min[axis] + leaf.max[axis]);
+            return std::min(kNumSAHBins - 1, (int)(kNumSAHBins * (center - centerMin[axis]) / extent));
+        };
+        for (int i = first; i < last; i++) {
+            const Node& leaf = nodes_[leaves[i]];
+            Bin& bin = bins[binOf(leaf)];
+            for (int a = 0; a < 3; a++) {
+                bin.min[a] = std::min(bin.min[a], leaf.min[a]);
+                bin.max[a] = std::max(bin.max[a], leaf.max[a]);
+            }
+            bin.count++;
+        }
+
+        // the cost of splitting after bin s is the area of each side times its number of leaves
+        float rightCost[kNumSAHBins];
+        Bin right;
+        for (int s = kNumSAHBins - 1; s > 0; s--) {
+            for (int a = 0; a < 3; a++) {
+                right.min[a] = std::min(right.min[a], bins[s].min[a]);
+                right.max[a] = std::max(right.max[a], bins[s].max[a]);
+            }
+            right.count += bins[s].count;
+            rightCost[s] = right.count ? right.count * area(right.min, right.max) : 0.f;
+        }
+        Bin left;
+        float bestCost = INFINITY;
+        int bestSplit = -1;
+        for (int s = 0; s < kNumSAHBins - 1; s++) {
+            for (int a = 0; a < 3; a++) {
+                left.min[a] = std::min(left.min[a], bins[s].min[a]);
+                left.max[a] = std::max(left.max[a], bins[s].max[a]);
+            }
+            left.count += bins[s].count;
+            if (left.count == 0 || left.count == last - first)
+                continue;
+            float cost = left.count * area(left.min, left.max) + rightCost[s + 1];
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestSplit = s;
+            }
+        }
+
+        if (bestSplit >= 0) {
+            int* middle = std::partition(&leaves[first], &leaves[first] + (last - first),
+                                         [&](int leaf) { return binOf(nodes_[leaf]) <= bestSplit; });
+            mid = middle - &leaves[0];
+        }
+    }
+
+    // (leaves with the same center are split in halves)
+    int node = allocateNode();
+    int left = buildSAH(leaves, first, mid);
+    int right = buildSAH(leaves, mid, last);
+    Node& n = nodes_[node];
+    n.child[0] = left;
+    n.child[1] = right;
+    nodes_[left].parent = node;
+    nodes_[right].parent = node;
+    setBoxToUnion(node);
+    return node;
+}
+
+BBox AABBTree::getBounds() const {
+    if (root_ == kNullNode)
+        return BBox();
+    const Node& root = nodes_[root_];
+    return BBox(root.min[0], root.min[1], root.min[2], root.max[0], root.max[1], root.max[2]);
+}
+
+}  // namespace DynamicScene
+}  // namespace CS248
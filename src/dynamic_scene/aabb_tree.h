@@ -0,0 +1,241 @@
+#ifndef CS248_DYNAMICSCENE_AABB_TREE_H
+#define CS248_DYNAMICSCENE_AABB_TREE_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "CS248/vector3D.h"
+
+#include "../bbox.h"
+#include "frustum_culling.h"
+
+namespace CS248 {
+namespace DynamicScene {
+
+/**
+ * A dynamic bounding volume hierarchy over the objects of a scene. Every object is a leaf,
+ * whose box is the object's world space bounding box enlarged by a margin, so that objects
+ * moving a little stay in their leaf. When an object leaves its enlarged box, its leaf is
+ * removed and inserted again next to the leaf it adds the least area to, and the nodes above
+ * it are refit and rotated to keep the tree balanced. rebuild() instead rebuilds the whole
+ * tree top-down with the surface area heuristic, which gives better trees for static scenes.
+ *
+ * Leaves are identified by the proxy returned by insert(), and carry the index of their object.
+ */
+class AABBTree {
+ public:
+    static const int kNullNode = -1;
+
+    // `margin` is the fraction of the size of a box it is enlarged by
+    explicit AABBTree(float margin = 0.05f) : margin_(margin) {}
+
+    // adds a leaf bounding `box`, returns its proxy
+    int insert(const BBox& box, int object);
+    void remove(int proxy);
+
+    // updates the box of a leaf, moving the leaf if `box` is no longer inside its enlarged box.
+    // Returns true if the leaf was moved.
+    bool update(int proxy, const BBox& box);
+
+    // rebuilds the tree over the current leaves with the surface area heuristic
+    void rebuild();
+
+    int getObject(int proxy) const { return nodes_[proxy].object; }
+    int getNumLeaves() const { return numLeaves_; }
+    int getHeight() const { return root_ == kNullNode ? 0 : nodes_[root_].height; }
+
+    // the box around all leaves (empty if there are none)
+    BBox getBounds() const;
+
+    // Calls callback(object) for the leaves whose box intersects `box`. Returns the number of
+    // nodes visited.
+    template <typename Callback>
+    int queryBox(const BBox& box, Callback callback) const;
+
+    // Calls callback(object, inside) for the leaves whose box intersects `frustum`, with `inside`
+    // true if the box is entirely inside it (only the others need a finer test). Returns the
+    // number of nodes visited.
+    template <typename Callback>
+    int queryFrustum(const Frustum& frustum, Callback callback) const;
+
+    // Calls callback(object, tMax) for the leaves whose box the ray origin + t * direction enters
+    // at some t in [0, tMax]. The callback returns the new tMax, e.g. the distance to a hit found
+    // in the object when looking for the closest one. Returns the number of nodes visited.
+    template <typename Callback>
+    int queryRay(const Vector3D& origin, const Vector3D& direction, float tMax, Callback callback) const;
+
+ private:
+    struct Node {
+        float min[3];
+        float max[3];
+        int   parent;     // or the next free node, for free nodes
+        int   child[2];   // kNullNode for leaves
+        int   height;     // 0 for leaves
+        int   object;     // object of a leaf
+        bool isLeaf() const { return child[0] == kNullNode; }
+    };
+
+    int allocateNode();
+    void freeNode(int node);
+    void insertLeaf(int leaf);
+    void removeLeaf(int leaf);
+    // refits the boxes and heights of `node` and its ancestors, rotating unbalanced nodes
+    void refitAncestors(int node);
+    // rotates the higher grandchild of `node` up if its children differ in height by more
+    // than one, and returns the node now at its place
+    int balance(int node);
+    void setBoxToUnion(int node);
+    // builds a subtree over leaves[first, last) with the surface area heuristic
+    int buildSAH(std::vector<int>& leaves, int first, int last);
+
+    static float area(const float min[3], const float max[3]);
+    static float unionArea(const Node& a, const Node& b);
+    static bool contains(const Node& outer, const BBox& box);
+
+    std::vector<Node> nodes_;
+    int root_ = kNullNode;
+    int freeList_ = kNullNode;
+    int numLeaves_ = 0;
+    float margin_;
+};
+
+template <typename Callback>
+int AABBTree::queryBox(const BBox& box, Callback callback) const {
+    if (root_ == kNullNode)
+        return 0;
+
+    int numVisited = 0;
+    std::vector<int> stack;
+    stack.reserve(64);
+    stack.push_back(root_);
+    while (!stack.empty()) {
+        const Node& node = nodes_[stack.back()];
+        stack.pop_back();
+        numVisited++;
+
+        bool overlaps = true;
+        for (int axis = 0; axis < 3; axis++)
+            overlaps &= node.min[axis] <= box.max[axis] && node.max[axis] >= box.min[axis];
+        if (!overlaps)
+            continue;
+
+        if (node.isLeaf()) {
+            callback(node.object);
+        } else {
+            stack.push_back(node.child[0]);
+            stack.push_back(node.child[1]);
+        }
+    }
+    return numVisited;
+}
+
+template <typename Callback>
+int AABBTree::queryFrustum(const Frustum& frustum, Callback callback) const {
+    if (root_ == kNullNode)
+        return 0;
+
+    // each entry is a node and the mask of the planes its parent straddles: a node inside a
+    // plane has all its descendants inside it, so they are not tested against it again
+    struct Entry {
+        int node;
+        int planeMask;
+    };
+    int numVisited = 0;
+    std::vector<Entry> stack;
+    stack.reserve(64);
+    stack.push_back({root_, 0x3f});
+    while (!stack.empty()) {
+        Entry entry = stack.back();
+        stack.pop_back();
+        const Node& node = nodes_[entry.node];
+        numVisited++;
+
+        int planeMask = 0;
+        bool outside = false;
+        for (int p = 0; p < 6 && !outside; p++) {
+            if (!(entry.planeMask & (1 << p)))
+                continue;
+            const float* plane = frustum.planes[p];
+            float centerDistance = plane[3];
+            float radius = 0.f;
+            for (int axis = 0; axis < 3; axis++) {
+                centerDistance += plane[axis] * 0.5f * (node.min[axis] + node.max[axis]);
+                radius += std::fabs(plane[axis]) * 0.5f * (node.max[axis] - node.min[axis]);
+            }
+            if (centerDistance + radius < 0.f)
+                outside = true;
+            else if (centerDistance - radius < 0.f)
+                planeMask |= 1 << p;
+        }
+        if (outside)
+            continue;
+
+        if (planeMask == 0) {
+            // entirely inside: report every leaf below without testing it
+            std::vector<int> subtree(1, entry.node);
+            while (!subtree.empty()) {
+                const Node& inner = nodes_[subtree.back()];
+                subtree.pop_back();
+                if (inner.isLeaf()) {
+                    callback(inner.object, true);
+                } else {
+                    subtree.push_back(inner.child[0]);
+                    subtree.push_back(inner.child[1]);
+                    numVisited += 2;
+                }
+            }
+        } else if (node.isLeaf()) {
+            callback(node.object, false);
+        } else {
+            stack.push_back({node.child[0], planeMask});
+            stack.push_back({node.child[1], planeMask});
+        }
+    }
+    return numVisited;
+}
+
+template <typename Callback>
+int AABBTree::queryRay(const Vector3D& origin, const Vector3D& direction, float tMax, Callback callback) const {
+    if (root_ == kNullNode)
+        return 0;
+
+    float invDirection[3];
+    for (int axis = 0; axis < 3; axis++)
+        invDirection[axis] = 1.f / direction[axis];
+
+    int numVisited = 0;
+    std::vector<int> stack;
+    stack.reserve(64);
+    stack.push_back(root_);
+    while (!stack.empty()) {
+        const Node& node = nodes_[stack.back()];
+        stack.pop_back();
+        numVisited++;
+
+        // slab test (a zero direction component gives infinite slab distances, as it should)
+        float tEnter = 0.f;
+        float tExit = tMax;
+        for (int axis = 0; axis < 3; axis++) {
+            float t0 = (node.min[axis] - origin[axis]) * invDirection[axis];
+            float t1 = (node.max[axis] - origin[axis]) * invDirection[axis];
+            tEnter = std::max(tEnter, std::min(t0, t1));
+            tExit = std::min(tExit, std::max(t0, t1));
+        }
+        if (tEnter > tExit)
+            continue;
+
+        if (node.isLeaf()) {
+            tMax = callback(node.object, tMax);
+        } else {
+            stack.push_back(node.child[0]);
+            stack.push_back(node.child[1]);
+        }
+    }
+    return numVisited;
+}
+
+}  // namespace DynamicScene
+}  // namespace CS248
+
+#endif  // CS248_DYNAMICSCENE_AABB_TREE_H
@@ -0,0 +1,216 @@
+#include "frustum_culling.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define CS248_CULLING_SSE
+#endif
+
+namespace CS248 {
+namespace DynamicScene {
+
+// static
+Frustum Frustum::fromWorldToNDC(const Matrix4x4& worldToNDC) {
+    // The planes are sums and differences of the rows of the matrix: a point p is inside
+    // if -w <= x, y, z <= w, with (x, y, z, w) = worldToNDC * p.
+    Frustum frustum;
+    for (int axis = 0; axis < 3; axis++) {
+        for (int side = 0; side < 2; side++) {
+            float sign = side == 0 ? 1.f : -1.f;
+            for (int j = 0; j < 4; j++)
+                frustum.planes[2 * axis + side][j] = worldToNDC(3, j) + sign * worldToNDC(axis, j);
+        }
+    }
+    return frustum;
+}
+
+bool Frustum::intersects(const BBox& box) const {
+    if (box.min.x > box.max.x)
+        return false;
+    for (int p = 0; p < 6; p++) {
+        const float* plane = planes[p];
+        float distance = plane[3];
+        for (int axis = 0; axis < 3; axis++) {
+            // the corner of the box furthest along the plane normal
+            distance += plane[axis] * (plane[axis] >= 0.f ? box.max[axis] : box.min[axis]);
+        }
+        if (distance < 0.f)
+            return false;
+    }
+    return true;
+}
+
+void CullingBounds::resize(int numObjects) {
+    size_ = numObjects;
+    int paddedSize = (numObjects + 3) / 4 * 4;
+    for (int axis = 0; axis < 3; axis++) {
+        boxCenter_[axis].assign(paddedSize, 0.f);
+        boxHalfExtent_[axis].assign(paddedSize, 0.f);
+        sphereCenter_[axis].assign(paddedSize, 0.f);
+    }
+    sphereRadius_.assign(paddedSize, 0.f);
+}
+
+void CullingBounds::set(int index, const BBox& box, const Vector3D& sphereCenter, float sphereRadius) {
+    for (int axis = 0; axis < 3; axis++) {
+        boxCenter_[axis][index] = 0.5 * (box.min[axis] + box.max[axis]);
+        boxHalfExtent_[axis][index] = 0.5 * (box.max[axis] - box.min[axis]);
+        sphereCenter_[axis][index] = sphereCenter[axis];
+    }
+    sphereRadius_[index] = sphereRadius;
+}
+
+#ifdef CS248_CULLING_SSE
+
+namespace {
+
+// the planes of a frustum, and the absolute values of their normals, broadcast to all four lanes
+struct FrustumSSE {
+    __m128 planes[6][4];
+    __m128 absNormals[6][3];
+
+    explicit FrustumSSE(const Frustum& frustum) {
+        for (int p = 0; p < 6; p++) {
+            for (int j = 0; j < 4; j++)
+                planes[p][j] = _mm_set1_ps(frustum.planes[p][j]);
+            for (int j = 0; j < 3; j++)
+                absNormals[p][j] = _mm_set1_ps(std::fabs(frustum.planes[p][j]));
+        }
+    }
+};
+
+// the bounds of four objects, one per lane
+struct BoundsSSE {
+    __m128 boxCenter[3];
+    __m128 boxHalfExtent[3];
+    __m128 sphereCenter[3];
+    __m128 sphereRadius;
+};
+
+// returns the mask of the lanes whose bounds may be visible
+int visibleLanes(const FrustumSSE& frustum, const BoundsSSE& bounds) {
+    const __m128 zero = _mm_setzero_ps();
+    __m128 inside = _mm_cmpeq_ps(zero, zero);
+    for (int p = 0; p < 6; p++) {
+        // signed distances of the box's corner farthest along the normal, and of the
+        // sphere's farthest point, to the plane
+        const __m128* plane = frustum.planes[p];
+        const __m128* absNormal = frustum.absNormals[p];
+        __m128 boxDistance = _mm_add_ps(
+            _mm_add_ps(_mm_add_ps(_mm_mul_ps(plane[0], bounds.boxCenter[0]), _mm_mul_ps(plane[1], bounds.boxCenter[1])),
+                       _mm_add_ps(_mm_mul_ps(plane[2], bounds.boxCenter[2]), plane[3])),
+            _mm_add_ps(_mm_add_ps(_mm_mul_ps(absNormal[0], bounds.boxHalfExtent[0]), _mm_mul_ps(absNormal[1], bounds.boxHalfExtent[1])),
+                       _mm_mul_ps(absNormal[2], bounds.boxHalfExtent[2])));
+        __m128 sphereDistance = _mm_add_ps(
+            _mm_add_ps(_mm_add_ps(_mm_mul_ps(plane[0], bounds.sphereCenter[0]), _mm_mul_ps(plane[1], bounds.sphereCenter[1])),
+                       _mm_add_ps(_mm_mul_ps(plane[2], bounds.sphereCenter[2]), plane[3])),
+            bounds.sphereRadius);
+        inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_min_ps(boxDistance, sphereDistance), zero));
+    }
+    return _mm_movemask_ps(inside);
+}
+
+}  // namespace
+
+#endif
+
+bool CullingBounds::isVisible(const Frustum& frustum, int i) const {
+    for (int p = 0; p < 6; p++) {
+        const float* plane = frustum.planes[p];
+        float boxDistance = plane[3];
+        float sphereDistance = plane[3] + sphereRadius_[i];
+        for (int axis = 0; axis < 3; axis++) {
+            boxDistance += plane[axis] * boxCenter_[axis][i] + std::fabs(plane[axis]) * boxHalfExtent_[axis][i];
+            sphereDistance += plane[axis] * sphereCenter_[axis][i];
+        }
+        if (std::min(boxDistance, sphereDistance) < 0.f)
+            return false;
+    }
+    return true;
+}
+
+int CullingBounds::cull(const Frustum& frustum, unsigned char* visible) const {
+
+    int numVisible = 0;
+
+#ifdef CS248_CULLING_SSE
+
+    FrustumSSE frustumSSE(frustum);
+    for (int i = 0; i < size_; i += 4) {
+        BoundsSSE bounds;
+        for (int axis = 0; axis < 3; axis++) {
+            bounds.boxCenter[axis] = _mm_loadu_ps(&boxCenter_[axis][i]);
+            bounds.boxHalfExtent[axis] = _mm_loadu_ps(&boxHalfExtent_[axis][i]);
+            bounds.sphereCenter[axis] = _mm_loadu_ps(&sphereCenter_[axis][i]);
+        }
+        bounds.sphereRadius = _mm_loadu_ps(&sphereRadius_[i]);
+
+        int mask = visibleLanes(frustumSSE, bounds);
+        for (int lane = 0; lane < 4 && i + lane < size_; lane++) {
+            visible[i + lane] = (mask >> lane) & 1;
+            numVisible += visible[i + lane];
+        }
+    }
+
+#else
+
+    for (int i = 0; i < size_; i++) {
+        visible[i] = isVisible(frustum, i);
+        numVisible += visible[i];
+    }
+
+#endif
+
+    return numVisible;
+}
+
+int CullingBounds::cull(const Frustum& frustum, const int* objects, int count, unsigned char* visible) const {
+
+    int numVisible = 0;
+
+#ifdef CS248_CULLING_SSE
+
+    // the bounds of the objects are gathered four at a time (the last group repeats its last object)
+    FrustumSSE frustumSSE(frustum);
+    for (int k = 0; k < count; k += 4) {
+        int i[4];
+        for (int lane = 0; lane < 4; lane++)
+            i[lane] = objects[std::min(k + lane, count - 1)];
+
+        BoundsSSE bounds;
+        for (int axis = 0; axis < 3; axis++) {
+            const float* boxCenter = boxCenter_[axis].data();
+            const float* boxHalfExtent = boxHalfExtent_[axis].data();
+            const float* sphereCenter = sphereCenter_[axis].data();
+            bounds.boxCenter[axis] = _mm_setr_ps(boxCenter[i[0]], boxCenter[i[1]], boxCenter[i[2]], boxCenter[i[3]]);
+            bounds.boxHalfExtent[axis] = _mm_setr_ps(boxHalfExtent[i[0]], boxHalfExtent[i[1]],
+                                                     boxHalfExtent[i[2]], boxHalfExtent[i[3]]);
+            bounds.sphereCenter[axis] = _mm_setr_ps(sphereCenter[i[0]], sphereCenter[i[1]],
+                                                    sphereCenter[i[2]], sphereCenter[i[3]]);
+        }
+        const float* radius = sphereRadius_.data();
+        bounds.sphereRadius = _mm_setr_ps(radius[i[0]], radius[i[1]], radius[i[2]], radius[i[3]]);
+
+        int mask = visibleLanes(frustumSSE, bounds);
+        for (int lane = 0; lane < 4 && k + lane < count; lane++) {
+            visible[i[lane]] = (mask >> lane) & 1;
+            numVisible += visible[i[lane]];
+        }
+    }
+
+#else
+
+    for (int k = 0; k < count; k++) {
+        visible[objects[k]] = isVisible(frustum, objects[k]);
+        numVisible += visible[objects[k]];
+    }
+
+#endif
+
+    return numVisible;
+}
+
+}  // namespace DynamicScene
+}  // namespace CS248
@@ -0,0 +1,67 @@
+#ifndef CS248_DYNAMICSCENE_FRUSTUM_CULLING_H
+#define CS248_DYNAMICSCENE_FRUSTUM_CULLING_H
+
+#include <vector>
+
+#include "CS248/matrix4x4.h"
+#include "CS248/vector3D.h"
+
+#include "../bbox.h"
+
+namespace CS248 {
+namespace DynamicScene {
+
+// The view frustum of a worldToNDC transform, as the six planes bounding the points it maps
+// into the NDC cube. A point p is inside where dot(plane.xyz, p) + plane.w >= 0 for every plane.
+struct Frustum {
+    float planes[6][4];
+
+    static Frustum fromWorldToNDC(const Matrix4x4& worldToNDC);
+
+    // false if `box` lies entirely outside one of the planes (so it may be true of some boxes
+    // outside the frustum, near its corners)
+    bool intersects(const BBox& box) const;
+};
+
+/**
+ * The world space bounds of the objects of a scene, tested against view frustums on the CPU.
+ * Every object has a bounding box and a bounding sphere, and is culled if either lies entirely
+ * outside one of the planes of the frustum: the sphere is tighter than the box for rotated
+ * objects, and the box for long thin ones.
+ *
+ * The bounds are stored as arrays of coordinates, so that the test handles four objects at a
+ * time with SSE instructions (or one at a time where SSE is not available).
+ */
+class CullingBounds {
+ public:
+    int size() const { return size_; }
+    void resize(int numObjects);
+
+    void set(int index, const BBox& box, const Vector3D& sphereCenter, float sphereRadius);
+
+    // sets visible[i] to 1 if object i may be visible in `frustum`, and to 0 otherwise
+    // (`visible` has size() elements). Returns the number of visible objects.
+    int cull(const Frustum& frustum, unsigned char* visible) const;
+
+    // same as above, for the `count` objects listed in `objects` only (the other elements of
+    // `visible` are left unchanged)
+    int cull(const Frustum& frustum, const int* objects, int count, unsigned char* visible) const;
+
+ private:
+    // the test of one object
+    bool isVisible(const Frustum& frustum, int i) const;
+
+    int size_ = 0;
+
+    // box centers and half extents, and sphere centers and radii, padded to a multiple of four
+    // objects with empty bounds at the origin
+    std::vector<float> boxCenter_[3];
+    std::vector<float> boxHalfExtent_[3];
+    std::vector<float> sphereCenter_[3];
+    std::vector<float> sphereRadius_;
+};
+
+}  // namespace DynamicScene
+}  // namespace CS248
+
+#endif  // CS248_DYNAMICSCENE_FRUSTUM_CULLING_H
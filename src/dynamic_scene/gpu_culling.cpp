@@ -0,0 +1,186 @@
+#include "gpu_culling.h"
+
+#include "../frame_stats.h"
+#include "../gl_utils.h"
+#include "../shader.h"
+#include "frustum_culling.h"
+
+using namespace std;
+
+namespace CS248 {
+namespace DynamicScene {
+
+namespace {
+
+// must match MAX_OBJECTS_PER_TRANSFORM_CHUNK and local_size_x in cull.comp
+const int kObjectsPerChunk = 128;
+const int kWorkGroupSize = 64;
+
+int alignUp(int size, int alignment) {
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+}  // namespace
+
+// static
+bool GpuCuller::isSupported() {
+    static int supported = -1;
+    if (supported < 0) {
+        // storage blocks are optional in vertex shaders, even with GL 4.3
+        GLint vertexStorageBlocks = 0;
+        if (GLEW_VERSION_4_3)
+            glGetIntegerv(GL_MAX_VERTEX_SHADER_STORAGE_BLOCKS, &vertexStorageBlocks);
+        supported = GLEW_VERSION_4_3 && GLEW_ARB_shader_storage_buffer_object && vertexStorageBlocks > 0;
+    }
+    return supported;
+}
+
+GpuCuller::GpuCuller(const std::string& baseShaderDir, int numObjects, const std::vector<Batch>& batches,
+                     const std::vector<DrawElementsIndirectCommand>& commands, int numSlots)
+    : baseShaderDir_(baseShaderDir), numObjects_(numObjects), numBatches_(batches.size()),
+      numCommands_(commands.size()), gl_mgr_(GLResourceManager::instance()) {
+
+    checkGLError("begin GpuCuller constructor");
+
+    cullProgram_ = createProgram("CULL_OBJECTS");
+    commandsProgram_ = createProgram("WRITE_COMMANDS");
+
+    // the per-scene data: the batch of every object and command, and where each batch lists its
+    // visible objects, within the chunk of the batch
+    int alignment = gl_mgr_->getStorageBufferOffsetAlignment();
+    visibleObjectsChunkStride_ = alignUp(kObjectsPerChunk * sizeof(GLint), alignment);
+    int numChunks = (numObjects + kObjectsPerChunk - 1) / kObjectsPerChunk;
+
+    // the objects of no batch (those drawn without indirect commands) are skipped by the culling
+    cullObjects_.resize(numObjects);
+    for (CullObject& object : cullObjects_)
+        object.batch = -1;
+    std::vector<GLint> batchVisibleBases(numBatches_);
+    std::vector<GLint> commandBatches(numCommands_);
+    for (int b = 0; b < numBatches_; b++) {
+        const Batch& batch = batches[b];
+        for (int i = batch.firstObject; i < batch.firstObject + batch.numObjects; i++)
+            cullObjects_[i].batch = b;
+        int chunk = batch.firstObject / kObjectsPerChunk;
+        batchVisibleBases[b] = chunk * visibleObjectsChunkStride_ / sizeof(GLint) + batch.firstObject % kObjectsPerChunk;
+        for (int c = batch.firstShadowCommand; c < batch.firstShadowCommand + batch.numShadowCommands; c++)
+            commandBatches[c] = b;
+        for (int c = batch.firstCommand; c < batch.firstCommand + batch.numCommands; c++)
+            commandBatches[c] = b;
+    }
+
+    cullObjectsBufferId_ = gl_mgr_->createStorageBuffer(cullObjects_.data(), numObjects * sizeof(CullObject));
+    batchesBufferId_ = gl_mgr_->createStorageBuffer(batchVisibleBases.data(), numBatches_ * sizeof(GLint));
+    commandBatchesBufferId_ = gl_mgr_->createStorageBuffer(commandBatches.data(), numCommands_ * sizeof(GLint));
+
+    // the per-pass results
+    batchCountsSlotStride_ = alignUp(numBatches_ * sizeof(GLuint), alignment);
+    visibleObjectsSlotStride_ = numChunks * visibleObjectsChunkStride_;
+    commandsSlotStride_ = alignUp(numCommands_ * sizeof(DrawElementsIndirectCommand), alignment);
+    batchCountsBufferId_ = gl_mgr_->createStorageBuffer(NULL, numSlots * batchCountsSlotStride_);
+    visibleObjectsBufferId_ = gl_mgr_->createStorageBuffer(NULL, numSlots * visibleObjectsSlotStride_);
+    commandsBufferId_ = gl_mgr_->createStorageBuffer(NULL, numSlots * commandsSlotStride_);
+    for (int slot = 0; slot < numSlots; slot++) {
+        gl_mgr_->updateStorageBuffer(commandsBufferId_, commands.data(),
+                                     numCommands_ * sizeof(DrawElementsIndirectCommand), slot * commandsSlotStride_);
+    }
+
+    labelGLObject(GL_BUFFER, cullObjectsBufferId_.id, "culling objects");
+    labelGLObject(GL_BUFFER, batchesBufferId_.id, "culling batches");
+    labelGLObject(GL_BUFFER, commandBatchesBufferId_.id, "culling command batches");
+    labelGLObject(GL_BUFFER, batchCountsBufferId_.id, "culling batch counts");
+    labelGLObject(GL_BUFFER, visibleObjectsBufferId_.id, "culling visible objects");
+    labelGLObject(GL_BUFFER, commandsBufferId_.id, "culling indirect commands");
+
+    printf("GPU culling: %d objects in %d batches, drawn by %d indirect commands\n",
+           numObjects_, numBatches_, numCommands_);
+
+    checkGLError("end GpuCuller constructor");
+}
+
+GpuCuller::~GpuCuller() {
+    gl_mgr_->freeStorageBuffer(cullObjectsBufferId_);
+    gl_mgr_->freeStorageBuffer(batchesBufferId_);
+    gl_mgr_->freeStorageBuffer(commandBatchesBufferId_);
+    gl_mgr_->freeStorageBuffer(batchCountsBufferId_);
+    gl_mgr_->freeStorageBuffer(visibleObjectsBufferId_);
+    gl_mgr_->freeStorageBuffer(commandsBufferId_);
+}
+
+GpuCuller::ComputeProgram GpuCuller::createProgram(const char* define) {
+    ComputeProgram result;
+    result.shader = ShaderCache::instance()->getCompute(baseShaderDir_ + "/cull.comp", {define});
+    result.numItems = result.shader->getUniform("num_items");
+    for (int i = 0; i < 6; i++)
+        result.frustumPlanes[i] = result.shader->getUniform("frustum_planes[" + std::to_string(i) + "]");
+    return result;
+}
+
+void GpuCuller::updateBounds(const std::vector<BBox>& bounds) {
+    for (int i = 0; i < numObjects_; i++) {
+        CullObject& object = cullObjects_[i];
+        for (int axis = 0; axis < 3; axis++) {
+            object.bboxMin[axis] = bounds[i].min[axis];
+            object.bboxMax[axis] = bounds[i].max[axis];
+        }
+    }
+    gl_mgr_->updateStorageBuffer(cullObjectsBufferId_, cullObjects_.data(), numObjects_ * sizeof(CullObject));
+}
+
+void GpuCuller::bindForCulling(int slot) {
+    gl_mgr_->bindStorageBufferRange(cullObjectsBufferId_, CULL_OBJECTS_STORAGE_BLOCK, 0, numObjects_ * sizeof(CullObject));
+    gl_mgr_->bindStorageBufferRange(batchesBufferId_, BATCHES_STORAGE_BLOCK, 0, numBatches_ * sizeof(GLint));
+    gl_mgr_->bindStorageBufferRange(commandBatchesBufferId_, COMMAND_BATCHES_STORAGE_BLOCK, 0, numCommands_ * sizeof(GLint));
+    gl_mgr_->bindStorageBufferRange(batchCountsBufferId_, BATCH_COUNTS_STORAGE_BLOCK,
+                                    slot * batchCountsSlotStride_, numBatches_ * sizeof(GLuint));
+    gl_mgr_->bindStorageBufferRange(visibleObjectsBufferId_, VISIBLE_OBJECTS_STORAGE_BLOCK,
+                                    slot * visibleObjectsSlotStride_, visibleObjectsSlotStride_);
+    gl_mgr_->bindStorageBufferRange(commandsBufferId_, COMMANDS_STORAGE_BLOCK,
+                                    slot * commandsSlotStride_, numCommands_ * sizeof(DrawElementsIndirectCommand));
+}
+
+void GpuCuller::cull(int slot, const Matrix4x4& worldToNDC) {
+
+    checkGLError("begin GpuCuller::cull");
+
+    Frustum frustum = Frustum::fromWorldToNDC(worldToNDC);
+
+    gl_mgr_->clearStorageBuffer(batchCountsBufferId_, slot * batchCountsSlotStride_, numBatches_ * sizeof(GLuint));
+    bindForCulling(slot);
+
+    {
+        auto shader_bind = cullProgram_.shader->bind();
+        cullProgram_.shader->setScalarParameter(cullProgram_.numItems, numObjects_);
+        for (int i = 0; i < 6; i++) {
+            const float* plane = frustum.planes[i];
+            cullProgram_.shader->setVectorParameter(cullProgram_.frustumPlanes[i],
+                                                    Vector4D(plane[0], plane[1], plane[2], plane[3]));
+        }
+        glDispatchCompute((numObjects_ + kWorkGroupSize - 1) / kWorkGroupSize, 1, 1);
+    }
+
+    // the counts are complete before the commands read them
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    {
+        auto shader_bind = commandsProgram_.shader->bind();
+        commandsProgram_.shader->setScalarParameter(commandsProgram_.numItems, numCommands_);
+        glDispatchCompute((numCommands_ + kWorkGroupSize - 1) / kWorkGroupSize, 1, 1);
+    }
+
+    // and the commands and visible objects before the draws read them
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+    FrameStats::current().computeDispatches += 2;
+
+    checkGLError("end GpuCuller::cull");
+}
+
+void GpuCuller::bindForDraw(int slot, int chunk) {
+    gl_mgr_->bindStorageBufferRange(visibleObjectsBufferId_, VISIBLE_OBJECTS_STORAGE_BLOCK,
+                                    slot * visibleObjectsSlotStride_ + chunk * visibleObjectsChunkStride_,
+                                    kObjectsPerChunk * sizeof(GLint));
+    gl_mgr_->setDrawIndirectBuffer(commandsBufferId_);
+}
+
+}  // namespace DynamicScene
+}  // namespace CS248
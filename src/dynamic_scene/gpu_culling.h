@@ -0,0 +1,128 @@
+#ifndef CS248_DYNAMICSCENE_GPU_CULLING_H
+#define CS248_DYNAMICSCENE_GPU_CULLING_H
+
+#include <string>
+#include <vector>
+
+#include "CS248/matrix4x4.h"
+
+#include "GL/glew.h"
+
+#include "../bbox.h"
+#include "../gl_resource_manager.h"
+#include "../shader.h"
+
+namespace CS248 {
+namespace DynamicScene {
+
+// The parameters of one glDrawElementsIndirect call, as laid out in a draw indirect buffer
+struct DrawElementsIndirectCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint  baseVertex;
+    GLuint baseInstance;
+};
+
+/**
+ * Frustum culling on the GPU. The objects of the scene are drawn in batches of instances (see
+ * Scene::InstanceBatch), each with a few indirect draw commands. Before a pass is drawn, a compute
+ * shader tests the bounding box of every object against the frustum of the pass and lists the
+ * visible objects of each batch; a second one sets the instance count of every command to the
+ * number of visible objects of its batch. The vertex shaders then read the transforms of the
+ * visible objects through the list (see the "VisibleObjects" block), so the CPU neither tests nor
+ * reads back anything per object. The commands of a batch are drawn by one multi-draw, and so are
+ * the shadow commands of consecutive batches sharing a vertex array (see Scene::drawObjects).
+ *
+ * Every pass of a frame (the camera, then the shadowed lights) has its own slot of results, so a
+ * pass does not overwrite what an earlier one is still drawing with.
+ */
+class GpuCuller {
+ public:
+    // true if the GL has compute shaders, storage blocks in vertex shaders and indirect draws (GL 4.3)
+    static bool isSupported();
+
+    // the preprocessor symbol making the vertex shaders read the transforms of the visible objects
+    static const char* shaderDefine() { return SHADER_GPU_CULLING_DEFINE; }
+
+    // A run of consecutive objects, in one transform chunk, drawn by the same commands (those of
+    // the shadow passes and those of the main pass)
+    struct Batch {
+        int firstObject;
+        int numObjects;
+        int firstShadowCommand;
+        int numShadowCommands;
+        int firstCommand;
+        int numCommands;
+    };
+
+    // `commands` are the commands of all batches, with their instance counts left at zero
+    GpuCuller(const std::string& baseShaderDir, int numObjects, const std::vector<Batch>& batches,
+              const std::vector<DrawElementsIndirectCommand>& commands, int numSlots);
+    ~GpuCuller();
+
+    // uploads the world space bounding box of every object, once per frame
+    void updateBounds(const std::vector<BBox>& bounds);
+
+    // culls the objects against the frustum of `worldToNDC`, into the results of pass `slot`
+    void cull(int slot, const Matrix4x4& worldToNDC);
+
+    // makes the results of pass `slot` the source of the draws of the objects of a transform
+    // chunk: the chunk's visible objects feed the "VisibleObjects" block, and the commands the
+    // draw indirect buffer
+    void bindForDraw(int slot, int chunk);
+
+    // the `indirect` argument of glMultiDrawElementsIndirect for a command of pass `slot`
+    const void* commandOffset(int slot, int command) const {
+        return (const void*)(size_t)(slot * commandsSlotStride_ + command * sizeof(DrawElementsIndirectCommand));
+    }
+
+ private:
+    // cull.comp compiled with a define, and the handles to its uniforms. The shaders come from the
+    // ShaderCache, which reloads them with the others.
+    struct ComputeProgram {
+        Shader*       shader;
+        UniformHandle numItems;
+        UniformHandle frustumPlanes[6];
+    };
+    ComputeProgram createProgram(const char* define);
+
+    // binds the storage blocks read and written by the compute shaders for pass `slot`
+    void bindForCulling(int slot);
+
+    std::string baseShaderDir_;
+    int numObjects_;
+    int numBatches_;
+    int numCommands_;
+
+    ComputeProgram cullProgram_;
+    ComputeProgram commandsProgram_;
+
+    // storage buffers, see cull.comp. The last three hold one slot per pass.
+    StorageBufferId cullObjectsBufferId_;
+    StorageBufferId batchesBufferId_;
+    StorageBufferId commandBatchesBufferId_;
+    StorageBufferId batchCountsBufferId_;
+    StorageBufferId visibleObjectsBufferId_;
+    StorageBufferId commandsBufferId_;
+    int batchCountsSlotStride_;
+    int visibleObjectsSlotStride_;
+    int visibleObjectsChunkStride_;
+    int commandsSlotStride_;
+
+    // host copy of the "CullObjects" block, whose bounds are updated every frame
+    struct CullObject {
+        float bboxMin[3];
+        int   batch;        // -1 if the object is in no batch
+        float bboxMax[3];
+        int   pad;
+    };
+    std::vector<CullObject> cullObjects_;
+
+    GLResourceManager* gl_mgr_;
+};
+
+}  // namespace DynamicScene
+}  // namespace CS248
+
+#endif  // CS248_DYNAMICSCENE_GPU_CULLING_H
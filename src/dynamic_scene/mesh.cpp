@@ -1,13 +1,15 @@
 #include "mesh.h"
-#include "CS248/lodepng.h"
 
+#include <algorithm>
 #include <cassert>
+#include <functional>
 #include <sstream>
 
 #include "../static_scene/object.h"
 #include "../static_scene/light.h"
 
 #include "../application.h"
+#include "../frame_stats.h"
 #include "../gl_utils.h"
 
 using namespace std;
@@ -26,6 +28,7 @@ Mesh::Mesh(Collada::PolymeshInfo& polyMesh, const Matrix4x4& transform) {
 	doEnvironmentMapping_ = false;
 	useMirrorBrdf_ = polyMesh.is_mirror_brdf;
 	phongSpecExponent_ = polyMesh.phong_spec_exp;
+	isStatic_ = polyMesh.is_static;
 
     //printf("Mesh details:\n");
     //printf("   num polys:     %lu\n", polyMesh.polygons.size());
@@ -43,185 +46,19 @@ Mesh::Mesh(Collada::PolymeshInfo& polyMesh, const Matrix4x4& transform) {
     position_ = Vector3D(transform[3][0], transform[3][1], transform[3][2]);
     scale_ = Vector3D(transform[0][0], transform[1][1], transform[2][2]);
 
+	// the geometry and shader are shared by all meshes placing the same file with the same shaders
+	MeshAssetRegistry* registry = MeshAssetRegistry::instance();
+	asset_ = registry->getAsset(polyMesh);
 
-    // FIXME(kayvonf): I do not understand why we are copying data from the PolyMesh structure
-    // into local variables below (step 1), and then copying the results into the non-indexed
-    // buffers (step 2). Step 2 could be completed directly from the PolyMesh structure.
-   
-    // Step 1: 
-    //
-    // Copy data from polyMesh structure to local variables
-    //
-
-    numTriangles_ = polyMesh.polygons.size();
-
-    vector<Vector3Df> positions;
-    vector<Vector3Df> normals;
-    vector<Vector2Df> textureCoordinates;
-    vector<Vector3Df> diffuseColors;  // (this is per face data)
-
-	positions.reserve(polyMesh.vertices.size());
-	normals.reserve(polyMesh.normals.size());
-	textureCoordinates.reserve(polyMesh.texcoords.size());
-	diffuseColors.reserve(polyMesh.polygons.size()); // one per face?
-
-	for (int i = 0; i < polyMesh.vertices.size(); ++i) {
-		Vector3Df v;
-		v.x = polyMesh.vertices[i].x;
-		v.y = polyMesh.vertices[i].y;
-		v.z = polyMesh.vertices[i].z;
-		positions.push_back(v);
-	}
-	for (int i = 0; i < polyMesh.normals.size(); ++i) {
-		Vector3Df v;
-		v.x = polyMesh.normals[i].x;
-		v.y = polyMesh.normals[i].y;
-		v.z = polyMesh.normals[i].z;
-		normals.push_back(v);
-	}
-	for (int i = 0; i < polyMesh.texcoords.size(); ++i) {
-		Vector2Df v;
-		v.x = polyMesh.texcoords[i].x;
-		v.y = polyMesh.texcoords[i].y;
-		textureCoordinates.push_back(v);
-	}
-	for (int i = 0; i < polyMesh.polygons.size(); ++i) {
-		Vector3Df v;
-		v.x = polyMesh.material_diffuse_parameters[i].x;
-		v.y = polyMesh.material_diffuse_parameters[i].y;
-		v.z = polyMesh.material_diffuse_parameters[i].z;
-		diffuseColors.push_back(v);
-	}
-
-	//
-	// Step 2:
-	// 
-    // These are the buffers that will be handed to glVertexArray calls.
-    // Allocate and populate them here.  They are a non-indexed representation, in that there are
-    // three values per polygon.
-
-	positionData_.reserve(3 * numTriangles_);
-	normalData_.reserve(3 * numTriangles_);
-	diffuseColorData_.reserve(3 * numTriangles_);
-	texcoordData_.reserve(3 * numTriangles_);
-	tangentData_.reserve(3 * numTriangles_);
-
-    // populate buffers for vertex position, normal, diffuse color, and texcoord
-	for (int i = 0; i < numTriangles_; ++i) {
-		for (int j = 0; j < 3; ++j) {
-  			positionData_.push_back(positions[polyMesh.polygons[i].vertex_indices[j]]);
-            normalData_.push_back(normals[polyMesh.polygons[i].normal_indices[j]]);
-	        diffuseColorData_.push_back(diffuseColors[i]);
-		}
-		if (textureCoordinates.size() > 0) {
-			for (int j = 0; j < 3; ++j) {
-				texcoordData_.push_back(textureCoordinates[polyMesh.polygons[i].texcoord_indices[j]]);
-			}
-		}
-	}
-
-	// compute tangents: this is a loop over triangles (not verts)
-	for (int i=0; i < positionData_.size(); i+=3) {
-		Vector3Df v0 = positionData_[i+0];
-		Vector3Df v1 = positionData_[i+1];
-		Vector3Df v2 = positionData_[i+2];
-
-		Vector2Df uv0 = texcoordData_[i+0];
-		Vector2Df uv1 = texcoordData_[i+1];
-		Vector2Df uv2 = texcoordData_[i+2];
-
-		Vector3Df deltaPos1;
-		deltaPos1.x = v1.x-v0.x;
-		deltaPos1.y = v1.y-v0.y;
-		deltaPos1.z = v1.z-v0.z;
-
-		Vector3Df deltaPos2;
-		deltaPos2.x = v2.x-v0.x;
-		deltaPos2.y = v2.y-v0.y;
-		deltaPos2.z = v2.z-v0.z;    
-
-		Vector2Df deltaUV1;
-		deltaUV1.x = uv1.x - uv0.x;
-		deltaUV1.y = uv1.y - uv0.y;
-
-		Vector2Df deltaUV2;
-		deltaUV2.x = uv2.x - uv0.x;
-		deltaUV2.y = uv2.y - uv0.y;
-
-		float r = 1.0f / (deltaUV1.x * deltaUV2.y - deltaUV1.y * deltaUV2.x);
-
-		Vector3Df tangent;
-		tangent.x = (deltaPos1.x * deltaUV2.y - deltaPos2.x * deltaUV1.y)*r;
-		tangent.y = (deltaPos1.y * deltaUV2.y - deltaPos2.y * deltaUV1.y)*r;
-		tangent.z = (deltaPos1.z * deltaUV2.y - deltaPos2.z * deltaUV1.y)*r;
-
-		// all three verts in a triangle share the same tangent
-		tangentData_.push_back(tangent);
-		tangentData_.push_back(tangent);
-		tangentData_.push_back(tangent);
-	}
-
-	// Allocate resources in GL
 	gl_mgr_ = GLResourceManager::instance();
 
-	// GL vertex array object
-	vertexArrayId_ = gl_mgr_->createVertexArray();
-
-	//
-	// allocate all the OpenGL vertex buffers, and copy the contents of the local buffers into them 
-	//
-
-	// Sanity check for struct layout in case of unconventional compiler
-	static_assert(sizeof(Vector3Df) == 3*sizeof(float), "Fatal error: Vector3Df struct has extra padding on this platform.");
-	static_assert(sizeof(Vector2Df) == 2*sizeof(float), "Fatal error: Vector2Df struct has extra padding on this platform.");
-
-	checkGLError("begin mesh vertex buffer setup");
-
-	positionBufferId_ = gl_mgr_->createVertexBufferFromData((const float *)&positionData_[0], positionData_.size()*3);
-
-	// printf("Position buffer object: %u\n", positionBufferId.id);
-
-	checkGLError("before normal buffers");
-
-	normalBufferId_ = gl_mgr_->createVertexBufferFromData((const float *)&normalData_[0], normalData_.size()*3);
-
-	// printf("Normal buffer object: %u\n", normalBufferId.id);
-
-	checkGLError("before texcoord buffers");
-
-	texcoordBufferId_ = gl_mgr_->createVertexBufferFromData((const float*)&texcoordData_[0], texcoordData_.size()*2);
-	  
-	// printf("Texcoord buffer object: %u\n", texcoordBufferId.id);
-
-	checkGLError("before tangent buffers");
-
-	tangentBufferId_ = gl_mgr_->createVertexBufferFromData((const float*)&tangentData_[0], tangentData_.size()*3);
-
-	// printf("Tangent buffer object: %u\n", tangentBufferId.id);
-
-	checkGLError("before diffuse color buffers");
-
-	diffuseColorBufferId_ = gl_mgr_->createVertexBufferFromData((const float*)&diffuseColorData_[0], diffuseColorData_.size()*3);
-
-	// printf("Diffuse color buffer object: %u\n", diffuseColorBufferId.id);
-
 	//
-	// allocate all the textures
+	// the textures, also shared by all meshes using the same files
 	//
 
-    // Texture data
-    vector<unsigned char> diffuse_texture;
-    vector<unsigned char> normal_texture;
-    vector<unsigned char> environment_texture;
-    unsigned int diffuse_texture_width, diffuse_texture_height;
-    unsigned int normal_texture_width, normal_texture_height;
-    unsigned int environment_texture_width, environment_texture_height;
-
     // create the diffuse albedo texture map
 	if (polyMesh.diffuse_filename != "") {
-		unsigned int error = lodepng::decode(diffuse_texture, diffuse_texture_width, diffuse_texture_height, polyMesh.diffuse_filename);
-		if(error) cerr << "Texture (diffuse) loading error = " << polyMesh.diffuse_filename << endl;
-		diffuseTextureId_ = gl_mgr_->createTextureFromData(diffuse_texture.data(), diffuse_texture_width, diffuse_texture_height);
+		diffuseTextureId_ = registry->getTexture(polyMesh.diffuse_filename);
 	    doTextureMapping_ = true;
     } else {
         doTextureMapping_ = false;
@@ -229,9 +66,7 @@ Mesh::Mesh(Collada::PolymeshInfo& polyMesh, const Matrix4x4& transform) {
 
     // create the normal map texture map
     if (polyMesh.normal_filename != "") {
-		unsigned int error = lodepng::decode(normal_texture, normal_texture_width, normal_texture_height, polyMesh.normal_filename);
-		if(error) cerr << "Texture (normal) loading error = " << polyMesh.normal_filename << endl;
-		normalTextureId_ = gl_mgr_->createTextureFromData(normal_texture.data(), normal_texture_width, normal_texture_height);
+		normalTextureId_ = registry->getTexture(polyMesh.normal_filename);
 	    doNormalMapping_ = true;
     } else {
         doNormalMapping_ = false;
@@ -239,128 +74,155 @@ Mesh::Mesh(Collada::PolymeshInfo& polyMesh, const Matrix4x4& transform) {
 
     // create the environment lighting texture map
     if (polyMesh.environment_filename != "") {
-		unsigned int error = lodepng::decode(environment_texture, environment_texture_width, environment_texture_height, polyMesh.environment_filename);
-		if(error) cerr << "Texture (environment) loading error = " << polyMesh.environment_filename << endl;
-		environmentTextureId_ = gl_mgr_->createTextureFromData(environment_texture.data(), environment_texture_width, environment_texture_height);
+		environmentTextureId_ = registry->getTexture(polyMesh.environment_filename);
 	    doEnvironmentMapping_ = true;
     } else {
         doEnvironmentMapping_ = false;
     }
 
-	//
-	// allocate the shader for this mesh
-	//
-
-	checkGLError("before mesh create shader");
-
-	shader_ = new Shader(polyMesh.vert_filename, polyMesh.frag_filename);
-
-	checkGLError("done mesh create shader");
+	checkGLError("end mesh constructor");
 }
 
-Mesh::~Mesh() {
-
-	gl_mgr_->freeVertexArray(vertexArrayId_);
-	gl_mgr_->freeVertexBuffer(positionBufferId_);
-	gl_mgr_->freeVertexBuffer(normalBufferId_);
-	gl_mgr_->freeVertexBuffer(diffuseColorBufferId_);
-	gl_mgr_->freeVertexBuffer(texcoordBufferId_);
-	gl_mgr_->freeVertexBuffer(tangentBufferId_);
-
-	if (doTextureMapping_) {
-		gl_mgr_->freeTexture(diffuseTextureId_);
-	}
-	if (doNormalMapping_) {
-		gl_mgr_->freeTexture(normalTextureId_);
-	}
-	if (doEnvironmentMapping_) {
-		gl_mgr_->freeTexture(environmentTextureId_);
-	}
+bool Mesh::canInstanceWith(const SceneObject* other) const {
+	const Mesh* mesh = dynamic_cast<const Mesh*>(other);
+	return mesh && mesh->asset_ == asset_ &&
+	       mesh->doTextureMapping_ == doTextureMapping_ && mesh->diffuseTextureId_.id == diffuseTextureId_.id &&
+	       mesh->doNormalMapping_ == doNormalMapping_ && mesh->normalTextureId_.id == normalTextureId_.id &&
+	       mesh->doEnvironmentMapping_ == doEnvironmentMapping_ &&
+	       mesh->environmentTextureId_.id == environmentTextureId_.id &&
+	       mesh->useMirrorBrdf_ == useMirrorBrdf_ && mesh->phongSpecExponent_ == phongSpecExponent_;
+}
 
-    delete shader_;
+size_t Mesh::getInstanceKey() const {
+	// the asset and the material
+	size_t key = std::hash<const MeshAsset*>()(asset_);
+	auto combine = [&key](size_t value) { key ^= value + 0x9e3779b9 + (key << 6) + (key >> 2); };
+	combine(doTextureMapping_ ? diffuseTextureId_.id : 0);
+	combine(doNormalMapping_ ? normalTextureId_.id : 0);
+	combine(doEnvironmentMapping_ ? environmentTextureId_.id : 0);
+	combine(useMirrorBrdf_);
+	combine(std::hash<float>()(phongSpecExponent_));
+	return key;
 }
 
 /*
  * Draw the mesh
  */
-void Mesh::draw(const Matrix4x4& worldToNDC) const {
-	internalDraw(false, worldToNDC);
+void Mesh::draw(int transformIndex, int instanceCount) const {
+	internalDraw(false, transformIndex, instanceCount, /*commands=*/NULL, /*drawCount=*/0);
 }
 
 /*
  * Draw the mesh as part of a shadow map generation rendering pass
  */
-void Mesh::drawShadow(const Matrix4x4& worldToNDC) const {
-	internalDraw(true, worldToNDC);
+void Mesh::drawShadow(int transformIndex, int instanceCount) const {
+	internalDraw(true, transformIndex, instanceCount, /*commands=*/NULL, /*drawCount=*/0);
+}
+
+void Mesh::getIndirectCommands(std::vector<DrawElementsIndirectCommand>* shadowCommands,
+                               std::vector<DrawElementsIndirectCommand>* commands) const {
+	// the shadow passes draw the whole mesh, the main pass one submesh per command, with its
+	// material as base instance (see shader.vert)
+	const GeometryArena::Allocation& geometry = asset_->getGeometry();
+	shadowCommands->push_back({(GLuint)geometry.numIndices, 0, (GLuint)geometry.firstIndex, geometry.baseVertex, 0});
+	for (const MeshAsset::Submesh& submesh : asset_->getSubmeshes()) {
+		commands->push_back({(GLuint)submesh.numIndices, 0, (GLuint)(geometry.firstIndex + submesh.firstIndex),
+		                     geometry.baseVertex, (GLuint)submesh.materialIndex});
+	}
+}
+
+void Mesh::drawIndirect(bool shadowPass, int transformIndex, const void* commands, int drawCount) const {
+	internalDraw(shadowPass, transformIndex, 0, commands, drawCount);
 }
 
-void Mesh::internalDraw(bool shadowPass, const Matrix4x4& worldToNDC) const {
+Shader* Mesh::getShadowShader() const {
+	return scene_->getShadowShader(asset_->getVertexFormat().normal);
+}
+
+VertexArrayId Mesh::getShadowVertexArrayId() const {
+	Shader* shader = getShadowShader();
+	bool positionsOnly = !shader->usesVertexAttribute(VTX_NORMAL_LOCATION) &&
+	                     !shader->usesVertexAttribute(VTX_NORMAL_OCT_LOCATION);
+	return positionsOnly ? asset_->getPositionVertexArrayId() : asset_->getVertexArrayId();
+}
+
+void Mesh::internalDraw(bool shadowPass, int transformIndex, int instanceCount,
+                        const void* commands, int drawCount) const {
 
 	// printf("Top of Mesh::internalDraw  (%lu shadowed lights)\n", scene->getNumShadowedLights());
 
 	checkGLError("begin draw faces");
-    
-	Matrix4x4 objectToWorld = getObjectToWorld();
-	Matrix3x3 objectToWorldForNormals = getObjectToWorldForNormals();
-	Matrix4x4 mvp = worldToNDC * objectToWorld;
 
-	// cout << "obj2world: " << objectToWorld << endl;
+	// the view and the object's transforms are in uniform buffers set up by the scene,
+	// the draw only selects the transforms of this object. Instance i of an instanced draw
+	// uses the transforms at object_index + gl_InstanceID (or, with GPU culling, the transforms
+	// listed there in the "VisibleObjects" block).
+
+	const VertexFormat& vertexFormat = asset_->getVertexFormat();
+	const GeometryArena::Allocation& geometry = asset_->getGeometry();
 
-	auto vertex_array_bind = gl_mgr_->bindVertexArray(vertexArrayId_);
+	// the mesh is a range of the buffers of its arena page, whose vertex array it shares with the
+	// other meshes of the page. Its indices are relative to its first vertex (the base vertex).
+	bool indirect = commands != NULL;
+	VertexArrayId vertexArrayId = shadowPass ? getShadowVertexArrayId() : asset_->getVertexArrayId();
+	auto vertex_array_bind = gl_mgr_->bindVertexArray(vertexArrayId);
+
+	// (the instances drawn indirectly are only known to the GPU)
+	bool positionsOnly = vertexArrayId.id == asset_->getPositionVertexArrayId().id;
+	int vertexBytes = positionsOnly ? vertexFormat.positionStride() : vertexFormat.stride();
+	FrameStats::current().verticesDrawn += geometry.numIndices * instanceCount;
+	FrameStats::current().vertexBytesFetched +=
+		((long long)geometry.numVertices * vertexBytes + geometry.numIndices * sizeof(GLuint)) * instanceCount;
+	FrameStats::current().instancesDrawn += instanceCount;
 
     if (shadowPass) {
 
-    	Shader* shadowShader = scene_->getShadowShader();
+    	Shader* shadowShader = getShadowShader();
+    	const Scene::ShadowShaderParameters& shadowParams = scene_->getShadowShaderParameters(vertexFormat.normal);
 
     	auto shader_bind = shadowShader->bind();
-        shadowShader->setMatrixParameter("mvp", mvp);
-        shadowShader->setVertexBuffer("vtx_position", 3, positionBufferId_);
-		shadowShader->setVertexBuffer("vtx_normal", 3, normalBufferId_);
-        shadowShader->setMatrixParameter("obj2worldNorm", objectToWorldForNormals);
-
-		checkGLError("before glDrawArrays in shadow pass");
-        glDrawArrays(GL_TRIANGLES, 0, 3 * numTriangles_);
+        shadowShader->setScalarParameter(shadowParams.objectIndex, transformIndex);
+
+		checkGLError("before glDrawElements in shadow pass");
+        if (indirect) {
+            // the commands may go on with those of other meshes of the arena page (see Scene::drawObjects)
+            glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, commands, drawCount, /*stride=*/0);
+            FrameStats::current().indirectCommandsDrawn += drawCount;
+        } else {
+            glDrawElementsInstancedBaseVertex(GL_TRIANGLES, geometry.numIndices, GL_UNSIGNED_INT,
+                                              (void*)(sizeof(GLuint) * geometry.firstIndex), instanceCount,
+                                              geometry.baseVertex);
+        }
+        FrameStats::current().drawCalls++;
 
     } else {
 
+    	Shader* shader = asset_->getShader();
+    	const MeshAsset::ShaderParameters& shaderParams = asset_->getShaderParameters();
+
     	checkGLError("before use program");
 
-    	auto shader_bind = shader_->bind();
+    	auto shader_bind = shader->bind();
 
 		checkGLError("before bind uniforms");
 
-    	shader_->setScalarParameter("useTextureMapping", doTextureMapping_ ? 1 : 0);
-    	shader_->setScalarParameter("useNormalMapping", doNormalMapping_ ? 1 : 0);        
-        shader_->setScalarParameter("useEnvironmentMapping", doEnvironmentMapping_ ? 1 : 0);
-        shader_->setScalarParameter("useMirrorBRDF", useMirrorBrdf_ ? 1 : 0);
-        shader_->setScalarParameter("spec_exp", phongSpecExponent_);
+    	shader->setScalarParameter(shaderParams.useTextureMapping, doTextureMapping_ ? 1 : 0);
+    	shader->setScalarParameter(shaderParams.useNormalMapping, doNormalMapping_ ? 1 : 0);        
+        shader->setScalarParameter(shaderParams.useEnvironmentMapping, doEnvironmentMapping_ ? 1 : 0);
+        shader->setScalarParameter(shaderParams.useMirrorBRDF, useMirrorBrdf_ ? 1 : 0);
+        shader->setScalarParameter(shaderParams.specExp, phongSpecExponent_);
 
 		checkGLError("after binding the scalars");
 
-        shader_->setVectorParameter("camera_position", scene_->getCamera()->getPosition());
-
-		checkGLError("after binding camera position");
-
-        shader_->setMatrixParameter("obj2world", objectToWorld);
+        shader->setScalarParameter(shaderParams.objectIndex, transformIndex);
 
-		checkGLError("after binding o2w");
+		checkGLError("after binding object index");
 
-        shader_->setMatrixParameter("obj2worldNorm", objectToWorldForNormals);
-
-		checkGLError("after binding everything but mvp");
-
-        shader_->setMatrixParameter("mvp", mvp);
-
-		checkGLError("after binding mvp");
-
-        int numShadowedLights = scene_->getNumShadowedLights();
-
-        // TODO CS248 Part 5.2: Shadow Mapping
-        // You need to pass an array of matrices to the shader.
-        // They should go from object space to the "light space" for each spot light.
-        // In this way, the shader can compute the texture coordinate to sample from the
-        // Shadow Map given any point on the object.
-        // For examples of passing arrays to the shader, look below for "directional_light_vectors[]" etc.
+        // CS248 Part 5.2: Shadow Mapping
+        // The shader needs the matrices going from world space to the "light space" of each spot light,
+        // so it can compute the texture coordinate to sample from the Shadow Map given any point on
+        // the object. The scene passes the matrices computed in Scene::renderShadowPass to every
+        // shader in the "View" uniform block (world_to_shadowlight[]), so nothing needs to be set here.
 
 
 		checkGLError("after bind uniforms, about to bind textures");
@@ -368,7 +230,7 @@ void Mesh::internalDraw(bool shadowPass, const Matrix4x4& worldToNDC) const {
         // bind texture samplers ///////////////////////////////////
 
         if (doTextureMapping_)
-        	shader_->setTextureSampler("diffuseTextureSampler", diffuseTextureId_);
+        	shader->setTextureSampler(shaderParams.diffuseTextureSampler, diffuseTextureId_);
 
         // TODO CS248 Part 3: Normal Mapping:
         // You want to pass the normal texture into the shader program.
@@ -379,97 +241,128 @@ void Mesh::internalDraw(bool shadowPass, const Matrix4x4& worldToNDC) const {
         // See diffuseTextureSampler for an example of passing textures.
 
         // TODO CS248 Part 5.2: Shadow Mapping:
-        // You want to pass the array of shadow textures computed during shadow pass into the shader program.
-        // See Scene::visualizeShadowMap for an example of passing texture arrays.
-        // See shadow_viz.frag for an example of using texture arrays in the shader.
-
+        // You want to pass the shadow maps computed during the shadow passes into the shader program.
+        // All maps are tiles of one atlas, which is layer 0 of a texture array (the scene's
+        // shadow depth texture array): see Scene::visualizeShadowMap for an example of passing
+        // texture arrays, and shadow_viz.frag for an example of sampling them in the shader.
 
-        // bind light parameters //////////////////////////////////
 
-    	shader_->setScalarParameter("num_directional_lights", (int)scene_->getNumDirectionalLights());
-        shader_->setScalarParameter("num_point_lights", (int)scene_->getNumPointLights());
-        shader_->setScalarParameter("num_spot_lights", (int)scene_->getNumSpotLights());
+        // light parameters are not set here: the scene uploads them to the
+        // "Lights" uniform block once per frame (see Scene::beginFrame)
 
-        for (int j=0; j<scene_->getNumDirectionalLights(); j++) {
-            string varname = "directional_light_vectors[" + std::to_string(j) + "]";
-            const StaticScene::DirectionalLight* light = scene_->getDirectionalLight(j);
-            shader_->setVectorParameter(varname, light->lightDir);
-        }
-
-	    checkGLError("before bind point light attributes");
-
-        for (int j=0; j<scene_->getNumPointLights(); j++) {
-            string varname = "point_light_positions[" + std::to_string(j) + "]";
-            const StaticScene::PointLight* light = scene_->getPointLight(j);
-            shader_->setVectorParameter(varname, light->position);
-        }
+        // per-vertex attribute buffers ("in" parameters to the vertex shader) were attached
+        // to the vertex array object when the mesh was created
 
-	    checkGLError("before bind spotlight attributes");
+		// the material colors are in this mesh's "Materials" uniform block, and each submesh
+		// selects its material
+		gl_mgr_->bindUniformBufferBase(asset_->getMaterialsUniformBufferId(), MATERIALS_UNIFORM_BLOCK);
 
-        for (int j=0; j<scene_->getNumSpotLights(); j++) {
+		// now issue the draw commands to OpenGL. Indirect draws draw all submeshes at once, each
+		// command giving the material of its submesh.
+		checkGLError("before glDrawElements");
+		if (indirect) {
+			glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, commands, drawCount, /*stride=*/0);
+			FrameStats::current().drawCalls++;
+			FrameStats::current().indirectCommandsDrawn += drawCount;
+		}
+		const std::vector<MeshAsset::Submesh>& submeshes = asset_->getSubmeshes();
+		for (size_t i = 0; !indirect && i < submeshes.size(); i++) {
+			const MeshAsset::Submesh& submesh = submeshes[i];
+			shader->setScalarParameter(shaderParams.materialIndex, submesh.materialIndex);
+			glDrawElementsInstancedBaseVertex(GL_TRIANGLES, submesh.numIndices, GL_UNSIGNED_INT,
+			                                  (void*)(sizeof(GLuint) * (geometry.firstIndex + submesh.firstIndex)),
+			                                  instanceCount, geometry.baseVertex);
+			FrameStats::current().drawCalls++;
+		}
+	}
 
-            const StaticScene::SpotLight* light = scene_->getSpotLight(j);
-            string varname = "spot_light_positions[" + std::to_string(j) + "]";
-            shader_->setVectorParameter(varname, light->position);
+	checkGLError("end mesh::internalDraw");
+}
 
-            varname = "spot_light_directions[" + std::to_string(j) + "]";
-            shader_->setVectorParameter(varname, light->direction);
+BBox Mesh::getBBox() const {
 
-            varname = "spot_light_angles[" + std::to_string(j) + "]";
-            shader_->setScalarParameter(varname, light->angle);
+	BBox bbox;
 
-            varname = "spot_light_intensities[" + std::to_string(j) + "]";
-            Vector3D value(light->radiance.r, light->radiance.g, light->radiance.b);
-            shader_->setVectorParameter(varname, value);
-        }
+	// convert the corners of the object-space bounding box to world space. The result bounds
+	// the mesh, but is looser than the box of its transformed vertices if the mesh is rotated.
+	const BBox& objectBBox = asset_->getBBox();
+	const Matrix4x4& objectToWorld = getObjectToWorld();
+	for (int i=0; i<8; ++i) {
+		Vector4D posObj((i & 1) ? objectBBox.max.x : objectBBox.min.x,
+		                (i & 2) ? objectBBox.max.y : objectBBox.min.y,
+		                (i & 4) ? objectBBox.max.z : objectBBox.min.z, 1.f);
+		Vector4D posObjWorld = objectToWorld * posObj;
+		bbox.expand(posObjWorld.projectTo3D());
+  	}
 
-        // bind per-vertex attribute buffers.  These are "in" parameters to the vertex shader
+  	return bbox;
+}
 
-	    checkGLError("before bind vertex attributes");
+void Mesh::getBoundingSphere(Vector3D* center, float* radius) const {
 
-	    shader_->setVertexBuffer("vtx_position", 3, positionBufferId_);
+	// the sphere around the object-space bounding box, scaled by the largest scale of the
+	// transform. Unlike the world space box, it does not grow when the mesh is rotated.
+	const Matrix4x4& objectToWorld = getObjectToWorld();
+	const BBox& objectBBox = asset_->getBBox();
+	*center = (objectToWorld * Vector4D(objectBBox.centroid(), 1.f)).projectTo3D();
 
-	   	checkGLError("before bind diffuse color");
+	double maxScale = 0.;
+	for (int i=0; i<3; ++i) {
+		const Vector4D& axis = objectToWorld.column(i);
+		maxScale = std::max(maxScale, Vector3D(axis.x, axis.y, axis.z).norm());
+	}
+	*radius = 0.5 * objectBBox.extent.norm() * maxScale;
+}
 
-	    shader_->setVertexBuffer("vtx_diffuse_color", 3, diffuseColorBufferId_);
+bool Mesh::intersect(const Vector3D& origin, const Vector3D& direction, float tMax, float* t) const {
 
-	   	checkGLError("before bind normal");
+	// the ray in object space, with its direction transformed as a vector (not normalized), so
+	// that the hits are at the same t
+	const Matrix4x4& worldToObject = getWorldToObject();
+	Vector3D objectOrigin = (worldToObject * Vector4D(origin, 1.f)).to3D();
+	Vector3D objectDirection = (worldToObject * Vector4D(direction, 0.f)).to3D();
 
-	    shader_->setVertexBuffer("vtx_normal", 3, normalBufferId_);
+	TriangleBVH::Hit hit;
+	if (!asset_->getBVH().intersectClosest(objectOrigin, objectDirection, tMax, &hit))
+		return false;
+	*t = hit.t;
+	return true;
+}
 
-	   	checkGLError("before bind texdtcoord");
+bool Mesh::intersectExhaustive(const Vector3D& origin, const Vector3D& direction, float tMax, float* t) const {
 
-	    shader_->setVertexBuffer("vtx_texcoord", 2, texcoordBufferId_);
+	const Matrix4x4& worldToObject = getWorldToObject();
+	Vector3D objectOrigin = (worldToObject * Vector4D(origin, 1.f)).to3D();
+	Vector3D objectDirection = (worldToObject * Vector4D(direction, 0.f)).to3D();
 
-		checkGLError("before bind tangent");
+	TriangleBVH::Hit hit;
+	if (!asset_->getBVH().intersectClosestExhaustive(objectOrigin, objectDirection, tMax, &hit))
+		return false;
+	*t = hit.t;
+	return true;
+}
 
-	    shader_->setVertexBuffer("vtx_tangent", 3, tangentBufferId_);
-		
-		// now issue the draw command to OpenGL
-		checkGLError("before glDrawArrays");
-		glDrawArrays(GL_TRIANGLES, 0, 3 * numTriangles_);
-	}
+bool Mesh::occludes(const Vector3D& origin, const Vector3D& direction, float tMax) const {
 
-	checkGLError("end mesh::internalDraw");
+	const Matrix4x4& worldToObject = getWorldToObject();
+	Vector3D objectOrigin = (worldToObject * Vector4D(origin, 1.f)).to3D();
+	Vector3D objectDirection = (worldToObject * Vector4D(direction, 0.f)).to3D();
+	return asset_->getBVH().intersectAny(objectOrigin, objectDirection, tMax);
 }
 
-void Mesh::reloadShaders() {
-	shader_->reload();
+GLuint Mesh::getSortProgram(bool shadowPass) const {
+	if (shadowPass)
+		return getShadowShader()->getProgramId().id;
+	return asset_->getShader()->getProgramId().id;
 }
 
-BBox Mesh::getBBox() const {
-
-	BBox bbox;
-
-	// convert object-space points to world space points, and compute a world-space bounding box
-	// NOTE(kayvonf): this is an inefficient implementation since we're considering each unique vertex position up to 3 times 
-	for (int i=0; i<3*numTriangles_; ++i) {
-		Vector4D posObj(positionData_[i].x, positionData_[i].y, positionData_[i].z, 1.f);
-		Vector4D posObjWorld = getObjectToWorld() * posObj;
-		bbox.expand(posObjWorld.projectTo3D());
-  	}
-
-  	return bbox;
+GLuint Mesh::getSortTextureSet(bool shadowPass) const {
+	if (shadowPass)
+		return getShadowVertexArrayId().id;
+	// the diffuse texture identifies the textures, as the other maps come with it
+	if (!doTextureMapping_)
+		return 0;
+	return diffuseTextureId_.id;
 }
 
 /*
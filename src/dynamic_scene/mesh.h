@@ -3,67 +3,57 @@
 
 #include "scene.h"
 
+#include "mesh_asset.h"
+
 #include "../collada/polymesh_info.h"
 #include "../shader.h"
 #include "../gl_resource_manager.h"
 
-#include <map>
-
 namespace CS248 {
 namespace DynamicScene {
 
 
-// We need to define new vector structs for fp32 fields. In other words, using floats, not doubles. 
-// Note that in the CS248 starter codebase the Vector2D/3D types have fields that are doubles.
-struct Vector2Df {
-    float x, y;
-};
-
-struct Vector3Df {
-    float x, y, z;
-};
-
-
 class Mesh : public SceneObject {
   public:
     Mesh(Collada::PolymeshInfo& polyMesh, const Matrix4x4& transform);
-    ~Mesh();
 
-    void draw(const Matrix4x4& worldToNDC) const override;
-    void drawShadow(const Matrix4x4& worldToNDC) const override;
+    void draw(int transformIndex, int instanceCount) const override;
+    void drawShadow(int transformIndex, int instanceCount) const override;
+    void getIndirectCommands(std::vector<DrawElementsIndirectCommand>* shadowCommands,
+                             std::vector<DrawElementsIndirectCommand>* commands) const override;
+    void drawIndirect(bool shadowPass, int transformIndex, const void* commands, int drawCount) const override;
+    bool canInstanceWith(const SceneObject* other) const override;
+    size_t getInstanceKey() const override;
+    bool isStatic() const override { return isStatic_; }
     BBox getBBox() const override;
-    void reloadShaders() override;
+    void getBoundingSphere(Vector3D* center, float* radius) const override;
+    bool intersect(const Vector3D& origin, const Vector3D& direction, float tMax, float* t) const override;
+    bool occludes(const Vector3D& origin, const Vector3D& direction, float tMax) const override;
+    bool intersectExhaustive(const Vector3D& origin, const Vector3D& direction, float tMax, float* t) const override;
+    GLuint getSortProgram(bool shadowPass) const override;
+    GLuint getSortTextureSet(bool shadowPass) const override;
+    // the shader belongs to the asset, see MeshAssetRegistry::checkVertexStreams
+    void reloadShaders() override {}
+    Matrix4x4 getVertexPositionDecode() const override { return asset_->getPositionDecode(); }
 
  private:
 
-    // Helper called by draw() and drawShadow()
-    void internalDraw(bool shadowPass, const Matrix4x4& worldToNDC) const;
-      
-    int numTriangles_;
-
-    // Per vertex mesh data.  These allocations are the host-side buffers whose contents are
-    // copied into OpenGL vertex buffers.  Note that we do not use an indexed format.  
-    vector<Vector3Df> positionData_;
-    vector<Vector3Df> diffuseColorData_;
-    vector<Vector3Df> normalData_;
-    vector<Vector2Df> texcoordData_;
-    vector<Vector3Df> tangentData_;
-    
-    // (wrapped) OpenGL program object
-    Shader* shader_;
+    // Helper called by draw(), drawShadow() and drawIndirect(). Indirect draws take their
+    // parameters from the `drawCount` commands at `commands` instead of drawing `instanceCount` instances.
+    void internalDraw(bool shadowPass, int transformIndex, int instanceCount,
+                      const void* commands, int drawCount) const;
+
+    // the shader and the vertex array of the shadow passes: the depth-only shaders read the
+    // positions only, from the position-only vertex array of the arena page
+    Shader* getShadowShader() const;
+    VertexArrayId getShadowVertexArrayId() const;
+
+    // geometry and shader, shared with the other meshes placing the same file (owned by the MeshAssetRegistry)
+    const MeshAsset* asset_;
+
     GLResourceManager* gl_mgr_;
 
-    // OpenGL vertex array object
-    VertexArrayId vertexArrayId_;
-
-    // OpenGL vertex buffer objects
-    VertexBufferId positionBufferId_;
-    VertexBufferId diffuseColorBufferId_;
-    VertexBufferId normalBufferId_;
-    VertexBufferId texcoordBufferId_;
-    VertexBufferId tangentBufferId_;
-    
-    // OpenGL texture objects
+    // OpenGL texture objects (owned by the MeshAssetRegistry)
     TextureId diffuseTextureId_;
     TextureId normalTextureId_;
     TextureId environmentTextureId_;
@@ -75,6 +65,8 @@ class Mesh : public SceneObject {
     bool  useMirrorBrdf_;
     float phongSpecExponent_;
 
+    bool  isStatic_;
+
 };
 
 }  // namespace DynamicScene
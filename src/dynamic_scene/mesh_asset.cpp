@@ -0,0 +1,400 @@
+#include "mesh_asset.h"
+#include "CS248/lodepng.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+#include "../gl_utils.h"
+#include "gpu_culling.h"
+
+using namespace std;
+
+namespace CS248 {
+namespace DynamicScene {
+
+namespace {
+
+struct ColorLess {
+	bool operator()(const Vector3Df& a, const Vector3Df& b) const {
+		if (a.x != b.x) return a.x < b.x;
+		if (a.y != b.y) return a.y < b.y;
+		return a.z < b.z;
+	}
+};
+
+float distanceSquared(const Vector3Df& a, const Vector3Df& b) {
+	return (a.x - b.x) * (a.x - b.x) + (a.y - b.y) * (a.y - b.y) + (a.z - b.z) * (a.z - b.z);
+}
+
+// Builds the palette of the distinct per-face diffuse colors, and the index into it of each face.
+// Past MESH_MAX_MATERIALS colors, faces use the closest color of the palette.
+void buildMaterialPalette(const vector<Vector3Df>& faceColors, vector<Vector3Df>* palette, vector<int>* faceMaterials) {
+	map<Vector3Df, int, ColorLess> paletteIndex;
+	bool truncated = false;
+
+	faceMaterials->resize(faceColors.size());
+	for (size_t i = 0; i < faceColors.size(); ++i) {
+		const Vector3Df& color = faceColors[i];
+		auto found = paletteIndex.find(color);
+		if (found != paletteIndex.end()) {
+			(*faceMaterials)[i] = found->second;
+		} else if (palette->size() < MESH_MAX_MATERIALS) {
+			paletteIndex[color] = palette->size();
+			(*faceMaterials)[i] = palette->size();
+			palette->push_back(color);
+		} else {
+			int closest = 0;
+			for (size_t m = 1; m < palette->size(); ++m) {
+				if (distanceSquared(color, (*palette)[m]) < distanceSquared(color, (*palette)[closest]))
+					closest = m;
+			}
+			(*faceMaterials)[i] = closest;
+			truncated = true;
+		}
+	}
+
+	if (palette->empty()) {
+		// meshes without material information (their faces have no colors)
+		Vector3Df black = {0.f, 0.f, 0.f};
+		palette->push_back(black);
+		faceMaterials->assign(faceMaterials->size(), 0);
+	}
+
+	if (truncated)
+		cerr << "Warning: mesh has more than " << MESH_MAX_MATERIALS << " materials, using the closest colors" << endl;
+}
+
+}  // namespace
+
+
+MeshAsset::MeshAsset(const Collada::PolymeshInfo& polyMesh) {
+
+	checkGLError("begin mesh asset constructor");
+
+	// the vertex data, possibly shared with other PolymeshInfos loaded from the same file
+	const Collada::PolymeshInfo& geometry = polyMesh.geometry();
+
+    // FIXME(kayvonf): I do not understand why we are copying data from the PolyMesh structure
+    // into local variables below (step 1), and then copying the results into the non-indexed
+    // buffers (step 2). Step 2 could be completed directly from the PolyMesh structure.
+   
+    // Step 1: 
+    //
+    // Copy data from polyMesh structure to local variables
+    //
+
+    numTriangles_ = geometry.polygons.size();
+
+    vector<Vector3Df> positions;
+    vector<Vector3Df> normals;
+    vector<Vector2Df> textureCoordinates;
+    vector<Vector3Df> diffuseColors;  // (this is per face data, turned into a material palette below)
+
+	positions.reserve(geometry.vertices.size());
+	normals.reserve(geometry.normals.size());
+	textureCoordinates.reserve(geometry.texcoords.size());
+	diffuseColors.reserve(geometry.polygons.size()); // one per face
+
+	for (size_t i = 0; i < geometry.vertices.size(); ++i) {
+		Vector3Df v;
+		v.x = geometry.vertices[i].x;
+		v.y = geometry.vertices[i].y;
+		v.z = geometry.vertices[i].z;
+		positions.push_back(v);
+	}
+	for (size_t i = 0; i < geometry.normals.size(); ++i) {
+		Vector3Df v;
+		v.x = geometry.normals[i].x;
+		v.y = geometry.normals[i].y;
+		v.z = geometry.normals[i].z;
+		normals.push_back(v);
+	}
+	for (size_t i = 0; i < geometry.texcoords.size(); ++i) {
+		Vector2Df v;
+		v.x = geometry.texcoords[i].x;
+		v.y = geometry.texcoords[i].y;
+		textureCoordinates.push_back(v);
+	}
+	for (size_t i = 0; i < geometry.material_diffuse_parameters.size(); ++i) {
+		Vector3Df v;
+		v.x = geometry.material_diffuse_parameters[i].x;
+		v.y = geometry.material_diffuse_parameters[i].y;
+		v.z = geometry.material_diffuse_parameters[i].z;
+		diffuseColors.push_back(v);
+	}
+
+	hasTexcoordData_ = textureCoordinates.size() > 0;
+
+	//
+	// Choose the vertex format from the indexed data (each distinct value is checked once), and
+	// allocate the shader for this mesh, which depends on the format. The streams the shader
+	// does not read are then left out of the format, so that they are neither built nor uploaded.
+	//
+
+	if (polyMesh.vertex_format == "full") {
+		vertexFormat_ = VertexFormat::full();
+	} else if (polyMesh.vertex_format == "compact") {
+		vertexFormat_ = VertexFormat::compact();
+	} else {
+		vector<Vector3Df> noTangents;  // tangents are derived data, any unit vector can be encoded
+		VertexAttributes indexed = {&positions, &normals, &textureCoordinates, &noTangents};
+		vertexFormat_ = chooseVertexFormat(indexed, VertexFormatTolerance());
+	}
+
+	checkGLError("before mesh create shader");
+
+	// with GPU culling, the transforms of the visible instances are listed by the culling pass
+	vector<string> defines = vertexFormat_.shaderDefines();
+	if (GpuCuller::isSupported())
+		defines.push_back(GpuCuller::shaderDefine());
+	shader_ = ShaderCache::instance()->get(polyMesh.vert_filename, polyMesh.frag_filename, defines);
+	resolveShaderParameters();
+
+	checkGLError("done mesh create shader");
+
+	vertexFormat_ = streamsReadByShader(vertexFormat_);
+
+	//
+	// The per-face diffuse colors become a palette of materials, and the triangles are sorted by
+	// material so that each material is a contiguous range of indices (a submesh).
+	//
+
+	vector<Vector3Df> materialPalette;
+	vector<int> faceMaterials;
+	buildMaterialPalette(diffuseColors, &materialPalette, &faceMaterials);
+	faceMaterials.resize(numTriangles_, 0);
+
+	vector<int> triangleOrder(numTriangles_);
+	for (int i = 0; i < numTriangles_; ++i)
+		triangleOrder[i] = i;
+	stable_sort(triangleOrder.begin(), triangleOrder.end(),
+	            [&faceMaterials](int a, int b) { return faceMaterials[a] < faceMaterials[b]; });
+
+	for (int i = 0; i < numTriangles_; ++i) {
+		int material = faceMaterials[triangleOrder[i]];
+		if (submeshes_.empty() || submeshes_.back().materialIndex != material)
+			submeshes_.push_back({3 * i, 0, material});
+		submeshes_.back().numIndices += 3;
+	}
+
+	//
+	// Step 2:
+	// 
+    // These are the buffers that will be encoded into the vertex buffer.
+    // Allocate and populate them here.  They are a non-indexed representation, in that there are
+    // three values per polygon.
+
+	vector<Vector3Df> positionData;
+	vector<Vector3Df> normalData;
+	vector<Vector2Df> texcoordData;
+	vector<Vector3Df> tangentData;
+
+	positionData.reserve(3 * numTriangles_);
+	if (vertexFormat_.hasNormal)
+		normalData.reserve(3 * numTriangles_);
+	if (vertexFormat_.hasTexcoord || vertexFormat_.hasTangent)
+		texcoordData.reserve(3 * numTriangles_);
+	if (vertexFormat_.hasTangent)
+		tangentData.reserve(3 * numTriangles_);
+
+    // populate buffers for vertex position, normal, and texcoord, in material order
+	for (int t = 0; t < numTriangles_; ++t) {
+		const Collada::Polygon& polygon = geometry.polygons[triangleOrder[t]];
+		for (int j = 0; j < 3; ++j) {
+  			positionData.push_back(positions[polygon.vertex_indices[j]]);
+			if (vertexFormat_.hasNormal)
+				normalData.push_back(normals[polygon.normal_indices[j]]);
+			if (vertexFormat_.hasTexcoord || vertexFormat_.hasTangent)
+				texcoordData.push_back(textureCoordinates[polygon.texcoord_indices[j]]);
+		}
+	}
+
+	for (const Vector3Df& p : positions)
+		objectBBox_.expand(Vector3D(p.x, p.y, p.z));
+
+	// the triangle hierarchy, built once per asset and shared by the meshes placing it
+	vector<int> triangleIndices;
+	triangleIndices.reserve(3 * numTriangles_);
+	for (const Collada::Polygon& polygon : geometry.polygons) {
+		for (int j = 0; j < 3; ++j)
+			triangleIndices.push_back(polygon.vertex_indices[j]);
+	}
+	auto bvhStart = chrono::steady_clock::now();
+	bvh_.build(positions, triangleIndices);
+	chrono::duration<double, milli> bvhTime = chrono::steady_clock::now() - bvhStart;
+	printf("Mesh BVH: %d triangles, %d nodes, built in %.1f ms\n",
+	       bvh_.getNumTriangles(), bvh_.getNumNodes(), bvhTime.count());
+
+	// compute tangents (they need texture coordinates): this is a loop over triangles (not verts)
+	for (size_t i = 0; vertexFormat_.hasTangent && i < positionData.size(); i+=3) {
+		Vector3Df v0 = positionData[i+0];
+		Vector3Df v1 = positionData[i+1];
+		Vector3Df v2 = positionData[i+2];
+
+		Vector2Df uv0 = texcoordData[i+0];
+		Vector2Df uv1 = texcoordData[i+1];
+		Vector2Df uv2 = texcoordData[i+2];
+
+		Vector3Df deltaPos1;
+		deltaPos1.x = v1.x-v0.x;
+		deltaPos1.y = v1.y-v0.y;
+		deltaPos1.z = v1.z-v0.z;
+
+		Vector3Df deltaPos2;
+		deltaPos2.x = v2.x-v0.x;
+		deltaPos2.y = v2.y-v0.y;
+		deltaPos2.z = v2.z-v0.z;    
+
+		Vector2Df deltaUV1;
+		deltaUV1.x = uv1.x - uv0.x;
+		deltaUV1.y = uv1.y - uv0.y;
+
+		Vector2Df deltaUV2;
+		deltaUV2.x = uv2.x - uv0.x;
+		deltaUV2.y = uv2.y - uv0.y;
+
+		float r = 1.0f / (deltaUV1.x * deltaUV2.y - deltaUV1.y * deltaUV2.x);
+
+		Vector3Df tangent;
+		tangent.x = (deltaPos1.x * deltaUV2.y - deltaPos2.x * deltaUV1.y)*r;
+		tangent.y = (deltaPos1.y * deltaUV2.y - deltaPos2.y * deltaUV1.y)*r;
+		tangent.z = (deltaPos1.z * deltaUV2.y - deltaPos2.z * deltaUV1.y)*r;
+
+		// all three verts in a triangle share the same tangent
+		tangentData.push_back(tangent);
+		tangentData.push_back(tangent);
+		tangentData.push_back(tangent);
+	}
+
+	// Allocate resources in GL
+	gl_mgr_ = GLResourceManager::instance();
+
+	//
+	// encode the local buffers into interleaved vertices, merge the identical ones, and copy
+	// them with their indices into the arena of the vertex format
+	//
+
+	// Sanity check for struct layout in case of unconventional compiler
+	static_assert(sizeof(Vector3Df) == 3*sizeof(float), "Fatal error: Vector3Df struct has extra padding on this platform.");
+	static_assert(sizeof(Vector2Df) == 2*sizeof(float), "Fatal error: Vector2Df struct has extra padding on this platform.");
+
+	checkGLError("begin mesh vertex buffer setup");
+
+	VertexAttributes attribs = {&positionData, &normalData, &texcoordData, &tangentData};
+	std::vector<unsigned char> vertices = encodeVertices(vertexFormat_, attribs, positionData.size(), &positionDecode_);
+	std::vector<GLuint> indices = indexVertices(vertexFormat_, &vertices);
+	int numVertices = vertices.size() / vertexFormat_.stride();
+
+	arena_ = MeshAssetRegistry::instance()->getArena(vertexFormat_);
+	geometry_ = arena_->allocate(vertices.data(), numVertices, indices.data(), indices.size());
+
+	printf("Mesh vertex format: %s, was %d bytes/vertex as separate float buffers\n",
+	       vertexFormat_.toString().c_str(), VertexFormat::full().stride());
+	printf("Mesh vertices: %d unique of %lu, in arena page %d\n", numVertices, indices.size(), geometry_.page);
+
+	checkGLError("after vertex arena setup");
+
+	// the material palette, padded to the size of the "Materials" block
+	vector<float> materials(4 * MESH_MAX_MATERIALS, 0.f);
+	for (size_t m = 0; m < materialPalette.size(); ++m) {
+		materials[4 * m + 0] = materialPalette[m].x;
+		materials[4 * m + 1] = materialPalette[m].y;
+		materials[4 * m + 2] = materialPalette[m].z;
+	}
+	materialsUniformBufferId_ = gl_mgr_->createUniformBuffer(materials.size() * sizeof(float));
+	gl_mgr_->updateUniformBuffer(materialsUniformBufferId_, materials.data(), materials.size() * sizeof(float));
+	labelGLObject(GL_BUFFER, materialsUniformBufferId_.id, "mesh " + polyMesh.name + " materials");
+
+	printf("Mesh materials: %lu, drawn as %lu submeshes\n", materialPalette.size(), submeshes_.size());
+
+	checkGLError("after materials setup");
+}
+
+VertexFormat MeshAsset::streamsReadByShader(VertexFormat format) const {
+
+	format.hasNormal = shader_->usesVertexAttribute(VTX_NORMAL_LOCATION) ||
+	                   shader_->usesVertexAttribute(VTX_NORMAL_OCT_LOCATION);
+	format.hasTangent = hasTexcoordData_ && (shader_->usesVertexAttribute(VTX_TANGENT_LOCATION) ||
+	                                         shader_->usesVertexAttribute(VTX_TANGENT_OCT_LOCATION));
+	format.hasTexcoord = hasTexcoordData_ && shader_->usesVertexAttribute(VTX_TEXCOORD_LOCATION);
+	return format;
+}
+
+void MeshAsset::resolveShaderParameters() {
+
+	shaderParams_.useTextureMapping = shader_->getUniform("useTextureMapping");
+	shaderParams_.useNormalMapping = shader_->getUniform("useNormalMapping");
+	shaderParams_.useEnvironmentMapping = shader_->getUniform("useEnvironmentMapping");
+	shaderParams_.useMirrorBRDF = shader_->getUniform("useMirrorBRDF");
+	shaderParams_.specExp = shader_->getUniform("spec_exp");
+	shaderParams_.objectIndex = shader_->getUniform("object_index");
+	shaderParams_.materialIndex = shader_->getUniform("material_index");
+	shaderParams_.diffuseTextureSampler = shader_->getUniform("diffuseTextureSampler");
+}
+
+MeshAsset::~MeshAsset() {
+
+	arena_->free(geometry_);
+	gl_mgr_->freeUniformBuffer(materialsUniformBufferId_);
+}
+
+void MeshAsset::checkVertexStreams() const {
+
+	// the vertex buffer only holds the streams the previous shader read
+	VertexFormat needed = streamsReadByShader(vertexFormat_);
+	if ((needed.hasNormal && !vertexFormat_.hasNormal) || (needed.hasTangent && !vertexFormat_.hasTangent) ||
+	    (needed.hasTexcoord && !vertexFormat_.hasTexcoord)) {
+		cerr << "Warning: the reloaded shader reads vertex attributes that were not uploaded when the mesh was loaded"
+		     << " (" << vertexFormat_.toString() << "). Restart to upload them." << endl;
+	}
+}
+
+// static
+MeshAssetRegistry* MeshAssetRegistry::instance() {
+	// Object with static storage is never freed.
+	static MeshAssetRegistry* singleton = new MeshAssetRegistry();
+	return singleton;
+}
+
+MeshAsset* MeshAssetRegistry::getAsset(const Collada::PolymeshInfo& polyMesh) {
+
+	AssetKey key(&polyMesh.geometry(), polyMesh.vertex_format, polyMesh.vert_filename, polyMesh.frag_filename);
+	MeshAsset*& asset = assets_[key];
+	if (!asset)
+		asset = new MeshAsset(polyMesh);
+	return asset;
+}
+
+TextureId MeshAssetRegistry::getTexture(const std::string& filename) {
+
+	auto found = textures_.find(filename);
+	if (found != textures_.end())
+		return found->second;
+
+	vector<unsigned char> texture;
+	unsigned int width = 0, height = 0;
+	unsigned int error = lodepng::decode(texture, width, height, filename);
+	if (error) cerr << "Texture loading error = " << filename << endl;
+
+	TextureId textureId = GLResourceManager::instance()->createTextureFromData(texture.data(), width, height);
+	labelGLObject(GL_TEXTURE, textureId.id, filename);
+	textures_[filename] = textureId;
+	return textureId;
+}
+
+GeometryArena* MeshAssetRegistry::getArena(const VertexFormat& format) {
+
+	GeometryArena*& arena = arenas_[format.toString()];
+	if (!arena)
+		arena = new GeometryArena(format.stride(), format.positionStride(), format.attributes(), "mesh arena " + format.toString());
+	return arena;
+}
+
+void MeshAssetRegistry::checkVertexStreams() const {
+	for (const auto& entry : assets_)
+		entry.second->checkVertexStreams();
+}
+
+}  // namespace DynamicScene
+}  // namespace CS248
@@ -0,0 +1,147 @@
+#ifndef CS248_DYNAMICSCENE_MESH_ASSET_H
+#define CS248_DYNAMICSCENE_MESH_ASSET_H
+
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "triangle_bvh.h"
+#include "vertex_format.h"
+
+#include "../bbox.h"
+#include "../collada/polymesh_info.h"
+#include "../shader.h"
+#include "../gl_resource_manager.h"
+#include "../geometry_arena.h"
+
+#define MESH_MAX_MATERIALS 64  // must match MAX_MESH_MATERIALS in the shaders
+
+namespace CS248 {
+namespace DynamicScene {
+
+/**
+ * The GL resources of the geometry of a mesh file: its vertices and indices (suballocated from the
+ * GeometryArena of its vertex format), its material palette, and the shader it is drawn with (the vertex format depends on it).
+ * Meshes placing the same file with the same shaders share one asset (see MeshAssetRegistry),
+ * so the file is uploaded once and its copies can be drawn by a single instanced draw call.
+ */
+class MeshAsset {
+  public:
+    MeshAsset(const Collada::PolymeshInfo& polyMesh);
+    ~MeshAsset();
+
+    // A range of consecutive indices whose triangles share a material. The triangles of the
+    // mesh are sorted by material, so each material is drawn with a single draw call.
+    struct Submesh {
+        int firstIndex;         // relative to the first index of the mesh in its arena
+        int numIndices;
+        int materialIndex;      // into the "Materials" uniform block
+    };
+
+    // handles to the parameters of the shader, so that drawing does not look up parameters by name
+    struct ShaderParameters {
+        UniformHandle useTextureMapping;
+        UniformHandle useNormalMapping;
+        UniformHandle useEnvironmentMapping;
+        UniformHandle useMirrorBRDF;
+        UniformHandle specExp;
+        UniformHandle objectIndex;
+        UniformHandle materialIndex;
+        UniformHandle diffuseTextureSampler;
+    };
+
+    Shader* getShader() const { return shader_; }
+    const ShaderParameters& getShaderParameters() const { return shaderParams_; }
+
+    int getNumTriangles() const { return numTriangles_; }
+    const std::vector<Submesh>& getSubmeshes() const { return submeshes_; }
+    UniformBufferId getMaterialsUniformBufferId() const { return materialsUniformBufferId_; }
+    // the vertex array of the arena page holding the mesh, shared with the other meshes of the page
+    VertexArrayId getVertexArrayId() const { return arena_->getVertexArrayId(geometry_.page); }
+    // the same, reading the positions only (e.g. for the depth-only shadow passes)
+    VertexArrayId getPositionVertexArrayId() const { return arena_->getPositionVertexArrayId(geometry_.page); }
+    const GeometryArena::Allocation& getGeometry() const { return geometry_; }
+    const VertexFormat& getVertexFormat() const { return vertexFormat_; }
+    const Matrix4x4& getPositionDecode() const { return positionDecode_; }
+
+    // object space bounding box of the vertex positions
+    const BBox& getBBox() const { return objectBBox_; }
+
+    // the hierarchy of the object space triangles, for ray queries on the CPU. Triangles are
+    // numbered like the polygons of the mesh file.
+    const TriangleBVH& getBVH() const { return bvh_; }
+
+    // warns if the shader, after it was reloaded, reads vertex streams that were not uploaded
+    void checkVertexStreams() const;
+
+  private:
+
+    // Resolves the handles of all shader parameters set by Mesh::internalDraw()
+    void resolveShaderParameters();
+
+    // Returns `format` with only the vertex streams that shader_ reads and the mesh has data for
+    VertexFormat streamsReadByShader(VertexFormat format) const;
+
+    int numTriangles_;
+    vector<Submesh> submeshes_;
+
+    // OpenGL uniform buffer holding the diffuse color of each material (the "Materials" block)
+    UniformBufferId materialsUniformBufferId_;
+
+    BBox objectBBox_;
+    TriangleBVH bvh_;
+
+    // true if the mesh has texture coordinates (tangents are derived from them)
+    bool hasTexcoordData_;
+
+    // (wrapped) OpenGL program object, owned by the ShaderCache
+    Shader* shader_;
+    ShaderParameters shaderParams_;
+    GLResourceManager* gl_mgr_;
+
+    // The vertices (in vertexFormat_, with the positions split off by the arena) and indices of
+    // the mesh, within the arena of its vertex format. The arena's vertex arrays use the fixed
+    // attribute locations shared by all programs, so they serve both the mesh and shadow shaders.
+    GeometryArena* arena_;
+    GeometryArena::Allocation geometry_;
+    VertexFormat   vertexFormat_;
+    // maps the (possibly quantized) positions of the vertex buffer to object space
+    Matrix4x4      positionDecode_;
+};
+
+/**
+ * Creates each mesh asset and texture of the scene once, and hands them out to every mesh
+ * that uses them. The registry owns them, and they live as long as the program.
+ */
+class MeshAssetRegistry {
+  public:
+    static MeshAssetRegistry* instance();
+
+    // returns the asset of the geometry of `polyMesh` drawn with its shaders, creating it on first use
+    MeshAsset* getAsset(const Collada::PolymeshInfo& polyMesh);
+
+    // returns the texture decoded from a PNG file, creating it on first use
+    TextureId getTexture(const std::string& filename);
+
+    // returns the arena holding the geometry of every mesh in `format`, creating it on first use
+    GeometryArena* getArena(const VertexFormat& format);
+
+    // checks the vertex streams of every asset, once the shaders were reloaded
+    void checkVertexStreams() const;
+
+  private:
+    MeshAssetRegistry() {}
+
+    // keyed by the source of the geometry (see PolymeshInfo::geometry()), the vertex format
+    // option and the shader filenames
+    typedef std::tuple<const Collada::PolymeshInfo*, std::string, std::string, std::string> AssetKey;
+    std::map<AssetKey, MeshAsset*> assets_;
+    std::map<std::string, TextureId> textures_;
+    std::map<std::string, GeometryArena*> arenas_;  // keyed by VertexFormat::toString()
+};
+
+}  // namespace DynamicScene
+}  // namespace CS248
+
+#endif  // CS248_DYNAMICSCENE_MESH_ASSET_H
@@ -0,0 +1,74 @@
+#include "render_queue.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace CS248 {
+namespace DynamicScene {
+
+namespace {
+
+const int kLayerShift          = 60;
+const int kTransformChunkShift = 52;
+const int kProgramShift        = 36;
+const int kTextureSetShift     = 16;
+
+const int kDepthBits = 16;
+
+// the 8-bit digits sorted on by the radix sort
+const int kRadixBits = 8;
+const int kRadixSize = 1 << kRadixBits;
+
+}  // namespace
+
+// static
+uint64_t RenderQueue::makeKey(Layer layer, int transformChunk, GLuint program, GLuint textureSet,
+                              float viewDepth, float nearClip, float farClip) {
+    // logarithmic buckets give the same relative precision near and far
+    float t = 0.f;
+    if (viewDepth > nearClip)
+        t = std::log(viewDepth / nearClip) / std::log(farClip / nearClip);
+    t = std::min(std::max(t, 0.f), 1.f);
+    uint64_t depthBucket = (uint64_t)(t * ((1 << kDepthBits) - 1));
+
+    return ((uint64_t)(layer & 0xf) << kLayerShift) |
+           ((uint64_t)(transformChunk & 0xff) << kTransformChunkShift) |
+           ((uint64_t)(program & 0xffff) << kProgramShift) |
+           ((uint64_t)(textureSet & 0xffff) << kTextureSetShift) |
+           depthBucket;
+}
+
+// static
+bool RenderQueue::sameState(uint64_t key, uint64_t other) {
+    return (key >> kDepthBits) == (other >> kDepthBits);
+}
+
+void RenderQueue::sort() {
+
+    // least significant digit first radix sort. Each pass is a stable counting sort, so the
+    // packets end up ordered by key, and packets with equal keys keep their submission order.
+    scratch_.resize(packets_.size());
+
+    for (int shift = 0; shift < 64; shift += kRadixBits) {
+        size_t count[kRadixSize] = {0};
+        for (const RenderPacket& packet : packets_)
+            count[(packet.key >> shift) & (kRadixSize - 1)]++;
+
+        // skip digits that all packets share (most of them, with few programs and chunks)
+        if (count[(packets_.empty() ? 0 : (packets_[0].key >> shift) & (kRadixSize - 1))] == packets_.size())
+            continue;
+
+        size_t offset = 0;
+        for (int d = 0; d < kRadixSize; d++) {
+            size_t n = count[d];
+            count[d] = offset;
+            offset += n;
+        }
+        for (const RenderPacket& packet : packets_)
+            scratch_[count[(packet.key >> shift) & (kRadixSize - 1)]++] = packet;
+        packets_.swap(scratch_);
+    }
+}
+
+}  // namespace DynamicScene
+}  // namespace CS248
@@ -0,0 +1,66 @@
+#ifndef CS248_DYNAMICSCENE_RENDER_QUEUE_H
+#define CS248_DYNAMICSCENE_RENDER_QUEUE_H
+
+#include <cstdint>
+#include <vector>
+
+#include "GL/glew.h"
+
+namespace CS248 {
+namespace DynamicScene {
+
+class SceneObject;
+
+// One draw of a scene object, ordered by its sort key
+struct RenderPacket {
+    uint64_t     key;
+    SceneObject* object;
+    int          objectIndex;   // index of the object's transforms (see Scene::beginFrame)
+    int          instanceCount; // number of objects drawn as instances, from objectIndex on
+    int          firstCommand;  // first indirect draw command of the objects (see GpuCuller), or -1
+    int          numCommands;
+};
+
+/**
+ * The draws of one rendering pass. Objects submit a packet each, and the packets are sorted by
+ * a 64-bit key before they are drawn. From the most to the least significant bits, the key is:
+ *
+ *   layer (4 bits)             passes drawn in a fixed order (e.g. opaque before transparent)
+ *   transform chunk (8 bits)   so the chunk of the transform uniform buffer is bound once
+ *   program (16 bits)          so objects sharing a program are drawn together
+ *   texture set (16 bits)      so objects sharing textures are drawn together
+ *   depth bucket (16 bits)     front to back, so that early depth testing rejects hidden fragments
+ *
+ * Ties keep the submission order, so the draw order only depends on the scene.
+ */
+class RenderQueue {
+ public:
+    enum Layer {
+        OPAQUE_LAYER = 0,
+    };
+
+    // Builds a sort key. `viewDepth` is the distance of the object from the eye along the view
+    // direction; depths are bucketed logarithmically between `nearClip` and `farClip`.
+    static uint64_t makeKey(Layer layer, int transformChunk, GLuint program, GLuint textureSet,
+                            float viewDepth, float nearClip, float farClip);
+
+    // true if the keys only differ by their depth, i.e. the packets are drawn with the same state
+    static bool sameState(uint64_t key, uint64_t other);
+
+    void clear() { packets_.clear(); }
+    void submit(const RenderPacket& packet) { packets_.push_back(packet); }
+
+    // sorts the packets by key (stable radix sort)
+    void sort();
+
+    const std::vector<RenderPacket>& packets() const { return packets_; }
+
+ private:
+    std::vector<RenderPacket> packets_;
+    std::vector<RenderPacket> scratch_;   // kept to avoid allocating on every sort
+};
+
+}  // namespace DynamicScene
+}  // namespace CS248
+
+#endif  // CS248_DYNAMICSCENE_RENDER_QUEUE_H
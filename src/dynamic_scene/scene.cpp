@@ -1,7 +1,14 @@
 #include "scene.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
 #include <fstream>
+#include <random>
+#include <unordered_map>
 
+#include "../frame_stats.h"
 #include "../gl_utils.h"
 #include "mesh.h"
 
@@ -74,20 +81,326 @@ std::pair<std::vector<float>, std::vector<float>> getTextureVizBuffers(float z)
   return std::make_pair(vtx, texcoords);
 }
 
+// Host-side image of the "Lights" uniform block declared in the shaders. Members follow
+// the std140 layout rules: every element of a vec3 or float array occupies 16 bytes.
+struct LightsUniformBlock {
+  int   numDirectionalLights;
+  int   numPointLights;
+  int   numSpotLights;
+  int   pad0;
+  float directionalLightVectors[SCENE_MAX_LIGHTS][4];
+  float pointLightPositions[SCENE_MAX_LIGHTS][4];
+  float spotLightPositions[SCENE_MAX_LIGHTS][4];
+  float spotLightDirections[SCENE_MAX_LIGHTS][4];
+  float spotLightIntensities[SCENE_MAX_LIGHTS][4];
+  float spotLightAngles[SCENE_MAX_LIGHTS][4];
+};
+
+static_assert(sizeof(LightsUniformBlock) == 16 + 6 * SCENE_MAX_LIGHTS * 16,
+              "Fatal error: LightsUniformBlock does not match the std140 layout of the Lights block.");
+
+// Host-side image of the "View" uniform block (std140), one per rendering pass
+struct ViewUniformBlock {
+  float worldToNDC[16];
+  float cameraPosition[4];
+  float worldToShadowLight[SCENE_MAX_SHADOWED_LIGHTS][16];
+};
+
+static_assert(sizeof(ViewUniformBlock) == 80 + SCENE_MAX_SHADOWED_LIGHTS * 64,
+              "Fatal error: ViewUniformBlock does not match the std140 layout of the View block.");
+
+// number of views in the view uniform buffer: the camera, then one per shadowed light
+const int kNumViewSlots = 1 + SCENE_MAX_SHADOWED_LIGHTS;
+
+// Host-side image of the "ShadowLayers" uniform block (std140) of the layered shadow pass. Map k
+// is drawn into the tile of the shadow atlas given by layerViewport[k] (see tileViewport).
+struct ShadowLayersUniformBlock {
+  float worldToLayerNDC[SCENE_MAX_SHADOWED_LIGHTS][16];
+  float layerViewport[SCENE_MAX_SHADOWED_LIGHTS][4];
+  int   numLayers;
+  int   pad[3];
+};
+
+static_assert(sizeof(ShadowLayersUniformBlock) == SCENE_MAX_SHADOWED_LIGHTS * 80 + 16,
+              "Fatal error: ShadowLayersUniformBlock does not match the std140 layout of the ShadowLayers block.");
+
+// scenes of fewer objects update their per-object data on one thread (see Scene::beginFrame)
+const int kMinParallelObjects = 1024;
+
+void packVector(float dst[4], const Vector3D& v) {
+  dst[0] = v.x;
+  dst[1] = v.y;
+  dst[2] = v.z;
+  dst[3] = 0.f;
+}
+
+// column-major, as expected by GL
+void packMatrix(float dst[16], const Matrix4x4& m) {
+  for (int i=0; i<4; i++) {
+    const Vector4D& c = m.column(i);
+    dst[4*i+0] = c[0]; dst[4*i+1] = c[1]; dst[4*i+2] = c[2]; dst[4*i+3] = c[3];
+  }
+}
+
+void packMatrix(float dst[3][4], const Matrix3x3& m) {
+  for (int i=0; i<3; i++) {
+    packVector(dst[i], m.column(i));
+  }
+}
+
+int alignUp(int size, int alignment) {
+  return (size + alignment - 1) / alignment * alignment;
+}
+
+// true if one of the regions intersects the frustum
+bool anyIntersects(const std::vector<BBox>& regions, const Frustum& frustum) {
+  for (const BBox& region : regions) {
+    if (frustum.intersects(region))
+      return true;
+  }
+  return false;
+}
+
+// The box around the part of `bounds` in the view frustum of `worldToNDC` (all of `bounds` if the
+// frustum is not bounded, e.g. if the transform is degenerate). Empty if they do not overlap.
+BBox frustumBox(const Matrix4x4& worldToNDC, const BBox& bounds) {
+  Matrix4x4 ndcToWorld = worldToNDC.inv();
+  BBox box;
+  for (int i=0; i<8; i++) {
+    Vector4D corner = ndcToWorld * Vector4D(i & 1 ? 1. : -1., i & 2 ? 1. : -1., i & 4 ? 1. : -1., 1.);
+    Vector3D p = corner.projectTo3D();
+    if (!(corner.w > 0.) || !std::isfinite(p.x) || !std::isfinite(p.y) || !std::isfinite(p.z))
+      return bounds;
+    box.expand(p);
+  }
+  for (int axis=0; axis<3; axis++) {
+    box.min[axis] = std::max(box.min[axis], bounds.min[axis]);
+    box.max[axis] = std::min(box.max[axis], bounds.max[axis]);
+  }
+  return box;
+}
+
+// A shadow map is drawn into its tile less a border of kShadowTileBorder texels, which clearTile
+// leaves at the far depth: filtered lookups (e.g. percentage closer filtering) near the edge of
+// a map then read "not in shadow", as outside the light's frustum, rather than the depths of the
+// neighboring tile.
+const int kShadowTileBorder = 4;
+ShadowAtlas::Tile mapArea(const ShadowAtlas::Tile& tile) {
+  ShadowAtlas::Tile area;
+  area.x = tile.x + kShadowTileBorder;
+  area.y = tile.y + kShadowTileBorder;
+  area.size = std::max(0, tile.size - 2 * kShadowTileBorder);
+  return area;
+}
+
+// the transform from the [0,1]^2 texture coordinates of a shadow map to those of its area in
+// the atlas (applied to homogeneous coordinates, before the divide)
+Matrix4x4 tileTransform(const ShadowAtlas::Tile& tile, int atlasSize) {
+  ShadowAtlas::Tile area = mapArea(tile);
+  double scale = (double)area.size / atlasSize;
+  Matrix4x4 m = Matrix4x4::identity();
+  m(0, 0) = scale;
+  m(1, 1) = scale;
+  m(0, 3) = (double)area.x / atlasSize;
+  m(1, 3) = (double)area.y / atlasSize;
+  return m;
+}
+
+// the same from the normalized device coordinates of a shadow map to those of the atlas, as the
+// scale (xy) and offset (zw) of the "layer_viewport" of the layered pass
+void tileViewport(float dst[4], const ShadowAtlas::Tile& tile, int atlasSize) {
+  ShadowAtlas::Tile area = mapArea(tile);
+  dst[0] = dst[1] = (float)area.size / atlasSize;
+  dst[2] = (2.f * area.x + area.size) / atlasSize - 1.f;
+  dst[3] = (2.f * area.y + area.size) / atlasSize - 1.f;
+}
+
+// clears the tile of a shadow map, leaving the rest of the atlas
+void clearTile(const ShadowAtlas::Tile& tile) {
+  glEnable(GL_SCISSOR_TEST);
+  glScissor(tile.x, tile.y, tile.size, tile.size);
+  glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
+  glDisable(GL_SCISSOR_TEST);
+}
+
+// The fraction of the screen covered by a sphere, seen by `camera` (as the disk the sphere
+// subtends, which may extend past the screen): 0 if it is outside the view, 1 if the camera is in it.
+float screenCoverage(const Camera& camera, const Vector3D& center, double radius) {
+  Vector3D toCenter = center - camera.getPosition();
+  double distance = toCenter.norm();
+  if (distance <= radius)
+    return 1.f;
+  double tanHalfFov = tan(radians(camera.getVFov()) / 2.);
+  double aspect = camera.getAspectRatio();
+  Vector3D viewDir = (camera.getViewPoint() - camera.getPosition()).unit();
+  double halfDiagonal = atan(tanHalfFov * sqrt(1. + aspect * aspect));
+  double angularRadius = asin(radius / distance);
+  double angle = acos(std::max(-1., std::min(1., dot(viewDir, toCenter) / distance)));
+  if (angle - angularRadius > halfDiagonal)
+    return 0.f;
+  double diskRadius = tan(std::min(angularRadius, M_PI / 2. - 1e-3));
+  return std::min(1., M_PI * diskRadius * diskRadius / (4. * tanHalfFov * tanHalfFov * aspect));
+}
+
+// an orthographic worldToNDC transform whose view volume is `box`, slightly enlarged
+Matrix4x4 boxToNDC(const BBox& box) {
+  Vector3D scale;
+  for (int axis=0; axis<3; axis++)
+    scale[axis] = 2. / (1.01 * std::max(box.max[axis] - box.min[axis], 1e-3));
+  return Matrix4x4::scaling(scale) * Matrix4x4::translation(-box.centroid());
+}
+
+// The size of the shadow atlas of `numLights` maps: the largest power of two whose square keeps
+// within SCENE_SHADOW_TEXELS_PER_LIGHT per light, for both atlases if the static maps have one
+// of their own, and that the GL can allocate.
+const int kMinShadowTileSize = 128;
+int shadowAtlasSize(int numLights, bool staticMaps) {
+  long long budget = (long long)numLights * SCENE_SHADOW_TEXELS_PER_LIGHT / (staticMaps ? 2 : 1);
+  GLint maxTextureSize = 0;
+  glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+  int size = kMinShadowTileSize;
+  while ((long long)(2 * size) * (2 * size) <= budget && 2 * size <= maxTextureSize)
+    size *= 2;
+  return size;
+}
+
 }  // namespace
 
+static_assert(SCENE_MAX_LIGHTS >= SCENE_MAX_SHADOWED_LIGHTS,
+              "Fatal error: the Lights block has fewer spot lights than can be shadowed.");
+static_assert(kNumViewSlots <= FrameStats::kMaxCullingPasses,
+              "Fatal error: FrameStats has fewer culling passes than the scene has views.");
+
+void SceneObject::updateTransforms() const {
+    if (transformsValid_)
+        return;
+
+    // (the normal transform ignores the translations)
+    float deg2Rad = M_PI / 180.0;
+    Matrix4x4 rotationScale = Matrix4x4::rotation(rotation_.x * deg2Rad, Matrix4x4::Axis::X) *
+                              Matrix4x4::rotation(rotation_.y * deg2Rad, Matrix4x4::Axis::Y) *
+                              Matrix4x4::rotation(rotation_.z * deg2Rad, Matrix4x4::Axis::Z) *
+                              Matrix4x4::scaling(scale_);
+    objectToWorld_ = parentToWorld_ * Matrix4x4::translation(position_) * rotationScale;
+    objectToWorldForNormals_ = normalTransform(objectToWorld_);
+    worldToObject_ = objectToWorld_.inv();
+    transformsValid_ = true;
+}
+
+void SceneObject::getBoundingSphere(Vector3D* center, float* radius) const {
+    BBox bbox = getBBox();
+    *center = bbox.centroid();
+    *radius = 0.5 * bbox.extent.norm();
+}
+
+const SceneObject::WorldBounds& SceneObject::getWorldBounds() const {
+    if (!worldBoundsValid_) {
+        worldBounds_.box = getBBox();
+        getBoundingSphere(&worldBounds_.sphereCenter, &worldBounds_.sphereRadius);
+        worldBoundsValid_ = true;
+    }
+    return worldBounds_;
+}
+
+bool SceneObject::intersect(const Vector3D& origin, const Vector3D& direction, float tMax, float* t) const {
+    const BBox& box = getWorldBounds().box;
+    float tEnter = 0.f;
+    float tExit = tMax;
+    for (int axis = 0; axis < 3; axis++) {
+        float t0 = (box.min[axis] - origin[axis]) / direction[axis];
+        float t1 = (box.max[axis] - origin[axis]) / direction[axis];
+        tEnter = std::max(tEnter, std::min(t0, t1));
+        tExit = std::min(tExit, std::max(t0, t1));
+    }
+    if (tEnter > tExit)
+        return false;
+    *t = tEnter;
+    return true;
+}
+
+bool SceneObject::occludes(const Vector3D& origin, const Vector3D& direction, float tMax) const {
+    float t;
+    return intersect(origin, direction, tMax, &t);
+}
+
 
 Scene::Scene(std::vector<SceneObject*> argObjects,
              std::vector<SceneLight*>  argLights,
-             const std::string& baseShaderDir) {
-
+             const std::string& baseShaderDir,
+             const std::vector<Collada::GroupInfo>& groups,
+             const std::vector<int>& objectGroups) {
+
+    gl_mgr_ = GLResourceManager::instance();
+
+    // group the objects that can be drawn as instances of the first object of their group (and
+    // that are static if it is, so that the shadow passes can draw the static objects alone).
+    // The groups are found by the instance key of the objects, and static ones, so that only the
+    // groups whose key collides are compared.
+    std::vector<std::vector<int>> instanceGroups;
+    std::unordered_map<size_t, std::vector<int>> groupsByKey;
     for (int i = 0; i < argObjects.size(); i++) {
         argObjects[i]->setScene(this);
-        objects_.insert(argObjects[i]);
+        size_t key = argObjects[i]->getInstanceKey() * 2 + (argObjects[i]->isStatic() ? 1 : 0);
+        std::vector<int>& candidates = groupsByKey[key];
+        auto group = std::find_if(candidates.begin(), candidates.end(), [&](int g) {
+            const SceneObject* first = argObjects[instanceGroups[g][0]];
+            return first->canInstanceWith(argObjects[i]) && first->isStatic() == argObjects[i]->isStatic();
+        });
+        if (group == candidates.end()) {
+            candidates.push_back(instanceGroups.size());
+            instanceGroups.push_back(std::vector<int>(1, i));
+        } else {
+            instanceGroups[*group].push_back(i);
+        }
     }
 
+    for (const std::vector<int>& group : instanceGroups) {
+        for (int i = 0; i < group.size(); i++) {
+            int objectIndex = objects_.size();
+            if (i == 0 || objectIndex % SCENE_MAX_OBJECTS_PER_TRANSFORM_CHUNK == 0) {
+                instanceBatches_.push_back(InstanceBatch());
+                instanceBatches_.back().firstObject = objectIndex;
+                instanceBatches_.back().numObjects = 0;
+            }
+            instanceBatches_.back().numObjects++;
+            objects_.push_back(argObjects[group[i]]);
+            objectHandles_.push_back(group[i]);
+        }
+    }
+    handleObjects_.resize(objects_.size());
+    for (int i = 0; i < objects_.size(); i++)
+        handleObjects_[objectHandles_[i]] = i;
+
+    // the groups, which place their objects before anything reads the objects' transforms
+    std::vector<int> groupParents;
+    std::vector<Matrix4x4> groupTransforms;
+    for (const Collada::GroupInfo& group : groups) {
+        groupParents.push_back(group.parent);  // (-1, i.e. kNoParent, for top-level groups)
+        groupTransforms.push_back(group.transform);
+    }
+    groupHierarchy_.build(groupParents, groupTransforms);
+    groupObjectsStart_.assign(groups.size() + 1, 0);
+    for (int i = 0; i < objects_.size(); i++) {
+        int group = objectGroups[objectHandles_[i]];
+        if (group >= 0)
+            groupObjectsStart_[group + 1]++;
+    }
+    for (int g = 0; g < groups.size(); g++)
+        groupObjectsStart_[g + 1] += groupObjectsStart_[g];
+    groupObjects_.resize(groupObjectsStart_[groups.size()]);
+    std::vector<int> numGroupObjects(groups.size(), 0);
+    for (int i = 0; i < objects_.size(); i++) {
+        int group = objectGroups[objectHandles_[i]];
+        if (group >= 0)
+            groupObjects_[groupObjectsStart_[group] + numGroupObjects[group]++] = i;
+    }
+    placeGroupedObjects();
+    if (!groups.empty())
+        printf("Scene groups: %lu, placing %lu objects\n", groups.size(), groupObjects_.size());
+    printf("Scene objects: %lu, drawn as %lu instance batches\n", objects_.size(), instanceBatches_.size());
+
     for (int i = 0; i < argLights.size(); i++) {
-        lights_.insert(argLights[i]);
+        lights_.push_back(argLights[i]);
     }
 
     for (SceneLight* sl : lights_) {
@@ -113,38 +426,139 @@ Scene::Scene(std::vector<SceneObject*> argObjects,
 
     // the following code creates frame buffer objects to render shadows
 
+    // uniform buffer holding the light parameters shared by all shader programs
+    lightsUniformBufferId_ = gl_mgr_->createUniformBuffer(sizeof(LightsUniformBlock));
+
+    // uniform buffers holding the per-pass views and the per-object transforms. Slots and chunks
+    // are bound with bindUniformBufferRange, so their offsets must be suitably aligned.
+    int alignment = gl_mgr_->getUniformBufferOffsetAlignment();
+    viewSlotStride_ = alignUp(sizeof(ViewUniformBlock), alignment);
+    viewUniformBufferId_ = gl_mgr_->createUniformBuffer(kNumViewSlots * viewSlotStride_);
+
+    numTransformChunks_ = std::max(1, ((int)objects_.size() + SCENE_MAX_OBJECTS_PER_TRANSFORM_CHUNK - 1) / SCENE_MAX_OBJECTS_PER_TRANSFORM_CHUNK);
+    transformChunkStride_ = alignUp(SCENE_MAX_OBJECTS_PER_TRANSFORM_CHUNK * sizeof(ObjectTransformBlock), alignment);
+    transformsUniformBufferId_ = gl_mgr_->createUniformBuffer(numTransformChunks_ * transformChunkStride_);
+    labelGLObject(GL_BUFFER, lightsUniformBufferId_.id, "Lights uniform block");
+    labelGLObject(GL_BUFFER, viewUniformBufferId_.id, "View uniform block");
+    labelGLObject(GL_BUFFER, transformsUniformBufferId_.id, "Transforms uniform block");
+
+    // with GPU culling, every batch is drawn by the indirect commands of its first object. The
+    // shadow commands of all batches come first, in the order of the batches, so that the shadow
+    // passes draw consecutive batches with one multi-draw (see drawObjects). Their base instance
+    // is where the batch lists its visible objects in the chunk (see shadow_pass.vert).
+    if (GpuCuller::isSupported()) {
+        std::vector<DrawElementsIndirectCommand> shadowCommands;
+        std::vector<DrawElementsIndirectCommand> commands;
+        for (InstanceBatch& batch : instanceBatches_) {
+            batch.firstShadowCommand = shadowCommands.size();
+            batch.firstCommand = commands.size();
+            objects_[batch.firstObject]->getIndirectCommands(&shadowCommands, &commands);
+            batch.numShadowCommands = shadowCommands.size() - batch.firstShadowCommand;
+            batch.numCommands = commands.size() - batch.firstCommand;
+            for (int c = batch.firstShadowCommand; c < (int)shadowCommands.size(); c++)
+                shadowCommands[c].baseInstance = batch.firstObject % SCENE_MAX_OBJECTS_PER_TRANSFORM_CHUNK;
+        }
+        std::vector<GpuCuller::Batch> cullBatches;
+        for (InstanceBatch& batch : instanceBatches_) {
+            batch.firstCommand += shadowCommands.size();
+            if (batch.numCommands == 0 && batch.numShadowCommands == 0) {
+                batch.firstCommand = batch.firstShadowCommand = -1;
+                continue;
+            }
+            cullBatches.push_back({batch.firstObject, batch.numObjects, batch.firstShadowCommand,
+                                   batch.numShadowCommands, batch.firstCommand, batch.numCommands});
+        }
+        commands.insert(commands.begin(), shadowCommands.begin(), shadowCommands.end());
+        if (!commands.empty())
+            gpuCuller_ = new GpuCuller(baseShaderDir, objects_.size(), cullBatches, commands, kNumViewSlots);
+    } else {
+        printf("GPU culling: unavailable (needs GL 4.3), culling on the CPU\n");
+    }
+
+    // the batches without indirect commands are culled on the CPU
+    cpuCulling_ = false;
+    for (const InstanceBatch& batch : instanceBatches_)
+        cpuCulling_ |= batch.firstCommand < 0;
+    cullingBounds_.resize(objects_.size());
+
+    // the transforms and bounds are filled in by the first beginFrame
+    objectData_.transforms.resize(objects_.size());
+    objectData_.worldBoxes.resize(objects_.size());
+    objectData_.transformVersions.assign(objects_.size(), -1);
+    objectData_.visible.resize(objects_.size());
+    objectData_.isStatic.resize(objects_.size());
+    for (int i = 0; i < (int)objects_.size(); i++)
+        objectData_.isStatic[i] = objects_[i]->isStatic();
+    previousWorldBoxes_.resize(objects_.size());
+    updateSortState();
+
+    // the tree of the objects' bounds, built with the surface area heuristic now that all are known
+    objectProxies_.resize(objects_.size());
+    for (int i = 0; i < (int)objects_.size(); i++)
+        objectProxies_[i] = objectTree_.insert(objects_[i]->getWorldBounds().box, i);
+    objectTree_.rebuild();
+    printf("Scene object tree: height %d\n", objectTree_.getHeight());
+
     checkGLError("pre shadow fb setup");
 
     doShadowPass_ = false;
+    cacheStaticShadows_ = false;
+    layeredShadowsSupported_ = false;
+    layeredShadows_ = false;
+    shadowColorMaps_ = false;
+    shadowColorTextureArrayId_.id = 0;
+    staticShadowColorTextureArrayId_.id = 0;
 
     if (getNumShadowedLights() > 0) {
 
         printf("Setting up shadow assets\n");
 
         doShadowPass_ = true;
-        shadowTextureSize_ = 1024;
 
-        gl_mgr_ = GLResourceManager::instance();
-    
         for (int i=0; i<getNumShadowedLights(); i++) {
 
           shadowFrameBufferId_[i] = gl_mgr_->createFrameBuffer();
+          labelGLObject(GL_FRAMEBUFFER, shadowFrameBufferId_[i].id, "shadow map " + std::to_string(i));
 	        checkGLError("after creating framebuffer");
 
         }
 
-        std::tie(shadowDepthTextureArrayId_, shadowColorTextureArrayId_) = gl_mgr_->createDepthAndColorTextureArrayFromFrameBuffers(
-            shadowFrameBufferId_, getNumShadowedLights(), shadowTextureSize_);
+        // the shadow maps of the static objects, if there are both static and dynamic objects
+        int numStatic = std::count(objectData_.isStatic.begin(), objectData_.isStatic.end(), 1);
+        cacheStaticShadows_ = numStatic > 0 && numStatic < (int)objects_.size();
+
+        // the maps of all lights are tiles of one atlas, the single layer of the texture array, which
+        // the frame buffer of every light draws into (see updateShadowAtlas). Depth only: the color
+        // maps are added for the shadow map visualization (see setShadowColorMaps).
+        shadowAtlas_ = ShadowAtlas(shadowAtlasSize(getNumShadowedLights(), cacheStaticShadows_), kMinShadowTileSize);
+        shadowDepthTextureArrayId_ = gl_mgr_->createDepthTextureArray(1, shadowAtlas_.getSize());
+        for (int i=0; i<getNumShadowedLights(); i++) {
+            gl_mgr_->attachTextureArrayLayers(&shadowFrameBufferId_[i], 1, shadowDepthTextureArrayId_,
+                                              shadowColorTextureArrayId_);
+        }
         checkGLError("after binding shadow texture as attachment");
 
-        // glDrawBuffer(GL_NONE); // No color buffer is drawn to
-        // glReadBuffer(GL_NONE); // No color is read from
+        if (cacheStaticShadows_) {
+            for (int i=0; i<getNumShadowedLights(); i++) {
+                staticShadowFrameBufferId_[i] = gl_mgr_->createFrameBuffer();
+                labelGLObject(GL_FRAMEBUFFER, staticShadowFrameBufferId_[i].id, "static shadow map " + std::to_string(i));
+            }
+            staticShadowDepthTextureArrayId_ = gl_mgr_->createDepthTextureArray(1, shadowAtlas_.getSize());
+            for (int i=0; i<getNumShadowedLights(); i++) {
+                gl_mgr_->attachTextureArrayLayers(&staticShadowFrameBufferId_[i], 1, staticShadowDepthTextureArrayId_,
+                                                  staticShadowColorTextureArrayId_);
+            }
+            checkGLError("after creating static shadow maps");
+        }
 
         for (int i=0; i<getNumShadowedLights();i++) {
             // sanity check
             if (!gl_mgr_->checkFrameBuffer(shadowFrameBufferId_[i])) {
                 exit(1);
             }
+            if (cacheStaticShadows_ && !gl_mgr_->checkFrameBuffer(staticShadowFrameBufferId_[i])) {
+                exit(1);
+            }
         }
 
         printf("Done setting up shadow assets\n");
@@ -153,20 +567,67 @@ Scene::Scene(std::vector<SceneObject*> argObjects,
         
         printf("Creating shadow shaders\n");
 
-        // create shader object for shadow passes
+        // create shader objects for shadow passes, one per vertex normal encoding. The depth-only
+        // shaders read no normal, so the cache returns the same one for every encoding.
         string sepchar("/");
-        shadowShader_ = new Shader(baseShaderDir + sepchar + "shadow_pass.vert",
-                                  baseShaderDir + sepchar + "shadow_pass.frag");
+        auto createShadowShaders = [&](bool layered, bool colorMaps) {
+            ShadowShaders& shaders = shadowShaders_[layered][colorMaps];
+            for (int e=0; e<NUM_NORMAL_ENCODINGS; e++) {
+                VertexFormat format;
+                format.normal = (NormalEncoding)e;
+                std::vector<std::string> defines;
+                if (colorMaps) {
+                    defines = format.shaderDefines();
+                    defines.push_back("SHADOW_COLOR_MAPS");
+                }
+                if (gpuCuller_)
+                    defines.push_back(GpuCuller::shaderDefine());
+                if (layered) {
+                    defines.push_back("LAYERED_SHADOWS");
+                    shaders.shader[e] = ShaderCache::instance()->get(baseShaderDir + sepchar + "shadow_pass.vert",
+                                                                     baseShaderDir + sepchar + "shadow_pass.geom",
+                                                                     baseShaderDir + sepchar + "shadow_pass.frag",
+                                                                     defines);
+                } else {
+                    shaders.shader[e] = ShaderCache::instance()->get(baseShaderDir + sepchar + "shadow_pass.vert",
+                                                                     baseShaderDir + sepchar + "shadow_pass.frag",
+                                                                     defines);
+                }
+                shaders.params[e].objectIndex = shaders.shader[e]->getUniform("object_index");
+            }
+        };
+        createShadowShaders(/*layered=*/false, /*colorMaps=*/false);
+        createShadowShaders(/*layered=*/false, /*colorMaps=*/true);
         checkGLError("post shadow shader compile");
         // checkGLError("post shadow shader debug compile");
-        shadowVizShader_ = new Shader(baseShaderDir + sepchar + "shadow_viz.vert",
-                                     baseShaderDir + sepchar + "shadow_viz.frag");
+        // the layered shadow pass draws into the same frame buffers, its geometry shader placing
+        // each triangle in the tiles of the maps (geometry shaders are core in GL 3.2)
+        createShadowShaders(/*layered=*/true, /*colorMaps=*/false);
+        createShadowShaders(/*layered=*/true, /*colorMaps=*/true);
+        shadowLayersUniformBufferId_ = gl_mgr_->createUniformBuffer(sizeof(ShadowLayersUniformBlock));
+        labelGLObject(GL_BUFFER, shadowLayersUniformBufferId_.id, "ShadowLayers uniform block");
+        layeredShadowsSupported_ = true;
+        layeredShadows_ = true;
+        printf("Shadow atlas: %d texels across, shared by %d lights%s\n", shadowAtlas_.getSize(), (int)getNumShadowedLights(),
+               cacheStaticShadows_ ? " (and copied for the static maps)" : "");
+        checkGLError("post layered shadow setup");
+
+        shadowVizShader_ = ShaderCache::instance()->get(baseShaderDir + sepchar + "shadow_viz.vert",
+                                                        baseShaderDir + sepchar + "shadow_viz.frag");
+
+        shadowVizDepthTextureArray_ = shadowVizShader_->getUniform("depthTextureArray");
+        shadowVizColorTextureArray_ = shadowVizShader_->getUniform("colorTextureArray");
 
         std::vector<float> vtx, texcoords;
         std::tie(vtx, texcoords) = getTextureVizBuffers(/*z=*/0.0);
         shadowVizVertexArrayId_ = gl_mgr_->createVertexArray();
         shadowVizVtxBufferId_ = gl_mgr_->createVertexBufferFromData(vtx.data(), vtx.size());
         shadowVizTexCoordBufferId_ = gl_mgr_->createVertexBufferFromData(texcoords.data(), texcoords.size());
+        {
+            auto vertex_array_bind = gl_mgr_->bindVertexArray(shadowVizVertexArrayId_);
+            gl_mgr_->setVertexBuffer(VTX_POSITION_LOCATION, 3, shadowVizVtxBufferId_);
+            gl_mgr_->setVertexBuffer(VTX_TEXCOORD_LOCATION, 2, shadowVizTexCoordBufferId_);
+        }
         checkGLError("post shadow viz shader compile");
 
         printf("Shaders created.\n");
@@ -175,7 +636,33 @@ Scene::Scene(std::vector<SceneObject*> argObjects,
     checkGLError("returning from Scene::Scene");  
 }
 
-Scene::~Scene() { }
+Scene::~Scene() {
+    delete gpuCuller_;
+    gl_mgr_->freeUniformBuffer(lightsUniformBufferId_);
+    gl_mgr_->freeUniformBuffer(viewUniformBufferId_);
+    gl_mgr_->freeUniformBuffer(transformsUniformBufferId_);
+
+    // the shadow assets, created when there are shadowed lights (the color maps only while
+    // they are enabled)
+    if (!doShadowPass_)
+        return;
+    for (int i=0; i<getNumShadowedLights(); i++) {
+        gl_mgr_->freeFrameBuffer(shadowFrameBufferId_[i]);
+        if (cacheStaticShadows_)
+            gl_mgr_->freeFrameBuffer(staticShadowFrameBufferId_[i]);
+    }
+    gl_mgr_->freeTextureArray(shadowDepthTextureArrayId_);
+    if (shadowColorTextureArrayId_.id)
+        gl_mgr_->freeTextureArray(shadowColorTextureArrayId_);
+    if (cacheStaticShadows_)
+        gl_mgr_->freeTextureArray(staticShadowDepthTextureArrayId_);
+    if (staticShadowColorTextureArrayId_.id)
+        gl_mgr_->freeTextureArray(staticShadowColorTextureArrayId_);
+    gl_mgr_->freeUniformBuffer(shadowLayersUniformBufferId_);
+    gl_mgr_->freeVertexArray(shadowVizVertexArrayId_);
+    gl_mgr_->freeVertexBuffer(shadowVizVtxBufferId_);
+    gl_mgr_->freeVertexBuffer(shadowVizTexCoordBufferId_);
+}
 
 size_t Scene::getNumShadowedLights() const {
     // for now, assume all spotlights (up to SCENE_MAX_SHADOWED_LIGHTS) are shadowed
@@ -183,11 +670,99 @@ size_t Scene::getNumShadowedLights() const {
 }
 
 BBox Scene::getBBox() const {
-    BBox bbox;
-    for (SceneObject *obj : objects_) {
-        bbox.expand(obj->getBBox());
+    // the root of the object tree, whose boxes are slightly enlarged
+    return objectTree_.getBounds();
+}
+
+ObjectHandle Scene::pickObject(const Vector3D& origin, const Vector3D& direction, float* distance) const {
+
+    // the closest hit of the objects whose bounding box the ray enters before it
+    ObjectHandle picked;
+    float closest = INFINITY;
+    objectTree_.queryRay(origin, direction, closest, [&](int object, float tMax) {
+        float t;
+        if (!objects_[object]->intersect(origin, direction, tMax, &t))
+            return tMax;
+        picked.id = objectHandles_[object];
+        closest = t;
+        return t;
+    });
+
+    if (distance)
+        *distance = closest;
+    return picked;
+}
+
+void Scene::benchmarkRayQueries() const {
+
+    const int kRaysPerObject = 20000;
+
+    // from random points around each object's bounding sphere, towards random points inside it
+    // (the same rays every time, so that runs compare)
+    std::mt19937 generator(248);
+    std::uniform_real_distribution<float> uniform(-1.f, 1.f);
+    auto randomDirection = [&]() {
+        Vector3D v;
+        do {
+            v = Vector3D(uniform(generator), uniform(generator), uniform(generator));
+        } while (v.norm2() > 1. || v.norm2() < 1e-6);
+        return v.unit();
+    };
+    std::vector<Vector3D> origins, directions;
+    origins.reserve(kRaysPerObject * objects_.size());
+    directions.reserve(kRaysPerObject * objects_.size());
+    for (const SceneObject* obj : objects_) {
+        const SceneObject::WorldBounds& bounds = obj->getWorldBounds();
+        for (int i = 0; i < kRaysPerObject; i++) {
+            Vector3D origin = bounds.sphereCenter + 2.f * bounds.sphereRadius * randomDirection();
+            Vector3D target = bounds.sphereCenter + bounds.sphereRadius * uniform(generator) * randomDirection();
+            origins.push_back(origin);
+            directions.push_back((target - origin).unit());
+        }
+    }
+
+    int numClosestHits = 0;
+    auto closestStart = std::chrono::steady_clock::now();
+    for (int i = 0; i < origins.size(); i++) {
+        float t;
+        numClosestHits += objects_[i / kRaysPerObject]->intersect(origins[i], directions[i], INFINITY, &t);
+    }
+    std::chrono::duration<double> closestTime = std::chrono::steady_clock::now() - closestStart;
+
+    int numAnyHits = 0;
+    auto anyStart = std::chrono::steady_clock::now();
+    for (int i = 0; i < origins.size(); i++)
+        numAnyHits += objects_[i / kRaysPerObject]->occludes(origins[i], directions[i], INFINITY);
+    std::chrono::duration<double> anyTime = std::chrono::steady_clock::now() - anyStart;
+
+    printf("Ray queries: %lu rays at %lu objects (%d%% hit)\n", origins.size(), objects_.size(),
+           origins.empty() ? 0 : 100 * numClosestHits / (int)origins.size());
+    printf("  closest hit: %.2f Mrays/s\n", origins.size() / closestTime.count() * 1e-6);
+    printf("  any hit:     %.2f Mrays/s\n", origins.size() / anyTime.count() * 1e-6);
+    if (numAnyHits != numClosestHits)
+        printf("  (%d rays hit an object by one query and not the other)\n", std::abs(numAnyHits - numClosestHits));
+
+    // the same hits as the exhaustive queries, up to rounding (the triangle tests are the same)
+    const int kCheckedRayStride = 16;
+    int numChecked = 0;
+    int numDifferent = 0;
+    for (int i = 0; i < origins.size(); i += kCheckedRayStride) {
+        const SceneObject* obj = objects_[i / kRaysPerObject];
+        float t, exhaustiveT;
+        bool hit = obj->intersect(origins[i], directions[i], INFINITY, &t);
+        bool exhaustiveHit = obj->intersectExhaustive(origins[i], directions[i], INFINITY, &exhaustiveT);
+        if (hit != exhaustiveHit || (hit && std::abs(t - exhaustiveT) > 1e-4f * std::max(1.f, exhaustiveT)))
+            numDifferent++;
+        numChecked++;
     }
-    return bbox;
+    printf("  checked against exhaustive queries: %d of %d rays differ\n", numDifferent, numChecked);
+}
+
+void Scene::checkGroupTransforms() {
+
+    placeGroupedObjects();
+    printf("Group transforms: %d groups, largest difference from a full recompute: %g\n",
+           groupHierarchy_.size(), groupHierarchy_.maxWorldTransformError());
 }
 
 void Scene::reloadShaders() {
@@ -196,22 +771,306 @@ void Scene::reloadShaders() {
 
     printf("Reloading all shaders.\n");
 
-    // FIXME(kayvonf): this breaks the abstraction that the shader class is the only place
-    // where shader program bindings are changed.  Fix this later.  We may not need it at all.
-    glUseProgram(0);
+    // no program needs to be unbound here: GLResourceManager forgets the binding of freed programs
 
-
-    if (getNumShadowedLights() > 0) {
-      shadowShader_->reload();
-      shadowVizShader_->reload();
-    }
+    // all shaders come from the cache, so each is reloaded once even if objects share it
+    ShaderCache::instance()->reloadAll();
+    MeshAssetRegistry::instance()->checkVertexStreams();
 
     for (SceneObject *obj : objects_)
         obj->reloadShaders();
+    updateSortState();
+
+    // the shadow maps are rendered again with the new shaders
+    for (ShadowMapCache& cache : shadowMapCache_)
+        cache = ShadowMapCache();
 
     checkGLError("end Scene::reloadShaders");
 }
 
+int Scene::placeGroupedObjects() {
+
+    int numUpdated = groupHierarchy_.update();
+    for (int group : groupHierarchy_.getUpdatedNodes()) {
+        const Matrix4x4& groupToWorld = groupHierarchy_.getWorldTransform(group);
+        for (int k = groupObjectsStart_[group]; k < groupObjectsStart_[group + 1]; k++)
+            objects_[groupObjects_[k]]->setParentToWorld(groupToWorld);
+    }
+    return numUpdated;
+}
+
+void Scene::updateSortState() {
+
+    for (int pass = 0; pass < 2; pass++) {
+        objectData_.sortPrograms[pass].resize(objects_.size());
+        objectData_.sortTextureSets[pass].resize(objects_.size());
+        for (int i = 0; i < (int)objects_.size(); i++) {
+            objectData_.sortPrograms[pass][i] = objects_[i]->getSortProgram(pass == 1);
+            objectData_.sortTextureSets[pass][i] = objects_[i]->getSortTextureSet(pass == 1);
+        }
+    }
+}
+
+void Scene::beginFrame() {
+
+    checkGLError("begin Scene::beginFrame");
+
+    LightsUniformBlock block;
+    memset(&block, 0, sizeof(block));
+
+    block.numDirectionalLights = std::min((int)getNumDirectionalLights(), SCENE_MAX_LIGHTS);
+    block.numPointLights = std::min((int)getNumPointLights(), SCENE_MAX_LIGHTS);
+    block.numSpotLights = std::min((int)getNumSpotLights(), SCENE_MAX_LIGHTS);
+
+    for (int j=0; j<block.numDirectionalLights; j++) {
+        packVector(block.directionalLightVectors[j], directionalLights_[j]->lightDir);
+    }
+
+    for (int j=0; j<block.numPointLights; j++) {
+        packVector(block.pointLightPositions[j], pointLights_[j]->position);
+    }
+
+    for (int j=0; j<block.numSpotLights; j++) {
+        const StaticScene::SpotLight* light = spotLights_[j];
+        packVector(block.spotLightPositions[j], light->position);
+        packVector(block.spotLightDirections[j], light->direction);
+        packVector(block.spotLightIntensities[j], Vector3D(light->radiance.r, light->radiance.g, light->radiance.b));
+        block.spotLightAngles[j][0] = light->angle;
+    }
+
+    gl_mgr_->updateUniformBuffer(lightsUniformBufferId_, &block, sizeof(block));
+    gl_mgr_->bindUniformBufferBase(lightsUniformBufferId_, LIGHTS_UNIFORM_BLOCK);
+
+    // the groups moved since the last frame move the objects in them
+    FrameStats& stats = FrameStats::current();
+    stats.transformNodesUpdated += placeGroupedObjects();
+
+    // the transforms and bounds of the objects whose transform changed since the last frame
+    // (all of them on the first frame) are copied into objectData_ and cullingBounds_. Objects
+    // are independent of each other, so large scenes update them in parallel (with OpenMP).
+    // Objects are numbered in the order of objects_; drawObjects() keeps each object's number when it reorders the draws.
+    int numObjects = objects_.size();
+    objectChanged_.assign(numObjects, 0);
+    #pragma omp parallel for if (numObjects >= kMinParallelObjects)
+    for (int i = 0; i < numObjects; i++) {
+        const SceneObject* obj = objects_[i];
+        if (objectData_.transformVersions[i] == obj->getTransformVersion())
+            continue;
+        previousWorldBoxes_[i] = objectData_.worldBoxes[i];
+        ObjectTransformBlock& transform = objectData_.transforms[i];
+        packMatrix(transform.obj2world, obj->getObjectToWorld() * obj->getVertexPositionDecode());
+        packMatrix(transform.obj2worldNorm, obj->getObjectToWorldForNormals());
+        const SceneObject::WorldBounds& bounds = obj->getWorldBounds();
+        objectData_.worldBoxes[i] = bounds.box;
+        cullingBounds_.set(i, bounds.box, bounds.sphereCenter, bounds.sphereRadius);
+        objectData_.transformVersions[i] = obj->getTransformVersion();
+        objectChanged_[i] = 1;
+    }
+
+    // the tree is updated, and the chunks of the transform uniform buffer holding the changed
+    // objects are uploaded again, for all passes of the frame. The shadow maps whose frustum
+    // holds one of the regions the objects moved through are rendered again.
+    std::vector<bool> chunkChanged(numTransformChunks_, false);
+    bool boundsChanged = false;
+    movedRegions_[0].clear();
+    movedRegions_[1].clear();
+    for (int i = 0; i < numObjects; i++) {
+        if (!objectChanged_[i])
+            continue;
+        objectTree_.update(objectProxies_[i], objectData_.worldBoxes[i]);
+        movedRegions_[objectData_.isStatic[i]].push_back(previousWorldBoxes_[i]);
+        movedRegions_[objectData_.isStatic[i]].push_back(objectData_.worldBoxes[i]);
+        chunkChanged[i / SCENE_MAX_OBJECTS_PER_TRANSFORM_CHUNK] = true;
+        boundsChanged = true;
+    }
+    for (int chunkIndex = 0; chunkIndex < numTransformChunks_; chunkIndex++) {
+        if (!chunkChanged[chunkIndex])
+            continue;
+        int firstObject = chunkIndex * SCENE_MAX_OBJECTS_PER_TRANSFORM_CHUNK;
+        int numChunkObjects = std::min(SCENE_MAX_OBJECTS_PER_TRANSFORM_CHUNK, numObjects - firstObject);
+        gl_mgr_->updateUniformBuffer(transformsUniformBufferId_, &objectData_.transforms[firstObject],
+                                     numChunkObjects * sizeof(ObjectTransformBlock),
+                                     chunkIndex * transformChunkStride_);
+        stats.transformChunksUploaded++;
+    }
+
+    if (gpuCuller_ && boundsChanged)
+        gpuCuller_->updateBounds(objectData_.worldBoxes);
+
+    if (needsShadowPass())
+        updateShadowAtlas();
+
+    checkGLError("end Scene::beginFrame");
+}
+
+void Scene::updateShadowAtlas() {
+
+    // A map should have about as many texels as the pixels its light covers on screen: a light
+    // lighting the whole screen gets kShadowTexelsAcrossScreen texels across. Dimmer lights get
+    // down to half that, relative to the brightest. The atlas makes the tiles smaller if they do
+    // not all fit.
+    const float kShadowTexelsAcrossScreen = 2048.f;
+
+    int numMaps = getNumShadowedLights();
+    BBox sceneBox = getBBox();
+    float maxIllum = 0.f;
+    for (int i=0; i<numMaps; i++)
+        maxIllum = std::max(maxIllum, spotLights_[i]->radiance.illum());
+
+    std::vector<float> idealSizes(numMaps);
+    for (int i=0; i<numMaps; i++) {
+        const StaticScene::SpotLight* light = spotLights_[i];
+        Vector3D dir = light->direction.unit();
+
+        // the sphere around the cone of the light, up to the far side of the scene
+        double length = 0.;
+        for (int c=0; c<8 && !sceneBox.empty(); c++) {
+            Vector3D corner(c & 1 ? sceneBox.max.x : sceneBox.min.x,
+                            c & 2 ? sceneBox.max.y : sceneBox.min.y,
+                            c & 4 ? sceneBox.max.z : sceneBox.min.z);
+            length = std::max(length, dot(corner - light->position, dir));
+        }
+        float coverage = 0.f;
+        if (length > 0.) {
+            double angle = radians(std::min(light->angle, 89.f));
+            double radius;
+            Vector3D center;
+            if (angle <= M_PI / 4.) {
+                // through the apex and the rim of the cone
+                radius = length / (2. * cos(angle) * cos(angle));
+                center = light->position + radius * dir;
+            } else {
+                radius = length * tan(angle);
+                center = light->position + length * dir;
+            }
+            coverage = screenCoverage(*camera_, center, radius);
+        }
+        float importance = maxIllum > 0.f ? 0.5f + 0.5f * light->radiance.illum() / maxIllum : 1.f;
+        idealSizes[i] = kShadowTexelsAcrossScreen * sqrtf(coverage) * importance;
+    }
+
+    // the maps whose tile changed are rendered again, and so are their static maps
+    std::vector<unsigned char> moved;
+    FrameStats::current().shadowTilesMoved += shadowAtlas_.update(idealSizes, &moved);
+    for (int i=0; i<numMaps; i++) {
+        if (moved[i])
+            shadowMapCache_[i] = ShadowMapCache();
+    }
+}
+
+void Scene::setView(int slot, const Matrix4x4& worldToNDC) {
+
+    ViewUniformBlock block;
+    packMatrix(block.worldToNDC, worldToNDC);
+    packVector(block.cameraPosition, camera_->getPosition());
+    for (int i=0; i<SCENE_MAX_SHADOWED_LIGHTS; i++) {
+        packMatrix(block.worldToShadowLight[i], worldToShadowLight_[i]);
+    }
+
+    gl_mgr_->updateUniformBuffer(viewUniformBufferId_, &block, sizeof(block), slot * viewSlotStride_);
+    gl_mgr_->bindUniformBufferRange(viewUniformBufferId_, VIEW_UNIFORM_BLOCK, slot * viewSlotStride_, sizeof(block));
+}
+
+void Scene::drawObjects(bool shadowPass, int viewSlot, const Matrix4x4& worldToNDC,
+                        const Vector3D& eye, const Vector3D& viewDir, float nearClip, float farClip,
+                        ObjectFilter filter) {
+
+    if (gpuCuller_)
+        gpuCuller_->cull(viewSlot, worldToNDC);
+    if (cpuCulling_) {
+        // the tree finds the objects in the frustum, and those whose box it only partly
+        // contains are tested individually
+        Frustum frustum = Frustum::fromWorldToNDC(worldToNDC);
+        std::vector<unsigned char>& visible = objectData_.visible;
+        std::fill(visible.begin(), visible.end(), 0);
+        cullCandidates_.clear();
+        FrameStats::current().cullingNodesVisited += objectTree_.queryFrustum(frustum, [&](int object, bool inside) {
+            if (inside)
+                visible[object] = 1;
+            else
+                cullCandidates_.push_back(object);
+        });
+        cullingBounds_.cull(frustum, cullCandidates_.data(), cullCandidates_.size(), visible.data());
+    }
+
+    // submits the draw of objects [firstObject, firstObject + numObjects), instances of the first.
+    // The indirect draws of shadow passes are not depth sorted, so that the batches drawn with the
+    // same state keep their order, which is that of their commands.
+    auto submit = [&](int firstObject, int numObjects, int firstCommand, int numCommands) {
+        float depth = 0.f;
+        if (!shadowPass || firstCommand < 0) {
+            BBox bbox;
+            for (int i = firstObject; i < firstObject + numObjects; i++)
+                bbox.expand(objectData_.worldBoxes[i]);
+            depth = dot(bbox.centroid() - eye, viewDir);
+        }
+        uint64_t key = RenderQueue::makeKey(RenderQueue::OPAQUE_LAYER, firstObject / SCENE_MAX_OBJECTS_PER_TRANSFORM_CHUNK,
+                                            objectData_.sortPrograms[shadowPass][firstObject],
+                                            objectData_.sortTextureSets[shadowPass][firstObject],
+                                            depth, nearClip, farClip);
+        renderQueue_.submit({key, objects_[firstObject], firstObject, numObjects, firstCommand, numCommands});
+    };
+
+    renderQueue_.clear();
+    for (const InstanceBatch& batch : instanceBatches_) {
+        if ((filter == STATIC_OBJECTS && !objectData_.isStatic[batch.firstObject]) ||
+            (filter == DYNAMIC_OBJECTS && objectData_.isStatic[batch.firstObject]))
+            continue;
+        if (batch.firstCommand >= 0) {
+            if (shadowPass && batch.numShadowCommands > 0)
+                submit(batch.firstObject, batch.numObjects, batch.firstShadowCommand, batch.numShadowCommands);
+            else if (!shadowPass && batch.numCommands > 0)
+                submit(batch.firstObject, batch.numObjects, batch.firstCommand, batch.numCommands);
+            continue;
+        }
+
+        // the visible objects of the batch are drawn by one instanced draw per run of consecutive ones
+        int end = batch.firstObject + batch.numObjects;
+        int numVisible = 0;
+        for (int i = batch.firstObject; i < end; ) {
+            if (!objectData_.visible[i]) {
+                i++;
+                continue;
+            }
+            int first = i;
+            while (i < end && objectData_.visible[i])
+                i++;
+            submit(first, i - first, -1, 0);
+            numVisible += i - first;
+        }
+        FrameStats::current().objectsVisible[viewSlot] += numVisible;
+        FrameStats::current().objectsCulled[viewSlot] += batch.numObjects - numVisible;
+    }
+    renderQueue_.sort();
+
+    const std::vector<RenderPacket>& packets = renderQueue_.packets();
+    for (size_t p = 0; p < packets.size(); p++) {
+        const RenderPacket& packet = packets[p];
+        // packets are sorted by chunk, and binding the chunk again is skipped by the resource manager
+        int chunkIndex = packet.objectIndex / SCENE_MAX_OBJECTS_PER_TRANSFORM_CHUNK;
+        gl_mgr_->bindUniformBufferRange(transformsUniformBufferId_, TRANSFORMS_UNIFORM_BLOCK,
+                                        chunkIndex * transformChunkStride_,
+                                        SCENE_MAX_OBJECTS_PER_TRANSFORM_CHUNK * sizeof(ObjectTransformBlock));
+
+        int indexInChunk = packet.objectIndex % SCENE_MAX_OBJECTS_PER_TRANSFORM_CHUNK;
+        if (packet.firstCommand >= 0) {
+            // in shadow passes, the following packets with the same chunk, program and vertex array
+            // whose commands come next are drawn by the same multi-draw
+            int numCommands = packet.numCommands;
+            while (shadowPass && p + 1 < packets.size() && packets[p + 1].firstCommand == packet.firstCommand + numCommands &&
+                   RenderQueue::sameState(packets[p + 1].key, packet.key)) {
+                numCommands += packets[++p].numCommands;
+            }
+            gpuCuller_->bindForDraw(viewSlot, chunkIndex);
+            packet.object->drawIndirect(shadowPass, indexInChunk, gpuCuller_->commandOffset(viewSlot, packet.firstCommand),
+                                        numCommands);
+        } else if (shadowPass)
+            packet.object->drawShadow(indexInChunk, packet.instanceCount);
+        else
+            packet.object->draw(indexInChunk, packet.instanceCount);
+    }
+}
+
 void Scene::render() {
   
     checkGLError("begin Scene::render");
@@ -220,8 +1079,10 @@ void Scene::render() {
     Matrix4x4 proj = createPerspectiveMatrix(camera_->getVFov(), camera_->getAspectRatio(), camera_->getNearClip(), camera_->getFarClip());  
     Matrix4x4 worldToCameraNDC = proj * worldToCamera;
 
-    for (SceneObject *obj : objects_)
-        obj->draw(worldToCameraNDC);
+    setView(/*slot=*/0, worldToCameraNDC);
+    Vector3D viewDir = (camera_->getViewPoint() - camera_->getPosition()).unit();
+    drawObjects(/*shadowPass=*/false, /*viewSlot=*/0, worldToCameraNDC,
+                camera_->getPosition(), viewDir, camera_->getNearClip(), camera_->getFarClip());
 
     checkGLError("end Scene::render");
 
@@ -244,53 +1105,233 @@ void Scene::renderShadowPass(int shadowedLightIndex) {
 
     // TODO CS248 Part 5.2 Shadow Mapping
     // Here we render the shadow map for the given light. You need to accomplish the following:
-    // (1) You need to use gl_mgr_->bindFrameBuffer on the correct framebuffer to render into.
-    // (2) You need to compute the correct worldToLightNDC matrix to pass into drawShadow by
+    // (1) You need to compute the correct worldToLightNDC matrix to use as the view of the shadow pass by
     //     pretending there is a camera at the light source looking at the scene. Some fake camera
     //     parameters are provided to you in the code above.
-    // (3) You need to compute a worldToShadowLight matrix that takes the point in world space and
+    // (2) You need to compute a worldToShadowLight matrix that takes the point in world space and
     //     transforms it into "light space" for the fragment shader to use to sample from the shadow map.
     //     Note that this is almost worldToLightNDC with an additional transform that converts 
     //     coordinates in the [-w,w]^3 normalized device coordinate box 
     //     (the result of the perspective projection transform) to coordinates in a [0,w]^3 volume.
     //     After homogeneous divide. this means that x,y correspond to valid texture
     //     coordinates in the [0,1]^2 domain that can be used for a shadow map lookup in the shader.
-    //     You should put it in the right place in worldToShadowLight_ array.
-    // Caveat: GLResourceManager::bindFrameBuffer uses the RAII idiom (https://en.cppreference.com/w/cpp/language/raii)
-    //     Which means you have to give the return value a name since its destructor will release the binding.
-    //     Bad:
-    //       gl_mgr_->bindFrameBuffer(100);  // Return value is destructed immediately!
-    //       drawTriangles();  //  <- Framebuffer 100 is not bound!!!
-    //     Good:
-    //       auto fb_bind = gl_mgr_->bindFrameBuffer(100);
-    //       drawTriangles();  //  <- Framebuffer 100 is bound, since fb_bind is still alive here.
+    //     You should put it in the right place in worldToShadowLight_ array. (The scene then moves
+    //     the coordinates into the tile of the light in the shadow atlas, see updateShadowAtlas.)
+    // You do not need to bind a frame buffer: the code below binds the one drawing into the light's
+    // tile of the shadow atlas (or queues the map for the layered pass, see renderShadowLayers).
     // 
     // Replaces the following lines with correct implementation.
     Matrix4x4 worldToLightNDC = Matrix4x4::identity();
     worldToShadowLight_[shadowedLightIndex].zero();
 
-    glViewport(0, 0, shadowTextureSize_, shadowTextureSize_);
+    // the map is the light's tile of the shadow atlas, which the viewport maps the frustum to
+    const ShadowAtlas::Tile& tile = shadowAtlas_.getTile(shadowedLightIndex);
+    worldToShadowLight_[shadowedLightIndex] =
+        tileTransform(tile, shadowAtlas_.getSize()) * worldToShadowLight_[shadowedLightIndex];
+
+    // The shadow map of the last frame is kept if the light did not move, its frustum is the
+    // same and no object moved in it. The static shadow map is kept if no static object did.
+    // (The light is compared rather than worldToLightNDC, which is only as good as the code
+    // computing it above.)
+    ShadowMapCache& cache = shadowMapCache_[shadowedLightIndex];
+    Frustum lightFrustum = Frustum::fromWorldToNDC(worldToLightNDC);
+    bool lightMoved = !cache.valid || !(cache.lightPos == lightPos) || !(cache.lightDir == lightDir) ||
+                      cache.fovy != fovy || cache.aspect != aspect || cache.near != near || cache.far != far;
+    bool staticChanged = lightMoved || !cache.staticValid || anyIntersects(movedRegions_[1], lightFrustum);
+    bool dynamicChanged = lightMoved || anyIntersects(movedRegions_[0], lightFrustum);
+    FrameStats& stats = FrameStats::current();
+    if (!staticChanged && !dynamicChanged) {
+        stats.shadowPassesSkipped++;
+        return;
+    }
+    cache.valid = true;
+    cache.lightPos = lightPos;
+    cache.lightDir = lightDir;
+    cache.fovy = fovy;
+    cache.aspect = aspect;
+    cache.near = near;
+    cache.far = far;
+    stats.shadowPassesRendered++;
+
+    // in layered mode, the map is drawn with the others by renderShadowLayers
+    if (layeredShadows_) {
+        queuedShadowLayers_.push_back({shadowedLightIndex, worldToLightNDC, staticChanged, lightPos, lightDir.unit(), near, far});
+        if (staticChanged)
+            cache.staticValid = true;
+        return;
+    }
+
+    ShadowAtlas::Tile area = mapArea(tile);
+    glViewport(area.x, area.y, area.size, area.size);
 
-    glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
     glEnable(GL_DEPTH_TEST);
 
-    // Now draw all the objects in the scene
-    for (SceneObject *obj : objects_)
-        obj->drawShadow(worldToLightNDC);
+    setView(/*slot=*/1 + shadowedLightIndex, worldToLightNDC);
+
+    // (the frame buffers are bound here whatever the code above bound, as the copy of the
+    // static map below rebinds the one of the surrounding scope)
+    if (!cacheStaticShadows_) {
+        // Now draw all the objects in the scene
+        auto fb_bind = gl_mgr_->bindFrameBuffer(shadowFrameBufferId_[shadowedLightIndex]);
+        clearTile(tile);
+        drawObjects(/*shadowPass=*/true, /*viewSlot=*/1 + shadowedLightIndex, worldToLightNDC,
+                    lightPos, lightDir.unit(), near, far);
+    } else {
+        // the static objects are drawn into their own map when it changed, and the dynamic
+        // objects on top of a copy of it
+        if (staticChanged) {
+            auto fb_bind = gl_mgr_->bindFrameBuffer(staticShadowFrameBufferId_[shadowedLightIndex]);
+            clearTile(tile);
+            drawObjects(/*shadowPass=*/true, /*viewSlot=*/1 + shadowedLightIndex, worldToLightNDC,
+                        lightPos, lightDir.unit(), near, far, STATIC_OBJECTS);
+            cache.staticValid = true;
+            stats.staticShadowMapsRendered++;
+        }
+        gl_mgr_->copyFrameBuffer(staticShadowFrameBufferId_[shadowedLightIndex], shadowFrameBufferId_[shadowedLightIndex],
+                                 tile.x, tile.y, tile.size, tile.size);
+        auto fb_bind = gl_mgr_->bindFrameBuffer(shadowFrameBufferId_[shadowedLightIndex]);
+        drawObjects(/*shadowPass=*/true, /*viewSlot=*/1 + shadowedLightIndex, worldToLightNDC,
+                    lightPos, lightDir.unit(), near, far, DYNAMIC_OBJECTS);
+    }
 
     checkGLError("end shadow pass");
     
 }
 
+void Scene::renderShadowLayers() {
+
+    if (queuedShadowLayers_.empty())
+        return;
+
+    checkGLError("begin layered shadow pass");
+
+    // the objects are culled against a box around the light frustums, and the geometry shader
+    // then skips the triangles outside each of them
+    BBox sceneBox = getBBox();
+    BBox lightsBox;
+    for (const QueuedShadowLayer& layer : queuedShadowLayers_)
+        lightsBox.expand(frustumBox(layer.worldToLightNDC, sceneBox));
+    if (lightsBox.min.x > lightsBox.max.x)
+        lightsBox = sceneBox;
+    Matrix4x4 worldToNDC = boxToNDC(lightsBox);
+
+    // (the pass culls into the results of the view of the first map, which its own pass would)
+    const QueuedShadowLayer& first = queuedShadowLayers_[0];
+    int viewSlot = 1 + first.light;
+    FrameStats& stats = FrameStats::current();
+
+    // the pass draws over the whole atlas, and the geometry shader clips each map to its tile
+    int atlasSize = shadowAtlas_.getSize();
+    glViewport(0, 0, atlasSize, atlasSize);
+    glEnable(GL_DEPTH_TEST);
+    setView(viewSlot, worldToNDC);
+
+    // clears the maps of `layers` (indices into queuedShadowLayers_), all at once if they are all the maps
+    auto clearLayers = [&](const std::vector<int>& layers, const FrameBufferId* frameBufferIds) {
+        auto fb_bind = gl_mgr_->bindFrameBuffer(frameBufferIds[first.light]);
+        if (layers.size() == getNumShadowedLights()) {
+            glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
+            return;
+        }
+        for (int k : layers)
+            clearTile(shadowAtlas_.getTile(queuedShadowLayers_[k].light));
+    };
+
+    // draws the objects of `filter` into the maps of `layers` in one pass
+    auto drawLayers = [&](const std::vector<int>& layers, const FrameBufferId* frameBufferIds, ObjectFilter filter) {
+        ShadowLayersUniformBlock block;
+        memset(&block, 0, sizeof(block));
+        for (int k = 0; k < (int)layers.size(); k++) {
+            const QueuedShadowLayer& layer = queuedShadowLayers_[layers[k]];
+            packMatrix(block.worldToLayerNDC[k], layer.worldToLightNDC);
+            tileViewport(block.layerViewport[k], shadowAtlas_.getTile(layer.light), atlasSize);
+        }
+        block.numLayers = layers.size();
+        gl_mgr_->updateUniformBuffer(shadowLayersUniformBufferId_, &block, sizeof(block));
+        gl_mgr_->bindUniformBufferBase(shadowLayersUniformBufferId_, SHADOW_LAYERS_UNIFORM_BLOCK);
+
+        auto fb_bind = gl_mgr_->bindFrameBuffer(frameBufferIds[first.light]);
+        for (int plane = 0; plane < 4; plane++)
+            glEnable(GL_CLIP_DISTANCE0 + plane);
+        drawObjects(/*shadowPass=*/true, viewSlot, worldToNDC, first.lightPos, first.lightDir,
+                    first.nearClip, first.farClip, filter);
+        for (int plane = 0; plane < 4; plane++)
+            glDisable(GL_CLIP_DISTANCE0 + plane);
+        stats.layeredShadowPasses++;
+    };
+
+    std::vector<int> allLayers, staticLayers;
+    for (int k = 0; k < (int)queuedShadowLayers_.size(); k++) {
+        allLayers.push_back(k);
+        if (queuedShadowLayers_[k].staticChanged)
+            staticLayers.push_back(k);
+    }
+
+    drawingShadowLayers_ = true;
+    if (!cacheStaticShadows_) {
+        clearLayers(allLayers, shadowFrameBufferId_);
+        drawLayers(allLayers, shadowFrameBufferId_, ALL_OBJECTS);
+    } else {
+        // as in renderShadowPass, the dynamic objects are drawn on top of copies of the static maps
+        if (!staticLayers.empty()) {
+            clearLayers(staticLayers, staticShadowFrameBufferId_);
+            drawLayers(staticLayers, staticShadowFrameBufferId_, STATIC_OBJECTS);
+            stats.staticShadowMapsRendered += staticLayers.size();
+        }
+        for (const QueuedShadowLayer& layer : queuedShadowLayers_) {
+            const ShadowAtlas::Tile& tile = shadowAtlas_.getTile(layer.light);
+            gl_mgr_->copyFrameBuffer(staticShadowFrameBufferId_[layer.light], shadowFrameBufferId_[layer.light],
+                                     tile.x, tile.y, tile.size, tile.size);
+        }
+        drawLayers(allLayers, shadowFrameBufferId_, DYNAMIC_OBJECTS);
+    }
+    drawingShadowLayers_ = false;
+    queuedShadowLayers_.clear();
+
+    checkGLError("end layered shadow pass");
+}
+
+void Scene::setShadowColorMaps(bool enabled) {
+    if (enabled == shadowColorMaps_ || !needsShadowPass())
+        return;
+    shadowColorMaps_ = enabled;
+
+    TextureArrayId oldColor = shadowColorTextureArrayId_;
+    TextureArrayId oldStaticColor = staticShadowColorTextureArrayId_;
+    shadowColorTextureArrayId_.id = 0;
+    staticShadowColorTextureArrayId_.id = 0;
+    if (enabled) {
+        shadowColorTextureArrayId_ = gl_mgr_->createColorTextureArray(1, shadowAtlas_.getSize());
+        if (cacheStaticShadows_)
+            staticShadowColorTextureArrayId_ = gl_mgr_->createColorTextureArray(1, shadowAtlas_.getSize());
+    }
+
+    for (int i=0; i<getNumShadowedLights(); i++) {
+        gl_mgr_->attachTextureArrayLayers(&shadowFrameBufferId_[i], 1, shadowDepthTextureArrayId_, shadowColorTextureArrayId_);
+        if (cacheStaticShadows_) {
+            gl_mgr_->attachTextureArrayLayers(&staticShadowFrameBufferId_[i], 1, staticShadowDepthTextureArrayId_,
+                                              staticShadowColorTextureArrayId_);
+        }
+    }
+    if (oldColor.id)
+        gl_mgr_->freeTextureArray(oldColor);
+    if (oldStaticColor.id)
+        gl_mgr_->freeTextureArray(oldStaticColor);
+    checkGLError("after changing the shadow color maps");
+
+    // the shadow passes use other shaders, and draw every map again
+    updateSortState();
+    for (ShadowMapCache& cache : shadowMapCache_)
+        cache = ShadowMapCache();
+}
+
 void Scene::visualizeShadowMap() {
     checkGLError("pre viz shadow map");
 
     auto vertex_array_bind = gl_mgr_->bindVertexArray(shadowVizVertexArrayId_);
     auto shader_bind = shadowVizShader_->bind();
-    shadowVizShader_->setVertexBuffer("vtx_position", 3, shadowVizVtxBufferId_);
-    shadowVizShader_->setVertexBuffer("vtx_texcoord", 2, shadowVizTexCoordBufferId_);
-    shadowVizShader_->setTextureArraySampler("depthTextureArray", shadowDepthTextureArrayId_);
-    shadowVizShader_->setTextureArraySampler("colorTextureArray", shadowColorTextureArrayId_);
+    shadowVizShader_->setTextureArraySampler(shadowVizDepthTextureArray_, shadowDepthTextureArrayId_);
+    shadowVizShader_->setTextureArraySampler(shadowVizColorTextureArray_, shadowColorTextureArrayId_);
     // now issue the draw command to OpenGL
     checkGLError("before glDrawArrays for shadow viz");
     // 6 indices, 2 triangles to render
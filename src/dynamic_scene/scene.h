@@ -3,7 +3,6 @@
 
 #include <string>
 #include <vector>
-#include <set>
 #include <iostream>
 
 #include "CS248/CS248.h"
@@ -15,10 +14,24 @@
 #include "../shader.h"
 #include "../gl_resource_manager.h"
 
+#include "../collada/collada_info.h"
 #include "../static_scene/scene.h"
 #include "../static_scene/light.h"
 
-#define SCENE_MAX_SHADOWED_LIGHTS 10
+#include "aabb_tree.h"
+#include "frustum_culling.h"
+#include "gpu_culling.h"
+#include "render_queue.h"
+#include "shadow_atlas.h"
+#include "transform_hierarchy.h"
+#include "vertex_format.h"
+
+#define SCENE_MAX_SHADOWED_LIGHTS 24  // must match MAX_NUM_SHADOWED_LIGHTS in the shaders
+// the shadow maps of all lights are tiles of one atlas (see ShadowAtlas), which has at most this
+// many texels per shadowed light, counting the atlas of the static maps if there is one
+#define SCENE_SHADOW_TEXELS_PER_LIGHT (1024 * 1024)
+#define SCENE_MAX_LIGHTS 24  // per light type; must match MAX_NUM_LIGHTS in the shaders
+#define SCENE_MAX_OBJECTS_PER_TRANSFORM_CHUNK 128  // must match MAX_OBJECTS_PER_TRANSFORM_CHUNK in the shaders
 
 namespace CS248 {
 
@@ -40,13 +53,43 @@ class SceneObject {
         : scene_(NULL) {}
 
     /**
-     * Renders the object in OpenGL, assuming that the camera and projection
-     * matrices have already been set up.
+     * Renders the object in OpenGL, assuming that the view of the current pass has
+     * already been set up. The object's transforms are element `transformIndex` of
+     * the per-object transforms bound by the scene. If `instanceCount` is more than one,
+     * the draw also renders the objects following this one in the scene, which are objects
+     * it can instance (see canInstanceWith), using the next elements of the transforms.
      */
-    virtual void draw(const Matrix4x4& worldToNDC) const = 0;
+    virtual void draw(int transformIndex, int instanceCount) const = 0;
 
     // same as above, but shadow pass form
-    virtual void drawShadow(const Matrix4x4& worldToNDC) const = 0;
+    virtual void drawShadow(int transformIndex, int instanceCount) const = 0;
+
+    // Appends the indirect draw commands (see GpuCuller) drawing the object and the objects it
+    // instances in the shadow passes to the first vector, and in the main pass to the second.
+    // Their instance counts are left at zero, for the culling pass to fill in, and the scene sets
+    // the base instance of the shadow commands. Objects without indirect commands are drawn
+    // directly, and not culled.
+    virtual void getIndirectCommands(std::vector<DrawElementsIndirectCommand>*,
+                                     std::vector<DrawElementsIndirectCommand>*) const {}
+
+    // Draws the object with `drawCount` commands, starting at `commands` in the bound draw indirect
+    // buffer, in one multi-draw. The transforms of the visible instances are listed in the
+    // "VisibleObjects" block from element `transformIndex` on. In shadow passes, the commands go on
+    // with those of the objects drawn after it with the same program and vertex array (see
+    // getSortTextureSet), and the base instance of each command locates its visible instances.
+    virtual void drawIndirect(bool, int, const void*, int) const {}
+
+    // true if the draw calls of this object can also render `other`, as an instance that only
+    // differs by its transforms
+    virtual bool canInstanceWith(const SceneObject*) const { return false; }
+
+    // a hash of what canInstanceWith compares, equal for the objects that can be instances of
+    // each other (the objects that cannot instance others return their address)
+    virtual size_t getInstanceKey() const { return reinterpret_cast<size_t>(this); }
+
+    // true if the object is never moved by the application (see PolymeshInfo::is_static), so that
+    // the shadow maps keep it in the part they only render again when it is invalidated
+    virtual bool isStatic() const { return false; }
 
     // reload any shaders associated with object
     virtual void reloadShaders() = 0; 
@@ -56,40 +99,99 @@ class SceneObject {
      */
     virtual BBox getBBox() const = 0;
 
-//  Matrix4x4 getTransformation() const;
-//  Matrix4x4 getRotation() const;
-//  Matrix4x4 getScale() const;
-    Matrix4x4 getObjectToWorld() const {
+    // Returns a world space bounding sphere of the object. By default, the sphere around its
+    // bounding box; objects should return a tighter one if they can (e.g. if they are rotated).
+    virtual void getBoundingSphere(Vector3D* center, float* radius) const;
+
+    // the world space bounds of the object, computed by getBBox and getBoundingSphere
+    // when they are first needed after the transform changed
+    struct WorldBounds {
+        BBox     box;
+        Vector3D sphereCenter;
+        float    sphereRadius;
+    };
+    const WorldBounds& getWorldBounds() const;
+
+    // Intersects the world space ray origin + t * direction with the object, for t in [0, tMax].
+    // Returns true and the t of the closest hit in `t` if there is one. By default, the object
+    // is hit where its world space bounding box is; objects should test their triangles if they can.
+    virtual bool intersect(const Vector3D& origin, const Vector3D& direction, float tMax, float* t) const;
+
+    // Returns true if the ray hits the object for some t in [0, tMax], without looking for the
+    // closest hit (e.g. for visibility tests). By default, the same test as intersect().
+    virtual bool occludes(const Vector3D& origin, const Vector3D& direction, float tMax) const;
+
+    // Same as intersect(), without the acceleration structure of the object (e.g. testing every
+    // triangle), to check it. By default, intersect() itself.
+    virtual bool intersectExhaustive(const Vector3D& origin, const Vector3D& direction, float tMax, float* t) const {
+        return intersect(origin, direction, tMax, t);
+    }
+
+    // incremented every time the transform changes, so that copies of the object's world
+    // space data (e.g. the scene's culling bounds) can tell when to update
+    int getTransformVersion() const { return transformVersion_; }
+
+    // the GL program and the textures the object draws with in a pass, used to order the draws
+    // (see RenderQueue) so that objects sharing them are drawn one after the other. Shadow passes
+    // bind no textures, and the vertex array the object draws from takes their place.
+    virtual GLuint getSortProgram(bool) const { return 0; }
+    virtual GLuint getSortTextureSet(bool) const { return 0; }
+
+    const Vector3D& getPosition() const { return position_; }
+    const Vector3D& getRotation() const { return rotation_; }
+    const Vector3D& getScale() const { return scale_; }
+    void setPosition(const Vector3D& position) { position_ = position; transformChanged(); }
+    void setRotation(const Vector3D& rotation) { rotation_ = rotation; transformChanged(); }
+    void setScale(const Vector3D& scale) { scale_ = scale; transformChanged(); }
+
+    // the world transform of the group the object is in (see Scene::setGroupTransform), which
+    // the position, rotation and scale are relative to. The identity if it is in none.
+    const Matrix4x4& getParentToWorld() const { return parentToWorld_; }
+    void setParentToWorld(const Matrix4x4& parentToWorld) { parentToWorld_ = parentToWorld; transformChanged(); }
+
+    // the transforms of the object, computed when they are first needed after the transform changed
+    const Matrix4x4& getObjectToWorld() const { updateTransforms(); return objectToWorld_; }
+    const Matrix3x3& getObjectToWorldForNormals() const { updateTransforms(); return objectToWorldForNormals_; }
+    const Matrix4x4& getWorldToObject() const { updateTransforms(); return worldToObject_; }
+
+    // the transforms of an object placed at `position`, rotated by `rotation` (in degrees
+    // around X, then Y, then Z) and scaled by `scale`
+    static Matrix4x4 objectToWorld(const Vector3D& position, const Vector3D& rotation, const Vector3D& scale) {
    
         float deg2Rad = M_PI / 180.0;
     
-        Matrix4x4 T = Matrix4x4::translation(position_);
-        Matrix4x4 RX = Matrix4x4::rotation(rotation_.x * deg2Rad, Matrix4x4::Axis::X);
-        Matrix4x4 RY = Matrix4x4::rotation(rotation_.y * deg2Rad, Matrix4x4::Axis::Y);
-        Matrix4x4 RZ = Matrix4x4::rotation(rotation_.z * deg2Rad, Matrix4x4::Axis::Z);
-        Matrix4x4 scaleXform = Matrix4x4::scaling(scale_);
+        Matrix4x4 T = Matrix4x4::translation(position);
+        Matrix4x4 RX = Matrix4x4::rotation(rotation.x * deg2Rad, Matrix4x4::Axis::X);
+        Matrix4x4 RY = Matrix4x4::rotation(rotation.y * deg2Rad, Matrix4x4::Axis::Y);
+        Matrix4x4 RZ = Matrix4x4::rotation(rotation.z * deg2Rad, Matrix4x4::Axis::Z);
+        Matrix4x4 scaleXform = Matrix4x4::scaling(scale);
     
         // object to world transformation
         Matrix4x4 objectToWorld = T * RX * RY * RZ * scaleXform;
         return objectToWorld;
     }
 
-    Matrix3x3 getObjectToWorldForNormals() const {
+    static Matrix3x3 objectToWorldForNormals(const Vector3D& rotation, const Vector3D& scale) {
    
         float deg2Rad = M_PI / 180.0;
     
-        Matrix4x4 RX = Matrix4x4::rotation(rotation_.x * deg2Rad, Matrix4x4::Axis::X);
-        Matrix4x4 RY = Matrix4x4::rotation(rotation_.y * deg2Rad, Matrix4x4::Axis::Y);
-        Matrix4x4 RZ = Matrix4x4::rotation(rotation_.z * deg2Rad, Matrix4x4::Axis::Z);
-        Matrix4x4 scaleXform = Matrix4x4::scaling(scale_);
+        Matrix4x4 RX = Matrix4x4::rotation(rotation.x * deg2Rad, Matrix4x4::Axis::X);
+        Matrix4x4 RY = Matrix4x4::rotation(rotation.y * deg2Rad, Matrix4x4::Axis::Y);
+        Matrix4x4 RZ = Matrix4x4::rotation(rotation.z * deg2Rad, Matrix4x4::Axis::Z);
+        Matrix4x4 scaleXform = Matrix4x4::scaling(scale);
     
 
         Matrix4x4 xformNorm = RX * RY * RZ * scaleXform;
+        return normalTransform(xformNorm);
+    }
+
+    // the inverse transpose of the upper 3x3 of `xform`, which transforms normals
+    static Matrix3x3 normalTransform(const Matrix4x4& xform) {
 
         // convert to 3x3
         Matrix3x3 xform3D;
         for (int i=0; i<3; i++) {
-            const Vector4D& col = xformNorm.column(i); 
+            const Vector4D& col = xform.column(i); 
             xform3D[i][0] = col[0];
             xform3D[i][1] = col[1];
             xform3D[i][2] = col[2];
@@ -98,11 +200,18 @@ class SceneObject {
         return xform3D.inv().T(); 
     }
 
+    // transform from the vertex positions stored in the object's vertex buffer to object space.
+    // It is the identity unless the positions are quantized (see VertexFormat).
+    virtual Matrix4x4 getVertexPositionDecode() const { return Matrix4x4::identity(); }
+
     void setScene(Scene* s) { scene_ = s; }
 
 
   protected:
 
+    // must be called after changing position_, rotation_ or scale_
+    void transformChanged() { transformVersion_++; transformsValid_ = false; worldBoundsValid_ = false; }
+
     /**
      * Pointer to the scene containing this object.
      */
@@ -112,6 +221,18 @@ class SceneObject {
     Vector3D position_;
     Vector3D rotation_;
     Vector3D scale_;
+
+  private:
+    void updateTransforms() const;
+
+    Matrix4x4 parentToWorld_ = Matrix4x4::identity();
+    int transformVersion_ = 0;
+    mutable bool transformsValid_ = false;
+    mutable Matrix4x4 objectToWorld_;
+    mutable Matrix3x3 objectToWorldForNormals_;
+    mutable Matrix4x4 worldToObject_;
+    mutable bool worldBoundsValid_ = false;
+    mutable WorldBounds worldBounds_;
 };
 
 /**
@@ -122,25 +243,70 @@ class SceneLight {
     virtual StaticScene::SceneLight* getStaticLight() const = 0;
 };
 
+// Host-side image of one element of the "Transforms" uniform block (std140). The columns
+// of the mat3 are padded to 16 bytes.
+struct ObjectTransformBlock {
+  float obj2world[16];
+  float obj2worldNorm[3][4];
+};
+
+static_assert(sizeof(ObjectTransformBlock) == 112,
+              "Fatal error: ObjectTransformBlock does not match the std140 layout of the Transforms block.");
+
+// Identifies an object of a scene for as long as the scene lives. The scene stores its objects
+// in draw order, which is not the order they were given in, so the application refers to them
+// by handle rather than by index.
+struct ObjectHandle {
+    int id = -1;  // the index of the object in the list given to the scene
+    bool isValid() const { return id >= 0; }
+};
+
 /**
  * The scene
  */
 class Scene {
  public:
+    // `groups` are the groups of the scene file, and objectGroups[i] the index of the group
+    // placing objects[i] (or -1)
     Scene(std::vector<SceneObject*> objects,
           std::vector<SceneLight*> lights,
-          const std::string& baseShaderDir);
+          const std::string& baseShaderDir,
+          const std::vector<Collada::GroupInfo>& groups,
+          const std::vector<int>& objectGroups);
     ~Scene();
 
+    // uploads the per-frame state shared by all shader programs (the light parameters
+    // and the object transforms). Must be called once per frame before any pass is rendered.
+    void beginFrame();
+
     /**
      * Renders the scene in OpenGL, assuming the camera and projection
      * transformations have been applied elsewhere.
      */
     void render();
 
-    // renders a shadow pass
+    // Renders a shadow pass. The shadow map of the last frame is kept if neither the light nor
+    // any object in its frustum moved since (see beginFrame).
     void renderShadowPass(int shadowedLightIndex);
 
+    // Renders the shadow maps queued by renderShadowPass in layered mode. Must be called after
+    // the shadow passes of the frame.
+    void renderShadowLayers();
+
+    // In layered mode, renderShadowPass only queues the shadow maps to render, and
+    // renderShadowLayers draws the objects once for all of them: a geometry shader sends every
+    // triangle to each map (a tile of the shadow atlas) it is in, so the draws scale with the
+    // objects rather than with objects times lights. On by default.
+    void setLayeredShadows(bool layered) { layeredShadows_ = layered && layeredShadowsSupported_; }
+    bool getLayeredShadows() const { return layeredShadows_; }
+
+    // The shadow passes only draw depth, unless they also draw the normals of the shadow casters
+    // into color maps, which visualizeShadowMap shows next to the depth. The color maps (and the
+    // vertex normals the passes then read) are only needed for the visualization, so they are
+    // only allocated while it is on.
+    void setShadowColorMaps(bool enabled);
+    bool getShadowColorMaps() const { return shadowColorMaps_; }
+
     // visualization mode
     void visualizeShadowMap();
 
@@ -159,9 +325,46 @@ class Scene {
      */
     BBox getBBox() const;
 
-    Shader*   getShadowShader() const { return shadowShader_; }
+    // the groups of the scene file, which place the objects and groups in them
+    int getNumGroups() const { return groupHierarchy_.size(); }
+    const Matrix4x4& getGroupTransform(int group) const { return groupHierarchy_.getLocalTransform(group); }
+    // moves a group (relative to its parent group), with everything in it, from the next frame on
+    void setGroupTransform(int group, const Matrix4x4& transform) { groupHierarchy_.setLocalTransform(group, transform); }
+
+    int getNumObjects() const { return objects_.size(); }
+    SceneObject* getObject(ObjectHandle handle) const { return objects_[handleObjects_[handle.id]]; }
+
+    // Returns the closest object hit by the ray origin + t * direction (t >= 0), or an invalid
+    // handle, and the t of the hit in `distance` if not NULL (see SceneObject::intersect).
+    ObjectHandle pickObject(const Vector3D& origin, const Vector3D& direction, float* distance) const;
+
+    // times closest hit and any hit ray queries against every object, with random rays through
+    // its bounding sphere, and prints the rays per second. Some of the closest hits are checked
+    // against exhaustive queries (see SceneObject::intersectExhaustive).
+    void benchmarkRayQueries() const;
+
+    // brings the group transforms up to date and prints how far the incrementally updated world
+    // transforms are from ones recomputed from scratch (see TransformHierarchy)
+    void checkGroupTransforms();
+
+    // handles to the parameters of the shadow pass shader, resolved once when it is created
+    struct ShadowShaderParameters {
+        UniformHandle   objectIndex;
+    };
+
+    // the shadow pass shader drawing the color maps reads vertex normals, so there is one per
+    // normal encoding (the depth-only shader is the same for all). The layered shadow pass has its
+    // own shaders, returned while it draws.
+    Shader*   getShadowShader(NormalEncoding encoding) const {
+        return shadowShaders_[drawingShadowLayers_][shadowColorMaps_].shader[encoding];
+    }
+    const ShadowShaderParameters& getShadowShaderParameters(NormalEncoding encoding) const {
+        return shadowShaders_[drawingShadowLayers_][shadowColorMaps_].params[encoding];
+    }
+    // the shadow atlas is layer 0 of the texture array. getWorldToShadowLight maps to the light's tile.
     TextureArrayId getShadowTextureArrayId() const { return shadowDepthTextureArrayId_; }
     Matrix4x4 getWorldToShadowLight(int lightid) const { return worldToShadowLight_[lightid]; }
+    const ShadowAtlas& getShadowAtlas() const { return shadowAtlas_; }
 
     size_t getNumShadowedLights() const;
     size_t getNumDirectionalLights() const { return directionalLights_.size(); }
@@ -177,10 +380,98 @@ class Scene {
 
   private:
 
+    // uploads the view of a rendering pass to its slot of the view uniform buffer
+    // and binds that slot to the "View" block
+    void setView(int slot, const Matrix4x4& worldToNDC);
+
+    // the objects drawObjects draws (see SceneObject::isStatic)
+    enum ObjectFilter { ALL_OBJECTS, STATIC_OBJECTS, DYNAMIC_OBJECTS };
+
+    // draws the objects in the frustum of `worldToNDC` as seen from `eye` looking along `viewDir`,
+    // ordered by the render queue, binding the chunks of the transform uniform buffer as needed.
+    // The objects are culled on the GPU if possible (into the results of `viewSlot`), and
+    // otherwise on the CPU.
+    void drawObjects(bool shadowPass, int viewSlot, const Matrix4x4& worldToNDC,
+                     const Vector3D& eye, const Vector3D& viewDir, float nearClip, float farClip,
+                     ObjectFilter filter = ALL_OBJECTS);
+
+    // copies the program and textures each object draws with into objectData_ (again after
+    // the shaders are reloaded, which changes the programs)
+    void updateSortState();
+
+    // Sizes the tiles of the shadow maps for the frame, from the part of the screen each light
+    // covers and its intensity, and renders the maps whose tile moved again.
+    void updateShadowAtlas();
+
+    // recomputes the world transforms of the groups moved since the last call, and places the
+    // objects in them. Returns the number of groups recomputed.
+    int placeGroupedObjects();
+
     Camera* camera_;
 
-    std::set<SceneObject*> objects_;
-    std::set<SceneLight*> lights_;
+    // A run of consecutive objects drawn by a single (instanced) draw of the first one. Runs
+    // do not cross chunks of the transform uniform buffer, and are all static or all dynamic.
+    struct InstanceBatch {
+        int firstObject;
+        int numObjects;
+        int firstCommand = -1;  // indirect draw commands of the run, with GPU culling
+        int numCommands = 0;
+        int firstShadowCommand = -1;  // and those of the shadow passes
+        int numShadowCommands = 0;
+    };
+
+    // in the order of the object transforms: the scene file order, except that objects that
+    // can be drawn as instances of each other are moved next to the first of them
+    std::vector<SceneObject*> objects_;
+    // objectHandles_[i] is the handle id of object i, and handleObjects_[id] the index of the object
+    std::vector<int> objectHandles_;
+    std::vector<int> handleObjects_;
+
+    // the groups, and the objects in each: those of group g are
+    // groupObjects_[groupObjectsStart_[g], groupObjectsStart_[g + 1]) (indices into objects_)
+    TransformHierarchy groupHierarchy_;
+    std::vector<int> groupObjectsStart_;
+    std::vector<int> groupObjects_;
+
+    // The data of the objects that the passes read, stored by field and indexed like objects_,
+    // so that culling, sorting and transform uploads stream through arrays instead of calling
+    // into each object. beginFrame refreshes it from the objects whose transform changed.
+    struct ObjectArrays {
+        // the transforms, as uploaded to the transform uniform buffer
+        std::vector<ObjectTransformBlock> transforms;
+        std::vector<BBox> worldBoxes;
+        // the program and texture set of each pass (indexed by shadowPass), for the sort keys
+        std::vector<GLuint> sortPrograms[2];
+        std::vector<GLuint> sortTextureSets[2];
+        // see SceneObject::isStatic
+        std::vector<unsigned char> isStatic;
+        // the version of each object's transform (see SceneObject::getTransformVersion) that
+        // the arrays, cullingBounds_ and objectTree_ hold
+        std::vector<int> transformVersions;
+        // set by the CPU culling of the current pass
+        std::vector<unsigned char> visible;
+    };
+    ObjectArrays objectData_;
+    // the objects beginFrame found changed
+    std::vector<unsigned char> objectChanged_;
+    // the world boxes the changed objects had before beginFrame updated them
+    std::vector<BBox> previousWorldBoxes_;
+    // the regions the dynamic and static objects (indexed by isStatic) that moved in the frame
+    // were in before and after moving, which beginFrame collects for the shadow passes
+    std::vector<BBox> movedRegions_[2];
+
+    std::vector<InstanceBatch> instanceBatches_;
+    std::vector<SceneLight*> lights_;
+    RenderQueue renderQueue_;
+    // culls the objects on the GPU, if the GL supports it (otherwise NULL)
+    GpuCuller* gpuCuller_ = nullptr;
+    // culls the objects drawn without indirect commands on the CPU
+    bool cpuCulling_;
+    CullingBounds cullingBounds_;
+    std::vector<int> cullCandidates_;
+    // the objects' bounds, for culling and picking. objectProxies_[i] is the leaf of object i.
+    AABBTree objectTree_;
+    std::vector<int> objectProxies_;
     std::vector<StaticScene::DirectionalLight*> directionalLights_;
     std::vector<StaticScene::PointLight*> pointLights_;
     std::vector<StaticScene::SpotLight*> spotLights_;
@@ -190,15 +481,72 @@ class Scene {
     //std::vector<StaticScene::AreaLight*> area_lights;
     //std::vector<StaticScene::SphereLight*> sphere_lights;
     GLResourceManager* gl_mgr_;
+    // uniform buffer backing the "Lights" block of the shaders
+    UniformBufferId lightsUniformBufferId_;
+    // uniform buffer with one view slot per rendering pass, backing the "View" block
+    UniformBufferId viewUniformBufferId_;
+    int             viewSlotStride_;
+    // uniform buffer with the transforms of all objects, split into chunks of
+    // SCENE_MAX_OBJECTS_PER_TRANSFORM_CHUNK objects, backing the "Transforms" block
+    UniformBufferId transformsUniformBufferId_;
+    int             transformChunkStride_;
+    int             numTransformChunks_;
     // resources for shadow mapping
     bool            doShadowPass_;
-    int             shadowTextureSize_;
-    Shader*         shadowShader_;
+    // the tile of each shadow map. Light i draws into the atlas through shadowFrameBufferId_[i].
+    // (Replaced by an atlas of the budgeted size when the shadow maps are created.)
+    ShadowAtlas     shadowAtlas_{/*size=*/1, /*minTileSize=*/1};
+    struct ShadowShaders {
+        Shader*                shader[NUM_NORMAL_ENCODINGS];
+        ShadowShaderParameters params[NUM_NORMAL_ENCODINGS];
+    };
+    ShadowShaders   shadowShaders_[2][2];  // [layered][color maps]
     Shader*         shadowVizShader_;
+    UniformHandle   shadowVizDepthTextureArray_;
+    UniformHandle   shadowVizColorTextureArray_;
     FrameBufferId   shadowFrameBufferId_[SCENE_MAX_SHADOWED_LIGHTS];
     Matrix4x4       worldToShadowLight_[SCENE_MAX_SHADOWED_LIGHTS];
     TextureArrayId  shadowDepthTextureArrayId_;
+    // the color maps, 0 unless shadowColorMaps_ (as are the static ones below)
+    bool            shadowColorMaps_;
     TextureArrayId  shadowColorTextureArrayId_;
+    // The light view each shadow map was last rendered from (if `valid`). A shadow pass is
+    // skipped when the light and its frustum are the same and no object moved in the frustum.
+    struct ShadowMapCache {
+        bool      valid = false;
+        bool      staticValid = false;  // the static shadow map holds the static objects
+        Vector3D  lightPos;
+        Vector3D  lightDir;
+        float     fovy = 0.f;
+        float     aspect = 0.f;
+        float     near = 0.f;
+        float     far = 0.f;
+    };
+    ShadowMapCache  shadowMapCache_[SCENE_MAX_SHADOWED_LIGHTS];
+    // Scenes with both static and dynamic objects also keep shadow maps of the static objects
+    // only. A shadow pass then copies the static map and draws the dynamic objects on top, and
+    // only renders the static map again when the light or a static object in its frustum moved.
+    bool            cacheStaticShadows_;
+    FrameBufferId   staticShadowFrameBufferId_[SCENE_MAX_SHADOWED_LIGHTS];
+    TextureArrayId  staticShadowDepthTextureArrayId_;
+    TextureArrayId  staticShadowColorTextureArrayId_;
+    // resources for layered shadow passes (see setLayeredShadows, the shaders are in
+    // shadowShaders_): the uniform buffer backing the "ShadowLayers" block of the shaders
+    bool            layeredShadowsSupported_;
+    bool            layeredShadows_;
+    bool            drawingShadowLayers_ = false;
+    UniformBufferId shadowLayersUniformBufferId_;
+    // the shadow maps renderShadowPass queued for renderShadowLayers
+    struct QueuedShadowLayer {
+        int       light;
+        Matrix4x4 worldToLightNDC;
+        bool      staticChanged;  // the static shadow map needs to be rendered again
+        Vector3D  lightPos;
+        Vector3D  lightDir;
+        float     nearClip;
+        float     farClip;
+    };
+    std::vector<QueuedShadowLayer> queuedShadowLayers_;
     // OpenGL vertex array object
     VertexArrayId   shadowVizVertexArrayId_;
     // OpenGL vertex buffer objects
@@ -0,0 +1,180 @@
+#include "shadow_atlas.h"
+
+#include <algorithm>
+#include <numeric>
+
+namespace CS248 {
+namespace DynamicScene {
+
+ShadowAtlas::ShadowAtlas(int size, int minTileSize)
+    : size_(size), minTileSize_(std::min(minTileSize, size)) {
+    freeSquares_.resize(level(minTileSize_) + 1);
+    freeSquares_[0].insert(std::make_pair(0, 0));
+}
+
+long long ShadowAtlas::getUsedTexels() const {
+    long long used = 0;
+    for (const Tile& tile : tiles_)
+        used += (long long)tile.size * tile.size;
+    return used;
+}
+
+int ShadowAtlas::update(const std::vector<float>& idealSizes, std::vector<unsigned char>* moved) {
+
+    // the maps beyond the new number give their tile back
+    int numMaps = idealSizes.size();
+    for (int i = numMaps; i < (int)tiles_.size(); i++) {
+        if (tiles_[i].size)
+            free(tiles_[i]);
+    }
+    tiles_.resize(numMaps);
+    chosenSizes_.resize(numMaps, 0);
+    moved->assign(numMaps, 0);
+
+    std::vector<int> sizes(numMaps);
+    for (int i = 0; i < numMaps; i++) {
+        chosenSizes_[i] = chooseSize(idealSizes[i], chosenSizes_[i]);
+        sizes[i] = chosenSizes_[i];
+    }
+    fitBudget(&sizes, idealSizes);
+
+    // the maps changing size give their tile back, and are placed again largest first
+    auto largestFirst = [&](int a, int b) { return sizes[a] > sizes[b] || (sizes[a] == sizes[b] && a < b); };
+    std::vector<int> changed;
+    for (int i = 0; i < numMaps; i++) {
+        if (sizes[i] == tiles_[i].size)
+            continue;
+        if (tiles_[i].size)
+            free(tiles_[i]);
+        tiles_[i] = Tile();
+        changed.push_back(i);
+    }
+    std::sort(changed.begin(), changed.end(), largestFirst);
+    bool placed = true;
+    for (int i : changed) {
+        (*moved)[i] = 1;
+        if (!allocate(sizes[i], &tiles_[i])) {
+            placed = false;
+            break;
+        }
+    }
+
+    if (!placed) {
+        // start over from an empty atlas. Placed largest first, tiles whose total area fits
+        // always find room. The maps placed where they were keep their contents.
+        numRepacks_++;
+        for (std::set<std::pair<int, int>>& squares : freeSquares_)
+            squares.clear();
+        freeSquares_[0].insert(std::make_pair(0, 0));
+        std::vector<int> all(numMaps);
+        std::iota(all.begin(), all.end(), 0);
+        std::sort(all.begin(), all.end(), largestFirst);
+        for (int i : all) {
+            Tile previous = tiles_[i];
+            allocate(sizes[i], &tiles_[i]);
+            if (tiles_[i].x != previous.x || tiles_[i].y != previous.y || tiles_[i].size != previous.size)
+                (*moved)[i] = 1;
+        }
+    }
+
+    return std::count(moved->begin(), moved->end(), 1);
+}
+
+int ShadowAtlas::chooseSize(float idealSize, int current) const {
+    // the nearest power of two changes at 1/sqrt(2) and sqrt(2) times a size, but a map keeps
+    // its size from 0.6 to 1.7 times it
+    if (current > 0 && idealSize > 0.6f * current && idealSize < 1.7f * current)
+        return current;
+    int size = minTileSize_;
+    while (size < size_ && idealSize > 1.41421356f * size)
+        size *= 2;
+    return size;
+}
+
+void ShadowAtlas::fitBudget(std::vector<int>* sizes, const std::vector<float>& idealSizes) const {
+    long long budget = (long long)size_ * size_;
+    long long used = 0;
+    for (int size : *sizes)
+        used += (long long)size * size;
+
+    // halve the largest tile, of the map with the smallest ideal size among those, until all fit
+    while (used > budget) {
+        int largest = -1;
+        for (int i = 0; i < (int)sizes->size(); i++) {
+            int size = (*sizes)[i];
+            if (size <= minTileSize_)
+                continue;
+            if (largest < 0 || size > (*sizes)[largest] ||
+                (size == (*sizes)[largest] && idealSizes[i] < idealSizes[largest]))
+                largest = i;
+        }
+        if (largest < 0)
+            break;
+        long long size = (*sizes)[largest];
+        used -= size * size * 3 / 4;
+        (*sizes)[largest] /= 2;
+    }
+}
+
+int ShadowAtlas::level(int tileSize) const {
+    int l = 0;
+    while ((size_ >> l) > tileSize)
+        l++;
+    return l;
+}
+
+bool ShadowAtlas::allocate(int tileSize, Tile* tile) {
+    // the smallest free square holding the tile, split down to its size
+    int target = level(tileSize);
+    int l = target;
+    while (l >= 0 && freeSquares_[l].empty())
+        l--;
+    if (l < 0) {
+        *tile = Tile();
+        return false;
+    }
+    std::pair<int, int> square = *freeSquares_[l].begin();
+    freeSquares_[l].erase(freeSquares_[l].begin());
+    for (; l < target; l++) {
+        int half = size_ >> (l + 1);
+        freeSquares_[l + 1].insert(std::make_pair(square.first + half, square.second));
+        freeSquares_[l + 1].insert(std::make_pair(square.first, square.second + half));
+        freeSquares_[l + 1].insert(std::make_pair(square.first + half, square.second + half));
+    }
+    tile->x = square.first;
+    tile->y = square.second;
+    tile->size = tileSize;
+    return true;
+}
+
+void ShadowAtlas::free(const Tile& tile) {
+    int l = level(tile.size);
+    std::pair<int, int> square(tile.x, tile.y);
+
+    // merge with the other quarters of the square above while they are all free
+    while (l > 0) {
+        int parentSize = size_ >> (l - 1);
+        int half = parentSize / 2;
+        int x = square.first / parentSize * parentSize;
+        int y = square.second / parentSize * parentSize;
+        std::pair<int, int> quarters[4] = {std::make_pair(x, y), std::make_pair(x + half, y),
+                                           std::make_pair(x, y + half), std::make_pair(x + half, y + half)};
+        bool allFree = true;
+        for (const std::pair<int, int>& quarter : quarters) {
+            if (quarter != square && !freeSquares_[l].count(quarter))
+                allFree = false;
+        }
+        if (!allFree)
+            break;
+        for (const std::pair<int, int>& quarter : quarters) {
+            if (quarter != square)
+                freeSquares_[l].erase(quarter);
+        }
+        square = std::make_pair(x, y);
+        l--;
+    }
+    freeSquares_[l].insert(square);
+}
+
+}  // namespace DynamicScene
+}  // namespace CS248
@@ -0,0 +1,75 @@
+#ifndef CS248_DYNAMICSCENE_SHADOW_ATLAS_H
+#define CS248_DYNAMICSCENE_SHADOW_ATLAS_H
+
+#include <set>
+#include <utility>
+#include <vector>
+
+namespace CS248 {
+namespace DynamicScene {
+
+/**
+ * The placement of the shadow maps of a scene in one square texture (the atlas), whose size is
+ * the memory budget of all the maps. Each map gets a square tile whose size is a power of two,
+ * chosen from how many texels the map should have (see update): when the tiles would not fit,
+ * the largest are made smaller until they do.
+ *
+ * The tiles are allocated from a quadtree of the atlas (a square is split into four when a
+ * smaller tile is needed, and merged back when its four quarters are free), so that any tiles
+ * whose total area fits in the atlas can be placed. When the size of some maps changes, only
+ * those are placed again, in the free space around the others; all maps are only placed again
+ * if that space is too fragmented.
+ */
+class ShadowAtlas {
+ public:
+    // a square of the atlas, in texels. A map without a tile has size 0.
+    struct Tile {
+        int x = 0;
+        int y = 0;
+        int size = 0;
+    };
+
+    // an atlas of `size` texels across (a power of two), with tiles of at least `minTileSize`
+    ShadowAtlas(int size, int minTileSize);
+
+    int getSize() const { return size_; }
+    int getNumMaps() const { return tiles_.size(); }
+    const Tile& getTile(int map) const { return tiles_[map]; }
+    // the texels of the atlas in a tile
+    long long getUsedTexels() const;
+
+    // Gives map i a tile of about idealSizes[i] texels across, removing the tiles of the maps
+    // beyond idealSizes.size(). A map keeps its size until its ideal size is well past the next
+    // power of two, so that maps whose ideal size hovers around one do not change every frame.
+    // Sets moved[i] to 1 for the maps whose tile changed (the others keep their contents), and
+    // returns their number.
+    int update(const std::vector<float>& idealSizes, std::vector<unsigned char>* moved);
+
+    // times all maps were placed again because the free space was too fragmented
+    int getNumRepacks() const { return numRepacks_; }
+
+ private:
+    // the tile size of a map of the given ideal size, that had the size `current` (or 0)
+    int chooseSize(float idealSize, int current) const;
+    // the sizes of the tiles, made smaller until they fit in the atlas
+    void fitBudget(std::vector<int>* sizes, const std::vector<float>& idealSizes) const;
+
+    // level of the squares of a given size: the atlas is level 0, its quarters level 1, etc.
+    int level(int tileSize) const;
+    bool allocate(int tileSize, Tile* tile);
+    void free(const Tile& tile);
+
+    int size_;
+    int minTileSize_;
+    std::vector<Tile> tiles_;
+    std::vector<int> chosenSizes_;   // the sizes chooseSize picked, before fitBudget
+    int numRepacks_ = 0;
+
+    // the free squares of each level, by their corner
+    std::vector<std::set<std::pair<int, int>>> freeSquares_;
+};
+
+}  // namespace DynamicScene
+}  // namespace CS248
+
+#endif  // CS248_DYNAMICSCENE_SHADOW_ATLAS_H
@@ -0,0 +1,211 @@
+#include "static_batch.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <set>
+#include <string>
+#include <tuple>
+
+#include "../bbox.h"
+#include "../collada/polymesh_info.h"
+
+#include "mesh_asset.h"
+#include "scene.h"
+
+using namespace std;
+
+namespace CS248 {
+namespace DynamicScene {
+
+namespace {
+
+using Collada::PolymeshInfo;
+
+// a static mesh of the scene, placed in world space
+struct StaticMesh {
+    const Collada::Node* node;
+    const PolymeshInfo*  polymesh;
+    Matrix4x4 objectToWorld;
+    Matrix3x3 objectToWorldForNormals;
+    BBox      bbox;
+};
+
+// Meshes with the same key are drawn the same way, and have the same vertex streams
+typedef tuple<string, string, string, string, string, string, bool, float, bool, bool> BatchKey;
+
+BatchKey batchKey(const PolymeshInfo& polymesh) {
+    const PolymeshInfo& geometry = polymesh.geometry();
+    return BatchKey(polymesh.vert_filename, polymesh.frag_filename, polymesh.diffuse_filename,
+                    polymesh.normal_filename, polymesh.environment_filename, polymesh.vertex_format,
+                    polymesh.is_mirror_brdf, polymesh.phong_spec_exp,
+                    geometry.normals.empty(), geometry.texcoords.empty());
+}
+
+// the diffuse color of a face, as MeshAsset reads it: faces past the colors of the mesh use the
+// first color, and meshes without colors are black
+Vector3D faceColor(const PolymeshInfo& geometry, size_t face) {
+    const vector<Vector3D>& colors = geometry.material_diffuse_parameters;
+    if (face < colors.size())
+        return colors[face];
+    return colors.empty() ? Vector3D(0, 0, 0) : colors[0];
+}
+
+// true if the meshes have no more distinct colors than a mesh has materials (see MeshAsset)
+bool fitsMaterialPalette(const vector<StaticMesh>& meshes, int begin, int end) {
+    set<tuple<double, double, double>> colors;
+    for (int i = begin; i < end; i++) {
+        const PolymeshInfo& geometry = meshes[i].polymesh->geometry();
+        for (size_t face = 0; face < geometry.polygons.size(); face++) {
+            Vector3D color = faceColor(geometry, face);
+            colors.insert(make_tuple(color.x, color.y, color.z));
+            if (colors.size() > MESH_MAX_MATERIALS)
+                return false;
+        }
+    }
+    return true;
+}
+
+// Splits meshes[begin, end) into ranges of meshes that fit the limits of a batch
+void partition(vector<StaticMesh>& meshes, int begin, int end, const StaticBatchOptions& options,
+               double maxExtent, vector<pair<int, int>>* batches) {
+
+    int numTriangles = 0;
+    BBox bbox, centers;
+    for (int i = begin; i < end; i++) {
+        numTriangles += meshes[i].polymesh->geometry().polygons.size();
+        bbox.expand(meshes[i].bbox);
+        centers.expand(meshes[i].bbox.centroid());
+    }
+
+    if (end - begin == 1 || (numTriangles <= options.maxTriangles && bbox.extent.norm() <= maxExtent &&
+                             fitsMaterialPalette(meshes, begin, end))) {
+        batches->push_back(make_pair(begin, end));
+        return;
+    }
+
+    int axis = 0;
+    if (centers.extent.y > centers.extent[axis]) axis = 1;
+    if (centers.extent.z > centers.extent[axis]) axis = 2;
+
+    int middle = (begin + end) / 2;
+    nth_element(meshes.begin() + begin, meshes.begin() + middle, meshes.begin() + end,
+                [axis](const StaticMesh& a, const StaticMesh& b) {
+                    return a.bbox.centroid()[axis] < b.bbox.centroid()[axis];
+                });
+    partition(meshes, begin, middle, options, maxExtent, batches);
+    partition(meshes, middle, end, options, maxExtent, batches);
+}
+
+// Merges meshes[begin, end) into one mesh, in world space
+PolymeshInfo* bakeBatch(const vector<StaticMesh>& meshes, int begin, int end, int batchIndex) {
+
+    // the shaders, textures and material parameters are those of all meshes of the batch
+    PolymeshInfo* batch = new PolymeshInfo(*meshes[begin].polymesh);
+    batch->name = "static batch " + to_string(batchIndex);
+    batch->shared_geometry = nullptr;
+    batch->vertices.clear();
+    batch->normals.clear();
+    batch->texcoords.clear();
+    batch->polygons.clear();
+    batch->material_diffuse_parameters.clear();
+    batch->position = Vector3D(0, 0, 0);
+    batch->rotation = Vector3D(0, 0, 0);
+    batch->scale = Vector3D(1, 1, 1);
+
+    for (int i = begin; i < end; i++) {
+        const StaticMesh& mesh = meshes[i];
+        const PolymeshInfo& geometry = mesh.polymesh->geometry();
+
+        size_t vertexOffset = batch->vertices.size();
+        size_t normalOffset = batch->normals.size();
+        size_t texcoordOffset = batch->texcoords.size();
+
+        for (const Vector3D& v : geometry.vertices)
+            batch->vertices.push_back((mesh.objectToWorld * Vector4D(v, 1.)).projectTo3D());
+        for (const Vector3D& n : geometry.normals)
+            batch->normals.push_back((mesh.objectToWorldForNormals * n).unit());
+        batch->texcoords.insert(batch->texcoords.end(), geometry.texcoords.begin(), geometry.texcoords.end());
+
+        for (size_t face = 0; face < geometry.polygons.size(); face++) {
+            Collada::Polygon polygon = geometry.polygons[face];
+            for (size_t& index : polygon.vertex_indices) index += vertexOffset;
+            for (size_t& index : polygon.normal_indices) index += normalOffset;
+            for (size_t& index : polygon.texcoord_indices) index += texcoordOffset;
+            batch->polygons.push_back(polygon);
+            batch->material_diffuse_parameters.push_back(faceColor(geometry, face));
+        }
+    }
+
+    return batch;
+}
+
+}  // namespace
+
+
+vector<Collada::Node> batchStaticMeshes(const vector<Collada::Node>& nodes, const vector<Collada::GroupInfo>& sceneGroups,
+                                        const StaticBatchOptions& options) {
+
+    vector<Matrix4x4> groupsToWorld = Collada::GroupInfo::groupsToWorld(sceneGroups);
+    vector<Collada::Node> result;
+    map<BatchKey, vector<StaticMesh>> groups;
+    BBox staticBBox;
+
+    for (const Collada::Node& node : nodes) {
+        if (!node.instance || node.instance->type != Collada::Instance::POLYMESH ||
+            !static_cast<const PolymeshInfo*>(node.instance)->is_static) {
+            result.push_back(node);
+            continue;
+        }
+
+        // placed the way Mesh::Mesh places it: the translation and scale of the node's transform,
+        // and the rotation of the mesh, in its group if it has one
+        const PolymeshInfo* polymesh = static_cast<const PolymeshInfo*>(node.instance);
+        const Matrix4x4& transform = node.transform;
+        Vector3D position(transform[3][0], transform[3][1], transform[3][2]);
+        Vector3D scale(transform[0][0], transform[1][1], transform[2][2]);
+
+        StaticMesh mesh;
+        mesh.node = &node;
+        mesh.polymesh = polymesh;
+        mesh.objectToWorld = SceneObject::objectToWorld(position, polymesh->rotation, scale);
+        if (node.group >= 0)
+            mesh.objectToWorld = groupsToWorld[node.group] * mesh.objectToWorld;
+        mesh.objectToWorldForNormals = SceneObject::normalTransform(mesh.objectToWorld);
+        for (const Vector3D& v : polymesh->geometry().vertices)
+            mesh.bbox.expand((mesh.objectToWorld * Vector4D(v, 1.)).projectTo3D());
+
+        groups[batchKey(*polymesh)].push_back(mesh);
+        staticBBox.expand(mesh.bbox);
+    }
+
+    if (groups.empty())
+        return result;
+
+    double maxExtent = options.maxExtentFraction * staticBBox.extent.norm();
+    int numMerged = 0, numBatches = 0;
+    for (auto& group : groups) {
+        vector<StaticMesh>& meshes = group.second;
+        vector<pair<int, int>> batches;
+        partition(meshes, 0, meshes.size(), options, maxExtent, &batches);
+
+        for (const pair<int, int>& batch : batches) {
+            if (batch.second - batch.first == 1) {
+                result.push_back(*meshes[batch.first].node);
+                continue;
+            }
+            Collada::Node batchNode;
+            batchNode.instance = bakeBatch(meshes, batch.first, batch.second, numBatches);
+            batchNode.name = batchNode.instance->name;
+            result.push_back(batchNode);
+            numMerged += batch.second - batch.first;
+            numBatches++;
+        }
+    }
+
+    printf("Static batching: %d static meshes merged into %d batches\n", numMerged, numBatches);
+    return result;
+}
+
+}  // namespace DynamicScene
+}  // namespace CS248
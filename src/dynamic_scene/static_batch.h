@@ -0,0 +1,40 @@
+#ifndef CS248_DYNAMICSCENE_STATIC_BATCH_H
+#define CS248_DYNAMICSCENE_STATIC_BATCH_H
+
+#include <vector>
+
+#include "../collada/collada_info.h"
+
+namespace CS248 {
+namespace DynamicScene {
+
+// Limits on the meshes merged into one static batch, so that batches stay small enough to be
+// culled (and depth sorted) as a unit
+struct StaticBatchOptions {
+    int   maxTriangles = 16384;
+    // largest diagonal of the bounding box of a batch, relative to that of all static meshes
+    float maxExtentFraction = 0.25f;
+};
+
+/**
+ * Merges the static meshes of a scene (see PolymeshInfo::is_static) that are drawn the same way,
+ * i.e. with the same shaders, textures and material parameters, into a few meshes whose vertices
+ * are already in world space. Each batch is then drawn as one mesh, with one draw call per
+ * material, instead of one (or more) per mesh. Batches group nearby meshes: a group larger than
+ * the limits of `options` is split in two at the median of the mesh centers along its longest axis.
+ *
+ * Static meshes in a group (see Collada::GroupInfo) are merged where `sceneGroups` places them.
+ *
+ * Returns the nodes to create the scene objects from: the nodes that were not merged (cameras,
+ * lights, non-static meshes, and static meshes with nothing to merge with), then one node per
+ * batch, in world space. The PolymeshInfos of the batches are allocated here and, like the
+ * parsed ones, never freed.
+ */
+std::vector<Collada::Node> batchStaticMeshes(const std::vector<Collada::Node>& nodes,
+                                             const std::vector<Collada::GroupInfo>& sceneGroups,
+                                             const StaticBatchOptions& options);
+
+}  // namespace DynamicScene
+}  // namespace CS248
+
+#endif  // CS248_DYNAMICSCENE_STATIC_BATCH_H
@@ -0,0 +1,152 @@
+#include "transform_hierarchy.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace CS248 {
+namespace DynamicScene {
+
+namespace {
+
+// fewer nodes to recompute are updated on one thread
+const int kMinParallelNodes = 4096;
+
+}  // namespace
+
+void TransformHierarchy::build(const std::vector<int>& parents, const std::vector<Matrix4x4>& localTransforms) {
+
+    int numNodes = parents.size();
+
+    // the children of each node, in the order they were given
+    std::vector<int> firstChild(numNodes + 1, 0);
+    for (int i = 0; i < numNodes; i++) {
+        if (parents[i] != kNoParent)
+            firstChild[parents[i] + 1]++;
+    }
+    for (int i = 0; i < numNodes; i++)
+        firstChild[i + 1] += firstChild[i];
+    std::vector<int> children(firstChild[numNodes]);
+    std::vector<int> numChildren(numNodes, 0);
+    for (int i = 0; i < numNodes; i++) {
+        if (parents[i] != kNoParent)
+            children[firstChild[parents[i]] + numChildren[parents[i]]++] = i;
+    }
+
+    // depth first order, from each top-level node in turn
+    node_.clear();
+    node_.reserve(numNodes);
+    position_.assign(numNodes, -1);
+    std::vector<int> stack;
+    for (int i = 0; i < numNodes; i++) {
+        if (parents[i] != kNoParent)
+            continue;
+        stack.push_back(i);
+        while (!stack.empty()) {
+            int node = stack.back();
+            stack.pop_back();
+            position_[node] = node_.size();
+            node_.push_back(node);
+            for (int c = firstChild[node + 1] - 1; c >= firstChild[node]; c--)
+                stack.push_back(children[c]);
+        }
+    }
+
+    parent_.resize(numNodes);
+    subtreeEnd_.resize(numNodes);
+    root_.resize(numNodes);
+    local_.resize(numNodes);
+    world_.resize(numNodes);
+    for (int p = 0; p < numNodes; p++) {
+        int node = node_[p];
+        if (parents[node] == kNoParent) {
+            parent_[p] = kNoParent;
+            root_[p] = p;
+        } else {
+            parent_[p] = position_[parents[node]];
+            root_[p] = root_[parent_[p]];
+        }
+        local_[p] = localTransforms[node];
+        subtreeEnd_[p] = p + 1;
+    }
+    for (int p = numNodes - 1; p >= 0; p--) {
+        if (parent_[p] != kNoParent)
+            subtreeEnd_[parent_[p]] = std::max(subtreeEnd_[parent_[p]], subtreeEnd_[p]);
+    }
+
+    changed_.assign(numNodes, 1);
+    updated_.assign(numNodes, 0);
+    rootChanged_.assign(numNodes, 0);
+    changedRoots_.clear();
+    for (int p = 0; p < numNodes; p++) {
+        if (parent_[p] == kNoParent) {
+            rootChanged_[p] = 1;
+            changedRoots_.push_back(p);
+        }
+    }
+    updatedNodes_.clear();
+}
+
+void TransformHierarchy::setLocalTransform(int node, const Matrix4x4& transform) {
+    int p = position_[node];
+    local_[p] = transform;
+    changed_[p] = 1;
+    int root = root_[p];
+    if (!rootChanged_[root]) {
+        rootChanged_[root] = 1;
+        changedRoots_.push_back(root);
+    }
+}
+
+int TransformHierarchy::update() {
+
+    int numCandidates = 0;
+    for (int root : changedRoots_)
+        numCandidates += subtreeEnd_[root] - root;
+
+    // a node is recomputed if it changed or its parent was recomputed, which the pass over its
+    // subtree decides before reaching it
+    int numUpdated = 0;
+    int numRoots = changedRoots_.size();
+    #pragma omp parallel for schedule(dynamic) reduction(+ : numUpdated) if (numCandidates >= kMinParallelNodes)
+    for (int k = 0; k < numRoots; k++) {
+        int root = changedRoots_[k];
+        for (int i = root; i < subtreeEnd_[root]; i++) {
+            int parent = parent_[i];
+            updated_[i] = changed_[i] || (parent != kNoParent && updated_[parent]);
+            if (!updated_[i])
+                continue;
+            world_[i] = parent == kNoParent ? local_[i] : world_[parent] * local_[i];
+            changed_[i] = 0;
+            numUpdated++;
+        }
+    }
+
+    updatedNodes_.clear();
+    for (int root : changedRoots_) {
+        for (int i = root; i < subtreeEnd_[root]; i++) {
+            if (updated_[i])
+                updatedNodes_.push_back(node_[i]);
+        }
+        rootChanged_[root] = 0;
+    }
+    changedRoots_.clear();
+    return numUpdated;
+}
+
+double TransformHierarchy::maxWorldTransformError() const {
+
+    // parents come before their children, so each node is recomputed from its parent's
+    std::vector<Matrix4x4> world(local_.size());
+    double maxError = 0.;
+    for (int i = 0; i < (int)local_.size(); i++) {
+        world[i] = parent_[i] == kNoParent ? local_[i] : world[parent_[i]] * local_[i];
+        for (int r = 0; r < 4; r++) {
+            for (int c = 0; c < 4; c++)
+                maxError = std::max(maxError, std::abs(world[i](r, c) - world_[i](r, c)));
+        }
+    }
+    return maxError;
+}
+
+}  // namespace DynamicScene
+}  // namespace CS248
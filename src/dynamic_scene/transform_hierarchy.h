@@ -0,0 +1,74 @@
+#ifndef CS248_DYNAMICSCENE_TRANSFORM_HIERARCHY_H
+#define CS248_DYNAMICSCENE_TRANSFORM_HIERARCHY_H
+
+#include <vector>
+
+#include "CS248/matrix4x4.h"
+
+namespace CS248 {
+namespace DynamicScene {
+
+/**
+ * A tree of transforms, each relative to its parent's (e.g. the groups of a scene, which place
+ * the objects in them). The nodes are stored in depth first order, so that every parent comes
+ * before its children and every subtree is a contiguous range of nodes. update() then
+ * recomputes the world transforms of the changed nodes and of their descendants in one pass
+ * over the subtrees holding a changed node, each node from its parent's. The subtrees of
+ * different top-level nodes are independent of each other, so they are updated in parallel
+ * (with OpenMP) when there are enough nodes to recompute.
+ *
+ * Nodes are identified by the index they were given to build() at, whatever their position.
+ */
+class TransformHierarchy {
+ public:
+    static const int kNoParent = -1;
+
+    // Builds the tree of the nodes whose parent and transform relative to it are parents[i]
+    // and localTransforms[i]. Parents must come before their children (parents[i] < i).
+    // All nodes start changed, so the first update() computes every world transform.
+    void build(const std::vector<int>& parents, const std::vector<Matrix4x4>& localTransforms);
+
+    int size() const { return local_.size(); }
+
+    const Matrix4x4& getLocalTransform(int node) const { return local_[position_[node]]; }
+    void setLocalTransform(int node, const Matrix4x4& transform);
+
+    // the world transform as of the last update()
+    const Matrix4x4& getWorldTransform(int node) const { return world_[position_[node]]; }
+
+    // Recomputes the world transforms of the nodes whose local transform changed since the
+    // last update, and of their descendants. Returns the number of nodes recomputed.
+    int update();
+
+    // the nodes whose world transform the last update() recomputed, parents first
+    const std::vector<int>& getUpdatedNodes() const { return updatedNodes_; }
+
+    // Recomputes every world transform from scratch and returns the largest difference of an
+    // entry from the one the incremental updates left (meant for checking update(), right after
+    // it, as nodes changed since are not up to date yet).
+    double maxWorldTransformError() const;
+
+ private:
+    // by position in depth first order
+    std::vector<int> node_;          // the node at each position
+    std::vector<int> parent_;        // position of the parent, or kNoParent
+    std::vector<int> subtreeEnd_;    // the subtree of position i is [i, subtreeEnd_[i])
+    std::vector<int> root_;          // position of the top-level node above (or at) each position
+    std::vector<Matrix4x4> local_;
+    std::vector<Matrix4x4> world_;
+    std::vector<unsigned char> changed_;
+    std::vector<unsigned char> updated_;
+
+    std::vector<int> position_;      // the position of each node
+
+    // the top-level nodes with a changed node in their subtree, marked in rootChanged_
+    std::vector<int> changedRoots_;
+    std::vector<unsigned char> rootChanged_;
+
+    std::vector<int> updatedNodes_;
+};
+
+}  // namespace DynamicScene
+}  // namespace CS248
+
+#endif  // CS248_DYNAMICSCENE_TRANSFORM_HIERARCHY_H
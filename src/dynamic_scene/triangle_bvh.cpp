@@ -0,0 +1,464 @@
+#include "triangle_bvh.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define CS248_BVH_SSE
+#endif
+
+namespace CS248 {
+namespace DynamicScene {
+
+namespace {
+
+const int kNumSAHBins = 16;
+// leaves hold at most this many triangles; fewer if splitting them is cheaper
+const int kMaxLeafTriangles = 8;
+// subtrees of more triangles are built by their own OpenMP task
+const int kMinParallelTriangles = 4096;
+// below this depth, nodes are split in halves, which bounds the depth of the hierarchy
+const int kMaxSAHDepth = 48;
+// at most three entries are left per level, and the hierarchy is less than 80 levels deep
+const int kTraversalStackSize = 256;
+
+float area(const float min[3], const float max[3]) {
+    float dx = max[0] - min[0];
+    float dy = max[1] - min[1];
+    float dz = max[2] - min[2];
+    return 2.f * (dx * dy + dy * dz + dz * dx);
+}
+
+void cross(const float a[3], const float b[3], float out[3]) {
+    out[0] = a[1] * b[2] - a[2] * b[1];
+    out[1] = a[2] * b[0] - a[0] * b[2];
+    out[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+float dot(const float a[3], const float b[3]) {
+    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+}  // namespace
+
+struct TriangleBVH::BuildNode {
+    float min[3];
+    float max[3];
+    int   left;       // -1 for leaves
+    int   right;
+    int   first;      // triangles order[first, first + count) of a leaf
+    int   count;
+};
+
+struct TriangleBVH::BuildState {
+    // the bounds and center of each triangle
+    struct Bounds {
+        float min[3];
+        float max[3];
+        float center[3];
+    };
+    std::vector<Bounds> triangles;
+    // the triangles, grouped by leaf as the hierarchy is built
+    std::vector<int> order;
+    // at most 2n - 1 nodes for n triangles, allocated up front so tasks can add nodes concurrently
+    std::vector<BuildNode> nodes;
+    std::atomic<int> numNodes;
+};
+
+void TriangleBVH::build(const std::vector<Vector3Df>& positions, const std::vector<int>& indices) {
+
+    nodes_.clear();
+    triangles_.clear();
+    int numTriangles = indices.size() / 3;
+    if (numTriangles == 0)
+        return;
+
+    BuildState state;
+    state.triangles.resize(numTriangles);
+    state.order.resize(numTriangles);
+    state.nodes.resize(2 * numTriangles - 1);
+    state.numNodes = 0;
+    triangles_.resize(numTriangles);
+
+    for (int i = 0; i < numTriangles; i++) {
+        const Vector3Df* v[3];
+        for (int j = 0; j < 3; j++)
+            v[j] = &positions[indices[3 * i + j]];
+
+        BuildState::Bounds& bounds = state.triangles[i];
+        float p[3][3] = {{v[0]->x, v[0]->y, v[0]->z}, {v[1]->x, v[1]->y, v[1]->z}, {v[2]->x, v[2]->y, v[2]->z}};
+        for (int axis = 0; axis < 3; axis++) {
+            bounds.min[axis] = std::min(p[0][axis], std::min(p[1][axis], p[2][axis]));
+            bounds.max[axis] = std::max(p[0][axis], std::max(p[1][axis], p[2][axis]));
+            bounds.center[axis] = 0.5f * (bounds.min[axis] + bounds.max[axis]);
+        }
+        state.order[i] = i;
+    }
+
+    int root;
+    #pragma omp parallel
+    #pragma omp single
+    root = buildBinary(state, 0, numTriangles, 0);
+
+    // the triangles in leaf order, so that each leaf is a range of them
+    for (int k = 0; k < numTriangles; k++) {
+        int i = state.order[k];
+        Triangle& triangle = triangles_[k];
+        const Vector3Df& v0 = positions[indices[3 * i + 0]];
+        const Vector3Df& v1 = positions[indices[3 * i + 1]];
+        const Vector3Df& v2 = positions[indices[3 * i + 2]];
+        float p0[3] = {v0.x, v0.y, v0.z};
+        float p1[3] = {v1.x, v1.y, v1.z};
+        float p2[3] = {v2.x, v2.y, v2.z};
+        for (int axis = 0; axis < 3; axis++) {
+            triangle.v0[axis] = p0[axis];
+            triangle.edge1[axis] = p1[axis] - p0[axis];
+            triangle.edge2[axis] = p2[axis] - p0[axis];
+        }
+        triangle.index = i;
+    }
+
+    nodes_.reserve(state.numNodes / 3 + 1);
+    nodes_.push_back(Node());
+    collapse(state, root, 0);
+}
+
+int TriangleBVH::buildBinary(BuildState& state, int first, int last, int depth) {
+
+    int node = state.numNodes++;
+    int count = last - first;
+
+    float min[3] = {INFINITY, INFINITY, INFINITY};
+    float max[3] = {-INFINITY, -INFINITY, -INFINITY};
+    float centerMin[3] = {INFINITY, INFINITY, INFINITY};
+    float centerMax[3] = {-INFINITY, -INFINITY, -INFINITY};
+    for (int k = first; k < last; k++) {
+        const BuildState::Bounds& bounds = state.triangles[state.order[k]];
+        for (int axis = 0; axis < 3; axis++) {
+            min[axis] = std::min(min[axis], bounds.min[axis]);
+            max[axis] = std::max(max[axis], bounds.max[axis]);
+            centerMin[axis] = std::min(centerMin[axis], bounds.center[axis]);
+            centerMax[axis] = std::max(centerMax[axis], bounds.center[axis]);
+        }
+    }
+    BuildNode& result = state.nodes[node];
+    for (int axis = 0; axis < 3; axis++) {
+        result.min[axis] = min[axis];
+        result.max[axis] = max[axis];
+    }
+    result.left = result.right = -1;
+    result.first = first;
+    result.count = count;
+    if (count == 1)
+        return node;
+
+    int axis = 0;
+    for (int a = 1; a < 3; a++) {
+        if (centerMax[a] - centerMin[a] > centerMax[axis] - centerMin[axis])
+            axis = a;
+    }
+    float extent = centerMax[axis] - centerMin[axis];
+
+    // split at the bin boundary with the lowest surface area heuristic cost, relative to the
+    // cost of intersecting every triangle of a leaf
+    int mid = -1;
+    if (extent > 0.f && depth < kMaxSAHDepth) {
+        struct Bin {
+            float min[3] = {INFINITY, INFINITY, INFINITY};
+            float max[3] = {-INFINITY, -INFINITY, -INFINITY};
+            int count = 0;
+        };
+        Bin bins[kNumSAHBins];
+        float scale = kNumSAHBins / extent;
+        auto binOf = [&](int triangle) {
+            return std::min(kNumSAHBins - 1, (int)((state.triangles[triangle].center[axis] - centerMin[axis]) * scale));
+        };
+        for (int k = first; k < last; k++) {
+            const BuildState::Bounds& bounds = state.triangles[state.order[k]];
+            Bin& bin = bins[binOf(state.order[k])];
+            for (int a = 0; a < 3; a++) {
+                bin.min[a] = std::min(bin.min[a], bounds.min[a]);
+                bin.max[a] = std::max(bin.max[a], bounds.max[a]);
+            }
+            bin.count++;
+        }
+
+        float rightCost[kNumSAHBins];
+        Bin right;
+        for (int s = kNumSAHBins - 1; s > 0; s--) {
+            for (int a = 0; a < 3; a++) {
+                right.min[a] = std::min(right.min[a], bins[s].min[a]);
+                right.max[a] = std::max(right.max[a], bins[s].max[a]);
+            }
+            right.count += bins[s].count;
+            rightCost[s] = right.count ? right.count * area(right.min, right.max) : 0.f;
+        }
+        Bin left;
+        float bestCost = INFINITY;
+        int bestSplit = -1;
+        for (int s = 0; s < kNumSAHBins - 1; s++) {
+            for (int a = 0; a < 3; a++) {
+                left.min[a] = std::min(left.min[a], bins[s].min[a]);
+                left.max[a] = std::max(left.max[a], bins[s].max[a]);
+            }
+            left.count += bins[s].count;
+            if (left.count == 0 || left.count == count)
+                continue;
+            float cost = left.count * area(left.min, left.max) + rightCost[s + 1];
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestSplit = s;
+            }
+        }
+
+        float nodeArea = area(min, max);
+        float splitCost = nodeArea > 0.f ? 1.f + bestCost / nodeArea : INFINITY;
+        if (bestSplit < 0 || splitCost >= count) {
+            if (count <= kMaxLeafTriangles)
+                return node;
+        } else {
+            int* middle = std::partition(&state.order[first], &state.order[first] + count,
+                                         [&](int triangle) { return binOf(triangle) <= bestSplit; });
+            mid = middle - &state.order[0];
+        }
+    } else if (count <= kMaxLeafTriangles) {
+        return node;
+    }
+
+    // otherwise the triangles are split in halves along the axis
+    if (mid < 0) {
+        mid = first + count / 2;
+        std::nth_element(&state.order[first], &state.order[mid], &state.order[first] + count,
+                         [&](int a, int b) { return state.triangles[a].center[axis] < state.triangles[b].center[axis]; });
+    }
+
+    int leftChild, rightChild;
+    if (count >= kMinParallelTriangles) {
+        #pragma omp task shared(state, leftChild)
+        leftChild = buildBinary(state, first, mid, depth + 1);
+        rightChild = buildBinary(state, mid, last, depth + 1);
+        #pragma omp taskwait
+    } else {
+        leftChild = buildBinary(state, first, mid, depth + 1);
+        rightChild = buildBinary(state, mid, last, depth + 1);
+    }
+    state.nodes[node].left = leftChild;
+    state.nodes[node].right = rightChild;
+    return node;
+}
+
+void TriangleBVH::collapse(const BuildState& state, int binaryNode, int node) {
+
+    // start from the two children (or the node itself, if the root is a leaf), and replace the
+    // largest inner child by its children until there are four
+    int children[4];
+    int numChildren = 0;
+    const BuildNode& root = state.nodes[binaryNode];
+    if (root.left < 0) {
+        children[numChildren++] = binaryNode;
+    } else {
+        children[numChildren++] = root.left;
+        children[numChildren++] = root.right;
+    }
+    while (numChildren < 4) {
+        int largest = -1;
+        float largestArea = -1.f;
+        for (int i = 0; i < numChildren; i++) {
+            const BuildNode& child = state.nodes[children[i]];
+            if (child.left >= 0 && area(child.min, child.max) > largestArea) {
+                largest = i;
+                largestArea = area(child.min, child.max);
+            }
+        }
+        if (largest < 0)
+            break;
+        const BuildNode& expanded = state.nodes[children[largest]];
+        children[largest] = expanded.left;
+        children[numChildren++] = expanded.right;
+    }
+
+    for (int i = 0; i < 4; i++) {
+        if (i >= numChildren) {
+            for (int axis = 0; axis < 3; axis++) {
+                nodes_[node].min[axis][i] = INFINITY;
+                nodes_[node].max[axis][i] = -INFINITY;
+            }
+            nodes_[node].child[i] = kEmptyChild;
+            nodes_[node].count[i] = kEmptyChild;
+            continue;
+        }
+
+        const BuildNode& child = state.nodes[children[i]];
+        for (int axis = 0; axis < 3; axis++) {
+            nodes_[node].min[axis][i] = child.min[axis];
+            nodes_[node].max[axis][i] = child.max[axis];
+        }
+        if (child.left < 0) {
+            nodes_[node].child[i] = child.first;
+            nodes_[node].count[i] = child.count;
+        } else {
+            // (adding the node may move nodes_, so it is only accessed by index)
+            int childNode = nodes_.size();
+            nodes_.push_back(Node());
+            nodes_[node].child[i] = childNode;
+            nodes_[node].count[i] = 0;
+            collapse(state, children[i], childNode);
+        }
+    }
+}
+
+template <bool any>
+bool TriangleBVH::intersectLeaf(int first, int count, const float origin[3], const float direction[3],
+                                float tMax, Hit* hit) const {
+    // Moller-Trumbore
+    bool found = false;
+    for (int k = first; k < first + count; k++) {
+        const Triangle& triangle = triangles_[k];
+        float p[3];
+        cross(direction, triangle.edge2, p);
+        float det = dot(triangle.edge1, p);
+        if (det == 0.f)
+            continue;
+        float invDet = 1.f / det;
+
+        float s[3] = {origin[0] - triangle.v0[0], origin[1] - triangle.v0[1], origin[2] - triangle.v0[2]};
+        float u = dot(s, p) * invDet;
+        if (u < 0.f || u > 1.f)
+            continue;
+        float q[3];
+        cross(s, triangle.edge1, q);
+        float v = dot(direction, q) * invDet;
+        if (v < 0.f || u + v > 1.f)
+            continue;
+        float t = dot(triangle.edge2, q) * invDet;
+        if (t < 0.f || t > tMax)
+            continue;
+
+        if (any)
+            return true;
+        tMax = t;
+        hit->t = t;
+        hit->triangle = triangle.index;
+        hit->u = u;
+        hit->v = v;
+        found = true;
+    }
+    return found;
+}
+
+template <bool any>
+bool TriangleBVH::traverse(const Vector3D& rayOrigin, const Vector3D& rayDirection, float tMax, Hit* hit) const {
+
+    if (nodes_.empty())
+        return false;
+
+    float origin[3], direction[3], invDirection[3];
+    for (int axis = 0; axis < 3; axis++) {
+        origin[axis] = rayOrigin[axis];
+        direction[axis] = rayDirection[axis];
+        invDirection[axis] = 1.f / direction[axis];
+    }
+
+#ifdef CS248_BVH_SSE
+    __m128 originSSE[3], invDirectionSSE[3];
+    for (int axis = 0; axis < 3; axis++) {
+        originSSE[axis] = _mm_set1_ps(origin[axis]);
+        invDirectionSSE[axis] = _mm_set1_ps(invDirection[axis]);
+    }
+#endif
+
+    // nodes to visit, with the distance at which the ray enters them
+    struct Entry {
+        int   node;
+        float tEnter;
+    };
+    Entry stack[kTraversalStackSize];
+    int stackSize = 0;
+    stack[stackSize++] = {0, 0.f};
+
+    bool found = false;
+    while (stackSize > 0) {
+        Entry entry = stack[--stackSize];
+        if (entry.tEnter > tMax)
+            continue;
+        const Node& node = nodes_[entry.node];
+
+        // the distances at which the ray enters and leaves each child's box
+        float tEnter[4];
+        int hitMask;
+#ifdef CS248_BVH_SSE
+        __m128 tNear = _mm_setzero_ps();
+        __m128 tFar = _mm_set1_ps(tMax);
+        for (int axis = 0; axis < 3; axis++) {
+            __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.min[axis]), originSSE[axis]), invDirectionSSE[axis]);
+            __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.max[axis]), originSSE[axis]), invDirectionSSE[axis]);
+            tNear = _mm_max_ps(tNear, _mm_min_ps(t0, t1));
+            tFar = _mm_min_ps(tFar, _mm_max_ps(t0, t1));
+        }
+        _mm_storeu_ps(tEnter, tNear);
+        hitMask = _mm_movemask_ps(_mm_cmple_ps(tNear, tFar));
+#else
+        hitMask = 0;
+        for (int i = 0; i < 4; i++) {
+            float tNear = 0.f;
+            float tFar = tMax;
+            for (int axis = 0; axis < 3; axis++) {
+                float t0 = (node.min[axis][i] - origin[axis]) * invDirection[axis];
+                float t1 = (node.max[axis][i] - origin[axis]) * invDirection[axis];
+                tNear = std::max(tNear, std::min(t0, t1));
+                tFar = std::min(tFar, std::max(t0, t1));
+            }
+            tEnter[i] = tNear;
+            hitMask |= (tNear <= tFar) << i;
+        }
+#endif
+
+        // the leaves hit are intersected right away, the nodes hit are visited nearest first
+        int hitNodes[4];
+        int numHitNodes = 0;
+        for (int i = 0; i < 4; i++) {
+            if (!(hitMask & (1 << i)) || node.count[i] == kEmptyChild)
+                continue;
+            if (node.count[i] > 0) {
+                if (intersectLeaf<any>(node.child[i], node.count[i], origin, direction, tMax, hit)) {
+                    if (any)
+                        return true;
+                    tMax = hit->t;
+                    found = true;
+                }
+            } else {
+                int j = numHitNodes++;
+                for (; j > 0 && tEnter[hitNodes[j - 1]] < tEnter[i]; j--)
+                    hitNodes[j] = hitNodes[j - 1];
+                hitNodes[j] = i;
+            }
+        }
+        for (int j = 0; j < numHitNodes; j++)
+            stack[stackSize++] = {node.child[hitNodes[j]], tEnter[hitNodes[j]]};
+    }
+    return found;
+}
+
+bool TriangleBVH::intersectClosest(const Vector3D& origin, const Vector3D& direction, float tMax, Hit* hit) const {
+    return traverse<false>(origin, direction, tMax, hit);
+}
+
+bool TriangleBVH::intersectAny(const Vector3D& origin, const Vector3D& direction, float tMax) const {
+    Hit hit;
+    return traverse<true>(origin, direction, tMax, &hit);
+}
+
+bool TriangleBVH::intersectClosestExhaustive(const Vector3D& rayOrigin, const Vector3D& rayDirection,
+                                             float tMax, Hit* hit) const {
+    float origin[3], direction[3];
+    for (int axis = 0; axis < 3; axis++) {
+        origin[axis] = rayOrigin[axis];
+        direction[axis] = rayDirection[axis];
+    }
+    return intersectLeaf<false>(0, triangles_.size(), origin, direction, tMax, hit);
+}
+
+}  // namespace DynamicScene
+}  // namespace CS248
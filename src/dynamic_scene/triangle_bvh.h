@@ -0,0 +1,91 @@
+#ifndef CS248_DYNAMICSCENE_TRIANGLE_BVH_H
+#define CS248_DYNAMICSCENE_TRIANGLE_BVH_H
+
+#include <vector>
+
+#include "CS248/vector3D.h"
+
+#include "vertex_format.h"
+
+namespace CS248 {
+namespace DynamicScene {
+
+/**
+ * A bounding volume hierarchy over the triangles of a mesh, for ray queries on the CPU (picking,
+ * visibility tests). It is built top-down with a binned surface area heuristic, with the large
+ * subtrees built in parallel (with OpenMP, when enabled), and then collapsed into nodes of four
+ * children, whose boxes are stored as arrays so that a ray is tested against the four at once
+ * with SSE instructions.
+ *
+ * Rays and hits are in the space of the positions the hierarchy was built from.
+ */
+class TriangleBVH {
+ public:
+    // Builds the hierarchy over the triangles positions[indices[3 * i + j]], j = 0, 1, 2.
+    void build(const std::vector<Vector3Df>& positions, const std::vector<int>& indices);
+
+    struct Hit {
+        float t;          // the hit is at origin + t * direction
+        int   triangle;   // index of the triangle, in the order given to build()
+        float u, v;       // barycentric coordinates of the hit in the triangle
+    };
+
+    // Finds the closest triangle hit by the ray origin + t * direction, t in [0, tMax]. Returns
+    // false if there is none.
+    bool intersectClosest(const Vector3D& origin, const Vector3D& direction, float tMax, Hit* hit) const;
+
+    // Returns true if any triangle is hit by the ray for t in [0, tMax], stopping at the first
+    // one found (e.g. for shadow or visibility tests).
+    bool intersectAny(const Vector3D& origin, const Vector3D& direction, float tMax) const;
+
+    // Same as intersectClosest, testing every triangle instead of traversing the hierarchy (to
+    // check the hierarchy against)
+    bool intersectClosestExhaustive(const Vector3D& origin, const Vector3D& direction, float tMax, Hit* hit) const;
+
+    int getNumTriangles() const { return triangles_.size(); }
+    int getNumNodes() const { return nodes_.size(); }
+
+ private:
+    static const int kEmptyChild = -1;
+
+    // Four children, whose boxes are stored by coordinate. A child is a node if its count is
+    // zero, a leaf of `count` triangles from triangles_[child] on if it is positive, and an
+    // empty slot if it is kEmptyChild.
+    struct Node {
+        float min[3][4];
+        float max[3][4];
+        int   child[4];
+        int   count[4];
+    };
+
+    // a triangle as its first vertex and two edges, the form the intersection test uses
+    struct Triangle {
+        float v0[3];
+        float edge1[3];
+        float edge2[3];
+        int   index;
+    };
+
+    // the intermediate binary hierarchy
+    struct BuildNode;
+    struct BuildState;
+    int buildBinary(BuildState& state, int first, int last, int depth);
+    // turns the binary subtree under `binaryNode` into the 4-wide node `node`
+    void collapse(const BuildState& state, int binaryNode, int node);
+
+    // intersects the ray with the triangles of a leaf; with `any`, stops at the first hit
+    template <bool any>
+    bool intersectLeaf(int first, int count, const float origin[3], const float direction[3],
+                       float tMax, Hit* hit) const;
+    template <bool any>
+    bool traverse(const Vector3D& origin, const Vector3D& direction, float tMax, Hit* hit) const;
+
+    // the root is node 0 (there are no nodes if there are no triangles)
+    std::vector<Node> nodes_;
+    std::vector<Triangle> triangles_;
+};
+
+}  // namespace DynamicScene
+}  // namespace CS248
+
+#endif  // CS248_DYNAMICSCENE_TRIANGLE_BVH_H
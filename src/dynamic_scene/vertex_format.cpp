@@ -0,0 +1,393 @@
+#include "vertex_format.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <unordered_map>
+
+#include "../shader.h"
+
+namespace CS248 {
+namespace DynamicScene {
+
+namespace {
+
+int positionSize(PositionEncoding e) { return e == POSITION_FLOAT3 ? 12 : 8; }
+int normalSize(NormalEncoding e)     { return e == NORMAL_FLOAT3 ? 12 : 4; }
+int texcoordSize(TexcoordEncoding e) { return e == TEXCOORD_FLOAT2 ? 8 : 4; }
+
+float clampf(float v, float lo, float hi) { return std::min(std::max(v, lo), hi); }
+
+float signNotZero(float v) { return v >= 0.f ? 1.f : -1.f; }
+
+float length(const Vector3Df& v) { return std::sqrt(v.x * v.x + v.y * v.y + v.z * v.z); }
+
+// Normalizes `v`. Returns false if it has no direction (zero length, or not finite),
+// which happens for the tangents of triangles with degenerate texture coordinates.
+bool normalizeDirection(const Vector3Df& v, Vector3Df* out) {
+    float len = length(v);
+    if (!std::isfinite(len) || len == 0.f)
+        return false;
+    out->x = v.x / len;
+    out->y = v.y / len;
+    out->z = v.z / len;
+    return true;
+}
+
+// Octahedral encoding of unit vectors: the unit sphere is projected onto the octahedron
+// |x|+|y|+|z| = 1, whose lower half is folded over the upper half to fill the [-1,1]^2 square.
+void octEncode(const Vector3Df& n, float* u, float* v) {
+    float l1 = std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z);
+    float px = n.x / l1;
+    float py = n.y / l1;
+    if (n.z < 0.f) {
+        float ox = (1.f - std::fabs(py)) * signNotZero(px);
+        float oy = (1.f - std::fabs(px)) * signNotZero(py);
+        px = ox;
+        py = oy;
+    }
+    *u = px;
+    *v = py;
+}
+
+// must match octDecode in the vertex shaders
+Vector3Df octDecode(float u, float v) {
+    Vector3Df n = {u, v, 1.f - std::fabs(u) - std::fabs(v)};
+    if (n.z < 0.f) {
+        n.x = (1.f - std::fabs(v)) * signNotZero(u);
+        n.y = (1.f - std::fabs(u)) * signNotZero(v);
+    }
+    Vector3Df out;
+    normalizeDirection(n, &out);
+    return out;
+}
+
+int16_t quantizeSnorm16(float v) { return (int16_t)std::lround(clampf(v, -1.f, 1.f) * 32767.f); }
+float dequantizeSnorm16(int16_t q) { return std::max(q / 32767.f, -1.f); }
+
+uint16_t quantizeUnorm16(float v, float min, float extent) {
+    return (uint16_t)std::lround(clampf((v - min) / extent, 0.f, 1.f) * 65535.f);
+}
+float dequantizeUnorm16(uint16_t q, float min, float extent) { return min + q / 65535.f * extent; }
+
+// IEEE 754 binary16 conversion, rounding to nearest even
+uint16_t floatToHalf(float f) {
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    uint32_t sign = (x >> 16) & 0x8000;
+    int exponent = (int)((x >> 23) & 0xff) - 127 + 15;
+    uint32_t mantissa = x & 0x7fffff;
+
+    if (((x >> 23) & 0xff) == 0xff)                 // inf or nan
+        return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+    if (exponent >= 31)                             // overflow
+        return sign | 0x7c00;
+    if (exponent <= 0) {                            // subnormal, or underflow to zero
+        if (exponent < -10)
+            return sign;
+        mantissa |= 0x800000;
+        int shift = 14 - exponent;
+        uint32_t h = mantissa >> shift;
+        uint32_t remainder = mantissa & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if (remainder > halfway || (remainder == halfway && (h & 1)))
+            h++;
+        return sign | h;
+    }
+
+    uint32_t h = ((uint32_t)exponent << 10) | (mantissa >> 13);
+    uint32_t remainder = mantissa & 0x1fff;
+    if (remainder > 0x1000 || (remainder == 0x1000 && (h & 1)))
+        h++;                                        // may carry into the exponent, which is correct
+    return sign | h;
+}
+
+float halfToFloat(uint16_t h) {
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t exponent = (h >> 10) & 0x1f;
+    uint32_t mantissa = h & 0x3ff;
+
+    if (exponent == 0) {
+        float f = std::ldexp((float)mantissa, -24);
+        return sign ? -f : f;
+    }
+
+    uint32_t x;
+    if (exponent == 31)
+        x = sign | 0x7f800000 | (mantissa << 13);
+    else
+        x = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+    float f;
+    memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+// Range of the positions of a mesh, used to quantize them
+struct PositionRange {
+    Vector3Df min;
+    Vector3Df extent;   // never zero, so that flat meshes can still be quantized
+    float     diagonal;
+};
+
+PositionRange computePositionRange(const std::vector<Vector3Df>& positions, size_t numVertices) {
+    Vector3Df lo = {0.f, 0.f, 0.f};
+    Vector3Df hi = {0.f, 0.f, 0.f};
+    for (size_t i = 0; i < numVertices; i++) {
+        const Vector3Df& p = positions[i];
+        if (i == 0) {
+            lo = hi = p;
+        } else {
+            lo.x = std::min(lo.x, p.x); lo.y = std::min(lo.y, p.y); lo.z = std::min(lo.z, p.z);
+            hi.x = std::max(hi.x, p.x); hi.y = std::max(hi.y, p.y); hi.z = std::max(hi.z, p.z);
+        }
+    }
+
+    PositionRange range;
+    range.min = lo;
+    range.extent = {hi.x - lo.x, hi.y - lo.y, hi.z - lo.z};
+    range.diagonal = length(range.extent);
+    if (range.extent.x == 0.f) range.extent.x = 1.f;
+    if (range.extent.y == 0.f) range.extent.y = 1.f;
+    if (range.extent.z == 0.f) range.extent.z = 1.f;
+    return range;
+}
+
+bool positionsFit(const VertexAttributes& attribs, const VertexFormatTolerance& tolerance) {
+    const std::vector<Vector3Df>& positions = *attribs.positions;
+    PositionRange range = computePositionRange(positions, positions.size());
+    float maxError = tolerance.position * range.diagonal;
+
+    for (size_t i = 0; i < positions.size(); i++) {
+        const Vector3Df& p = positions[i];
+        Vector3Df d;
+        d.x = dequantizeUnorm16(quantizeUnorm16(p.x, range.min.x, range.extent.x), range.min.x, range.extent.x) - p.x;
+        d.y = dequantizeUnorm16(quantizeUnorm16(p.y, range.min.y, range.extent.y), range.min.y, range.extent.y) - p.y;
+        d.z = dequantizeUnorm16(quantizeUnorm16(p.z, range.min.z, range.extent.z), range.min.z, range.extent.z) - p.z;
+        if (!(length(d) <= maxError))
+            return false;
+    }
+    return true;
+}
+
+bool directionsFit(const std::vector<Vector3Df>& directions, float minCosine) {
+    for (size_t i = 0; i < directions.size(); i++) {
+        Vector3Df n;
+        if (!normalizeDirection(directions[i], &n))
+            continue;   // nothing to preserve
+
+        float u, v;
+        octEncode(n, &u, &v);
+        Vector3Df decoded = octDecode(dequantizeSnorm16(quantizeSnorm16(u)), dequantizeSnorm16(quantizeSnorm16(v)));
+        if (n.x * decoded.x + n.y * decoded.y + n.z * decoded.z < minCosine)
+            return false;
+    }
+    return true;
+}
+
+bool normalsFit(const VertexAttributes& attribs, const VertexFormatTolerance& tolerance) {
+    float minCosine = std::cos(radians(tolerance.normalDegrees));
+    return directionsFit(*attribs.normals, minCosine) &&
+           directionsFit(*attribs.tangents, minCosine);
+}
+
+bool texcoordsFit(const VertexAttributes& attribs, const VertexFormatTolerance& tolerance) {
+    const std::vector<Vector2Df>& texcoords = *attribs.texcoords;
+    for (size_t i = 0; i < texcoords.size(); i++) {
+        const Vector2Df& t = texcoords[i];
+        if (!(std::fabs(halfToFloat(floatToHalf(t.x)) - t.x) <= tolerance.texcoord) ||
+            !(std::fabs(halfToFloat(floatToHalf(t.y)) - t.y) <= tolerance.texcoord))
+            return false;
+    }
+    return true;
+}
+
+void encodeOctahedral(const Vector3Df& direction, int16_t out[2]) {
+    Vector3Df n;
+    if (!normalizeDirection(direction, &n))
+        n = {0.f, 0.f, 1.f};
+    float u, v;
+    octEncode(n, &u, &v);
+    out[0] = quantizeSnorm16(u);
+    out[1] = quantizeSnorm16(v);
+}
+
+}  // namespace
+
+
+VertexFormat VertexFormat::compact() {
+    VertexFormat format;
+    format.position = POSITION_UNORM16;
+    format.normal = NORMAL_OCTAHEDRAL_SNORM16;
+    format.texcoord = TEXCOORD_HALF2;
+    return format;
+}
+
+int VertexFormat::stride() const {
+    return positionSize(position) +
+           (hasNormal ? normalSize(normal) : 0) +
+           (hasTangent ? normalSize(normal) : 0) +
+           (hasTexcoord ? texcoordSize(texcoord) : 0);
+}
+
+int VertexFormat::positionStride() const {
+    return positionSize(position);
+}
+
+std::vector<VertexAttributeLayout> VertexFormat::attributes() const {
+    std::vector<VertexAttributeLayout> layout;
+    int offset = 0;
+
+    if (position == POSITION_FLOAT3)
+        layout.push_back({VTX_POSITION_LOCATION, 3, GL_FLOAT, false, offset});
+    else
+        layout.push_back({VTX_POSITION_LOCATION, 3, GL_UNSIGNED_SHORT, true, offset});
+    offset += positionSize(position);
+
+    if (hasNormal) {
+        if (normal == NORMAL_FLOAT3)
+            layout.push_back({VTX_NORMAL_LOCATION, 3, GL_FLOAT, false, offset});
+        else
+            layout.push_back({VTX_NORMAL_OCT_LOCATION, 2, GL_SHORT, true, offset});
+        offset += normalSize(normal);
+    }
+
+    if (hasTangent) {
+        if (normal == NORMAL_FLOAT3)
+            layout.push_back({VTX_TANGENT_LOCATION, 3, GL_FLOAT, false, offset});
+        else
+            layout.push_back({VTX_TANGENT_OCT_LOCATION, 2, GL_SHORT, true, offset});
+        offset += normalSize(normal);
+    }
+
+    if (hasTexcoord) {
+        if (texcoord == TEXCOORD_FLOAT2)
+            layout.push_back({VTX_TEXCOORD_LOCATION, 2, GL_FLOAT, false, offset});
+        else
+            layout.push_back({VTX_TEXCOORD_LOCATION, 2, GL_HALF_FLOAT, false, offset});
+        offset += texcoordSize(texcoord);
+    }
+
+    return layout;
+}
+
+std::vector<std::string> VertexFormat::shaderDefines() const {
+    std::vector<std::string> defines;
+    if (normal == NORMAL_OCTAHEDRAL_SNORM16)
+        defines.push_back("VTX_OCTAHEDRAL_NORMALS");
+    return defines;
+}
+
+std::string VertexFormat::toString() const {
+    std::ostringstream s;
+    s << "position " << (position == POSITION_FLOAT3 ? "float3" : "unorm16");
+    if (hasNormal || hasTangent) {
+        s << (hasNormal ? ", normal" : "") << (hasTangent ? ", tangent" : "")
+          << " " << (normal == NORMAL_FLOAT3 ? "float3" : "octahedral snorm16");
+    }
+    if (hasTexcoord)
+        s << ", texcoord " << (texcoord == TEXCOORD_FLOAT2 ? "float2" : "half2");
+    s << " (" << stride() << " bytes/vertex)";
+    return s.str();
+}
+
+VertexFormat chooseVertexFormat(const VertexAttributes& attribs, const VertexFormatTolerance& tolerance) {
+    // the encodings of the attributes are independent, so the smallest format
+    // uses the smallest encoding of each attribute that is precise enough
+    VertexFormat format;
+    if (positionsFit(attribs, tolerance))
+        format.position = POSITION_UNORM16;
+    if (normalsFit(attribs, tolerance))
+        format.normal = NORMAL_OCTAHEDRAL_SNORM16;
+    if (texcoordsFit(attribs, tolerance))
+        format.texcoord = TEXCOORD_HALF2;
+    return format;
+}
+
+std::vector<unsigned char> encodeVertices(const VertexFormat& format, const VertexAttributes& attribs,
+                                          size_t numVertices, Matrix4x4* positionDecode) {
+    const std::vector<Vector3Df>& positions = *attribs.positions;
+
+    PositionRange range = computePositionRange(positions, numVertices);
+    if (format.position == POSITION_UNORM16) {
+        // unorm16 attributes reach the shader in [0,1]^3
+        *positionDecode = Matrix4x4::translation(Vector3D(range.min.x, range.min.y, range.min.z)) *
+                          Matrix4x4::scaling(Vector3D(range.extent.x, range.extent.y, range.extent.z));
+    } else {
+        *positionDecode = Matrix4x4::identity();
+    }
+
+    int stride = format.stride();
+    std::vector<unsigned char> buffer(numVertices * stride, 0);
+
+    for (size_t i = 0; i < numVertices; i++) {
+        unsigned char* vertex = &buffer[i * stride];
+
+        if (format.position == POSITION_FLOAT3) {
+            memcpy(vertex, &positions[i], sizeof(Vector3Df));
+        } else {
+            uint16_t q[4] = {quantizeUnorm16(positions[i].x, range.min.x, range.extent.x),
+                             quantizeUnorm16(positions[i].y, range.min.y, range.extent.y),
+                             quantizeUnorm16(positions[i].z, range.min.z, range.extent.z), 0};
+            memcpy(vertex, q, sizeof(q));
+        }
+        vertex += positionSize(format.position);
+
+        const std::vector<Vector3Df>* directions[2] = {attribs.normals, attribs.tangents};
+        bool present[2] = {format.hasNormal, format.hasTangent};
+        for (int d = 0; d < 2; d++) {
+            if (!present[d])
+                continue;
+            const Vector3Df& direction = (*directions[d])[i];
+            if (format.normal == NORMAL_FLOAT3) {
+                memcpy(vertex, &direction, sizeof(Vector3Df));
+            } else {
+                int16_t q[2];
+                encodeOctahedral(direction, q);
+                memcpy(vertex, q, sizeof(q));
+            }
+            vertex += normalSize(format.normal);
+        }
+
+        if (format.hasTexcoord) {
+            const Vector2Df& texcoord = (*attribs.texcoords)[i];
+            if (format.texcoord == TEXCOORD_FLOAT2) {
+                memcpy(vertex, &texcoord, sizeof(Vector2Df));
+            } else {
+                uint16_t q[2] = {floatToHalf(texcoord.x), floatToHalf(texcoord.y)};
+                memcpy(vertex, q, sizeof(q));
+            }
+        }
+    }
+
+    return buffer;
+}
+
+std::vector<GLuint> indexVertices(const VertexFormat& format, std::vector<unsigned char>* vertices) {
+
+    int stride = format.stride();
+    size_t numVertices = vertices->size() / stride;
+
+    // vertices are compared by their encoded bytes, so vertices that only differ by less than
+    // the precision of the format are merged too
+    std::unordered_map<std::string, GLuint> uniqueVertices;
+    std::vector<GLuint> indices(numVertices);
+    GLuint numUnique = 0;
+    for (size_t i = 0; i < numVertices; i++) {
+        unsigned char* vertex = vertices->data() + i * stride;
+        auto inserted = uniqueVertices.insert(std::make_pair(std::string((const char*)vertex, stride), numUnique));
+        if (inserted.second) {
+            // unique vertices move to the front, in order, so they never overwrite unread ones
+            memmove(vertices->data() + numUnique * stride, vertex, stride);
+            numUnique++;
+        }
+        indices[i] = inserted.first->second;
+    }
+
+    vertices->resize(numUnique * stride);
+    return indices;
+}
+
+}  // namespace DynamicScene
+}  // namespace CS248
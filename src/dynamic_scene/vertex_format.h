@@ -0,0 +1,116 @@
+#ifndef CS248_DYNAMICSCENE_VERTEX_FORMAT_H
+#define CS248_DYNAMICSCENE_VERTEX_FORMAT_H
+
+#include <string>
+#include <vector>
+
+#include "CS248/CS248.h"
+#include "CS248/matrix4x4.h"
+
+#include "GL/glew.h"
+
+#include "../gl_resource_manager.h"
+
+namespace CS248 {
+namespace DynamicScene {
+
+
+// We need to define new vector structs for fp32 fields. In other words, using floats, not doubles.
+// Note that in the CS248 starter codebase the Vector2D/3D types have fields that are doubles.
+struct Vector2Df {
+    float x, y;
+};
+
+struct Vector3Df {
+    float x, y, z;
+};
+
+// Encodings of the per-vertex attributes of a mesh. The first value of each enum stores the
+// attribute as 32-bit floats; the others are smaller, lossy encodings.
+enum PositionEncoding {
+    POSITION_FLOAT3,                // 12 bytes
+    POSITION_UNORM16,               //  8 bytes, 16 bits per axis relative to the mesh bounding box
+};
+
+// used for both the normal and the tangent
+enum NormalEncoding {
+    NORMAL_FLOAT3,                  // 12 bytes
+    NORMAL_OCTAHEDRAL_SNORM16,      //  4 bytes, octahedral-encoded in 2x16 bits
+    NUM_NORMAL_ENCODINGS
+};
+
+enum TexcoordEncoding {
+    TEXCOORD_FLOAT2,                //  8 bytes
+    TEXCOORD_HALF2,                 //  4 bytes
+};
+
+// Largest error each lossy encoding may introduce for it to be used
+struct VertexFormatTolerance {
+    float position = 1e-4f;         // relative to the diagonal of the mesh bounding box
+    float normalDegrees = 0.1f;     // angle between the original and the decoded normal or tangent
+    float texcoord = 1.f / 2048;    // absolute, in texture space
+};
+
+// The full precision per-vertex data of a mesh. Arrays of streams that are not
+// stored in the vertex buffer may be empty.
+struct VertexAttributes {
+    const std::vector<Vector3Df>* positions;
+    const std::vector<Vector3Df>* normals;
+    const std::vector<Vector2Df>* texcoords;
+    const std::vector<Vector3Df>* tangents;
+};
+
+/**
+ * The layout of the interleaved (array of structures) vertex buffer of a mesh.
+ * All attributes of a vertex are stored next to each other, in the order position,
+ * normal, tangent, texcoord (the geometry arena then moves the positions to a buffer of
+ * their own, see GeometryArena). Material colors are not per-vertex data, see Mesh::Submesh.
+ */
+struct VertexFormat {
+    PositionEncoding position = POSITION_FLOAT3;
+    NormalEncoding   normal   = NORMAL_FLOAT3;
+    TexcoordEncoding texcoord = TEXCOORD_FLOAT2;
+
+    // streams stored in the vertex buffer besides the position. Streams the shaders do not
+    // read are left out; the corresponding shader inputs then read as zero.
+    bool hasNormal   = true;
+    bool hasTangent  = true;
+    bool hasTexcoord = true;
+
+    // the format storing every attribute as floats (44 bytes per vertex)
+    static VertexFormat full() { return VertexFormat(); }
+    // the format using the smallest encoding of every attribute (20 bytes per vertex)
+    static VertexFormat compact();
+
+    // bytes per vertex
+    int stride() const;
+    // bytes of the position, at the start of the vertex
+    int positionStride() const;
+
+    // layout of each attribute (see VertexAttributeLayout in gl_resource_manager.h)
+    std::vector<VertexAttributeLayout> attributes() const;
+
+    // preprocessor symbols the vertex shaders need to decode the format
+    std::vector<std::string> shaderDefines() const;
+
+    std::string toString() const;
+};
+
+// Returns the smallest format whose encoding of `attribs` stays within `tolerance`. The arrays
+// only need to contain each distinct value once (e.g. the indexed data of a mesh).
+VertexFormat chooseVertexFormat(const VertexAttributes& attribs, const VertexFormatTolerance& tolerance);
+
+// Encodes the streams of `attribs` present in the format into an interleaved vertex buffer of
+// `numVertices` vertices. Quantized positions must be mapped back to object space by the
+// matrix returned in `positionDecode`.
+std::vector<unsigned char> encodeVertices(const VertexFormat& format, const VertexAttributes& attribs,
+                                          size_t numVertices, Matrix4x4* positionDecode);
+
+// Merges the identical vertices of an encoded vertex buffer, keeping the first copy of each, and
+// returns the index of each original vertex in the merged buffer (see encodeVertices).
+std::vector<GLuint> indexVertices(const VertexFormat& format, std::vector<unsigned char>* vertices);
+
+}  // namespace DynamicScene
+}  // namespace CS248
+
+#endif  // CS248_DYNAMICSCENE_VERTEX_FORMAT_H
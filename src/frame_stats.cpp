@@ -0,0 +1,11 @@
+#include "frame_stats.h"
+
+namespace CS248 {
+
+// static
+FrameStats& FrameStats::current() {
+  static FrameStats stats;
+  return stats;
+}
+
+}  // namespace CS248
@@ -0,0 +1,97 @@
+#ifndef CS248_FRAME_STATS_H
+#define CS248_FRAME_STATS_H
+
+namespace CS248 {
+
+/**
+ * Counters describing the amount of CPU-side GL work issued during one frame.
+ * Application::render resets the counters at the start of every frame, and the
+ * HUD displays the totals of the previous frame.
+ */
+struct FrameStats {
+
+    // glGetUniformLocation/glGetAttribLocation calls. Programs are introspected when
+    // they are linked, so this should be zero on every frame that does not (re)link a program.
+    int locationQueries = 0;
+
+    // shader parameters looked up by name in a program's location table
+    // (parameters set through a pre-resolved handle do not count)
+    int parameterNameLookups = 0;
+
+    // glUniform* calls issued, and calls skipped because the uniform already held the value
+    int uniformUploads = 0;
+    int uniformUploadsSkipped = 0;
+
+    // vertex array object binds, and vertex attribute pointers specified. Vertex arrays are
+    // set up when a mesh (or arena page) is created, so drawing should not specify any attribute pointer.
+    int vertexArrayBinds = 0;
+    int vertexAttribPointerCalls = 0;
+
+    // glBind*/glUseProgram/glActiveTexture calls issued by GLResourceManager, and binds it
+    // skipped because the object was already bound
+    int bindsIssued = 0;
+    int bindsElided = 0;
+
+    // draw calls issued, and the objects they drew (more than the draw calls when objects
+    // are drawn as instances of each other)
+    int drawCalls = 0;
+    int instancesDrawn = 0;
+
+    // objects found visible and culled by the CPU frustum test in each pass: the camera pass,
+    // then one per shadowed light (objects culled on the GPU are not counted)
+    static const int kMaxCullingPasses = 25;
+    int objectsVisible[kMaxCullingPasses] = {};
+    int objectsCulled[kMaxCullingPasses] = {};
+
+    // nodes of the scene's object tree visited by the CPU culling of all passes (see AABBTree)
+    int cullingNodesVisited = 0;
+
+    // groups of the scene whose world transform was recomputed (see TransformHierarchy): the
+    // groups moved, and the groups in them
+    int transformNodesUpdated = 0;
+
+    // chunks of the transform uniform buffer uploaded. Only the chunks of objects whose
+    // transform changed are uploaded, so this is zero on frames where nothing moves.
+    int transformChunksUploaded = 0;
+
+    // shadow passes rendered, and skipped because neither their light nor any object in its
+    // frustum moved (see Scene::renderShadowPass). Passes rendered on top of a cached map of the
+    // static objects also count the static maps they rendered again.
+    int shadowPassesRendered = 0;
+    int shadowPassesSkipped = 0;
+    int staticShadowMapsRendered = 0;
+
+    // passes over the scene that drew several shadow maps at once (see Scene::setLayeredShadows)
+    int layeredShadowPasses = 0;
+
+    // shadow maps given a new tile of the shadow atlas (see Scene::updateShadowAtlas), which
+    // are rendered again
+    int shadowTilesMoved = 0;
+
+    // compute shader dispatches (see GpuCuller). Objects culled on the GPU are drawn by indirect
+    // multi-draws, which count as one draw call each but whose instances and vertices are not
+    // known to the CPU, and the commands the multi-draws drew.
+    int computeDispatches = 0;
+    int indirectCommandsDrawn = 0;
+
+    // vertices drawn (indices of indexed draws), and the bytes of vertex and index data the
+    // drawn meshes occupy (see VertexFormat)
+    int verticesDrawn = 0;
+    long long vertexBytesFetched = 0;
+
+    // glGetError calls issued by checkGLError. They make the CPU wait for the GL, and are only
+    // issued when validation is enabled without KHR_debug support (see gl_utils.h).
+    int glErrorQueries = 0;
+
+    // CPU time spent in Application::render issuing the frame (not waiting for the GPU)
+    double cpuRenderMilliseconds = 0.;
+
+    void reset() { *this = FrameStats(); }
+
+    // the counters of the frame currently being rendered
+    static FrameStats& current();
+};
+
+}  // namespace CS248
+
+#endif  // CS248_FRAME_STATS_H
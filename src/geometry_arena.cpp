@@ -0,0 +1,189 @@
+#include "geometry_arena.h"
+
+#include <algorithm>
+
+#include "gl_utils.h"
+#include "shader.h"
+
+namespace CS248 {
+
+namespace {
+
+// the default size of a page: small scenes fit in one page, larger ones need a few
+const int kPageVertices = 1 << 18;
+const int kPageIndices = 1 << 20;
+
+// the base instance attribute advances once every this many instances, i.e. never in practice
+const GLuint kBaseInstanceDivisor = 1u << 30;
+
+}  // namespace
+
+RangeAllocator::RangeAllocator(int capacity) {
+  if (capacity > 0)
+    freeRanges_[0] = capacity;
+}
+
+int RangeAllocator::allocate(int size) {
+  for (auto range = freeRanges_.begin(); range != freeRanges_.end(); ++range) {
+    if (range->second < size)
+      continue;
+    int offset = range->first;
+    int remaining = range->second - size;
+    freeRanges_.erase(range);
+    if (remaining > 0)
+      freeRanges_[offset + size] = remaining;
+    return offset;
+  }
+  return -1;
+}
+
+void RangeAllocator::free(int offset, int size) {
+  if (size <= 0)
+    return;
+
+  // merge with the free range that follows, then with the one that precedes
+  auto next = freeRanges_.find(offset + size);
+  if (next != freeRanges_.end()) {
+    size += next->second;
+    freeRanges_.erase(next);
+  }
+  auto range = freeRanges_.insert(std::make_pair(offset, size)).first;
+  if (range != freeRanges_.begin()) {
+    auto previous = std::prev(range);
+    if (previous->first + previous->second == offset) {
+      previous->second += size;
+      freeRanges_.erase(range);
+    }
+  }
+}
+
+GeometryArena::GeometryArena(int stride, int positionStride, const std::vector<VertexAttributeLayout>& attributes,
+                             const std::string& label)
+    : stride_(stride), positionStride_(positionStride), attributes_(attributes), label_(label),
+      baseInstanceBufferId_{0}, gl_mgr_(GLResourceManager::instance()) {}
+
+GeometryArena::~GeometryArena() {
+  for (Page& page : pages_) {
+    gl_mgr_->freeVertexArray(page.vertexArrayId);
+    gl_mgr_->freeVertexArray(page.positionVertexArrayId);
+    gl_mgr_->freeVertexBuffer(page.positionBufferId);
+    if (page.vertexBufferId.id)
+      gl_mgr_->freeVertexBuffer(page.vertexBufferId);
+    gl_mgr_->freeIndexBuffer(page.indexBufferId);
+  }
+  if (baseInstanceBufferId_.id)
+    gl_mgr_->freeVertexBuffer(baseInstanceBufferId_);
+}
+
+void GeometryArena::createPage(int minVertices, int minIndices) {
+  int numVertices = std::max(kPageVertices, minVertices);
+  int numIndices = std::max(kPageIndices, minIndices);
+
+  int otherStride = stride_ - positionStride_;
+  Page page = {gl_mgr_->createVertexArray(), gl_mgr_->createVertexArray(),
+               gl_mgr_->createVertexBuffer(numVertices * positionStride_),
+               otherStride > 0 ? gl_mgr_->createVertexBuffer(numVertices * otherStride) : VertexBufferId{0},
+               gl_mgr_->createIndexBuffer(numIndices * sizeof(GLuint)),
+               RangeAllocator(numVertices), RangeAllocator(numIndices)};
+
+  if (GLEW_VERSION_4_3 && !baseInstanceBufferId_.id) {
+    std::vector<GLint> baseInstances(GEOMETRY_ARENA_MAX_BASE_INSTANCE);
+    for (int i = 0; i < GEOMETRY_ARENA_MAX_BASE_INSTANCE; i++)
+      baseInstances[i] = i;
+    baseInstanceBufferId_ = gl_mgr_->createVertexBufferFromBytes(baseInstances.data(), baseInstances.size() * sizeof(GLint));
+    labelGLObject(GL_BUFFER, baseInstanceBufferId_.id, label_ + " base instances");
+  }
+
+  // record the layout and the buffers of the page in its vertex arrays, so that drawing only binds
+  // one. The position is the attribute at offset 0, the others are offset past it.
+  {
+    auto vertex_array_bind = gl_mgr_->bindVertexArray(page.vertexArrayId);
+    for (const VertexAttributeLayout& attrib : attributes_) {
+      if (attrib.offset < positionStride_) {
+        gl_mgr_->setVertexBuffer(attrib.location, attrib.components, attrib.type, attrib.normalized,
+                                 positionStride_, attrib.offset, page.positionBufferId);
+      } else {
+        gl_mgr_->setVertexBuffer(attrib.location, attrib.components, attrib.type, attrib.normalized,
+                                 otherStride, attrib.offset - positionStride_, page.vertexBufferId);
+      }
+    }
+    if (baseInstanceBufferId_.id)
+      gl_mgr_->setInstanceBuffer(VTX_BASE_INSTANCE_LOCATION, kBaseInstanceDivisor, baseInstanceBufferId_);
+    gl_mgr_->setIndexBuffer(page.indexBufferId);
+  }
+  {
+    auto vertex_array_bind = gl_mgr_->bindVertexArray(page.positionVertexArrayId);
+    for (const VertexAttributeLayout& attrib : attributes_) {
+      if (attrib.offset < positionStride_) {
+        gl_mgr_->setVertexBuffer(attrib.location, attrib.components, attrib.type, attrib.normalized,
+                                 positionStride_, attrib.offset, page.positionBufferId);
+      }
+    }
+    if (baseInstanceBufferId_.id)
+      gl_mgr_->setInstanceBuffer(VTX_BASE_INSTANCE_LOCATION, kBaseInstanceDivisor, baseInstanceBufferId_);
+    gl_mgr_->setIndexBuffer(page.indexBufferId);
+  }
+
+  std::string name = label_ + " page " + std::to_string(pages_.size());
+  labelGLObject(GL_VERTEX_ARRAY, page.vertexArrayId.id, name);
+  labelGLObject(GL_VERTEX_ARRAY, page.positionVertexArrayId.id, name + " positions only");
+  labelGLObject(GL_BUFFER, page.positionBufferId.id, name + " positions");
+  if (page.vertexBufferId.id)
+    labelGLObject(GL_BUFFER, page.vertexBufferId.id, name + " vertices");
+  labelGLObject(GL_BUFFER, page.indexBufferId.id, name + " indices");
+  checkGLError("after geometry arena page setup");
+
+  pages_.push_back(page);
+}
+
+GeometryArena::Allocation GeometryArena::allocate(const void* vertices, int numVertices,
+                                                  const GLuint* indices, int numIndices) {
+  Allocation allocation = {-1, -1, numVertices, -1, numIndices};
+
+  for (int p = 0; p <= (int)pages_.size() && allocation.page < 0; p++) {
+    if (p == (int)pages_.size())
+      createPage(numVertices, numIndices);
+
+    Page& page = pages_[p];
+    int baseVertex = page.vertexRanges.allocate(numVertices);
+    if (baseVertex < 0)
+      continue;
+    int firstIndex = page.indexRanges.allocate(numIndices);
+    if (firstIndex < 0) {
+      page.vertexRanges.free(baseVertex, numVertices);
+      continue;
+    }
+    allocation.page = p;
+    allocation.baseVertex = baseVertex;
+    allocation.firstIndex = firstIndex;
+  }
+
+  // split the vertices into their positions and the rest
+  int otherStride = stride_ - positionStride_;
+  std::vector<unsigned char> positions(numVertices * positionStride_);
+  std::vector<unsigned char> others(numVertices * otherStride);
+  const unsigned char* vertex = (const unsigned char*)vertices;
+  for (int i = 0; i < numVertices; i++, vertex += stride_) {
+    std::copy(vertex, vertex + positionStride_, positions.begin() + i * positionStride_);
+    std::copy(vertex + positionStride_, vertex + stride_, others.begin() + i * otherStride);
+  }
+
+  const Page& page = pages_[allocation.page];
+  gl_mgr_->updateVertexBuffer(page.positionBufferId, positions.data(), numVertices * positionStride_,
+                              allocation.baseVertex * positionStride_);
+  if (otherStride > 0) {
+    gl_mgr_->updateVertexBuffer(page.vertexBufferId, others.data(), numVertices * otherStride,
+                                allocation.baseVertex * otherStride);
+  }
+  gl_mgr_->updateIndexBuffer(page.indexBufferId, indices, numIndices * sizeof(GLuint),
+                             allocation.firstIndex * sizeof(GLuint));
+  return allocation;
+}
+
+void GeometryArena::free(const Allocation& allocation) {
+  Page& page = pages_[allocation.page];
+  page.vertexRanges.free(allocation.baseVertex, allocation.numVertices);
+  page.indexRanges.free(allocation.firstIndex, allocation.numIndices);
+}
+
+}  // namespace CS248
@@ -0,0 +1,100 @@
+#ifndef CS248_GEOMETRY_ARENA_H
+#define CS248_GEOMETRY_ARENA_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "GL/glew.h"
+
+#include "gl_resource_manager.h"
+
+#define GEOMETRY_ARENA_MAX_BASE_INSTANCE 256
+
+namespace CS248 {
+
+// First-fit allocator of ranges of [0, capacity). The free ranges are kept sorted by offset, and a
+// freed range is merged with the free ranges next to it, so the free list stays short.
+class RangeAllocator {
+ public:
+  explicit RangeAllocator(int capacity);
+
+  // Returns the offset of `size` free units, or -1 if no free range is large enough.
+  int allocate(int size);
+  void free(int offset, int size);
+
+ private:
+  std::map<int, int> freeRanges_;   // offset -> size
+};
+
+/**
+ * Vertex and index data of many meshes with the same vertex layout, suballocated from a few
+ * large buffers. Each page of the arena is a vertex buffer and an index buffer, recorded with the
+ * layout in one vertex array object. Meshes of the same page are drawn by binding that vertex
+ * array and offsetting their draws by their base vertex and first index, instead of binding
+ * buffers of their own.
+ *
+ * The positions are stored in a buffer of their own rather than interleaved with the other
+ * attributes, and each page has a second vertex array reading only them: passes that only need
+ * the positions (the shadow passes) then fetch nothing else.
+ *
+ * Where the GL has indirect draws (GL 4.3), both vertex arrays also have the "vtx_base_instance"
+ * attribute, which is the base instance of the draw for all its vertices and instances. GLSL 4.30
+ * has no gl_BaseInstance, so this is how each draw of a multi-draw finds its parameters (see
+ * Mesh::drawIndirect). Draws using it have a base instance below GEOMETRY_ARENA_MAX_BASE_INSTANCE.
+ */
+class GeometryArena {
+ public:
+  // Vertices are `stride` bytes, with the given attributes, starting with a position of
+  // `positionStride` bytes. `label` names the GL objects of the arena in debug output.
+  GeometryArena(int stride, int positionStride, const std::vector<VertexAttributeLayout>& attributes,
+                const std::string& label);
+  ~GeometryArena();
+
+  // The vertices and indices of one mesh within a page
+  struct Allocation {
+    int page;
+    int baseVertex;   // added to every index by glDrawElementsBaseVertex
+    int numVertices;
+    int firstIndex;
+    int numIndices;
+  };
+
+  // Copies the (interleaved) vertices and the indices (relative to the first vertex) into the
+  // first page with room for them, creating a new page if no page has enough.
+  Allocation allocate(const void* vertices, int numVertices, const GLuint* indices, int numIndices);
+  void free(const Allocation& allocation);
+
+  VertexArrayId getVertexArrayId(int page) const { return pages_[page].vertexArrayId; }
+  // the vertex array of the page reading the positions only
+  VertexArrayId getPositionVertexArrayId(int page) const { return pages_[page].positionVertexArrayId; }
+  int getStride() const { return stride_; }
+  int getPositionStride() const { return positionStride_; }
+
+ private:
+  struct Page {
+    VertexArrayId  vertexArrayId;
+    VertexArrayId  positionVertexArrayId;
+    VertexBufferId positionBufferId;
+    VertexBufferId vertexBufferId;   // the other attributes (none if the vertices are positions only)
+    IndexBufferId  indexBufferId;
+    RangeAllocator vertexRanges;
+    RangeAllocator indexRanges;
+  };
+
+  // Adds a page holding at least the given number of vertices and indices
+  void createPage(int minVertices, int minIndices);
+
+  int stride_;
+  int positionStride_;
+  std::vector<VertexAttributeLayout> attributes_;
+  std::string label_;
+  std::vector<Page> pages_;
+  // the integers 0 to GEOMETRY_ARENA_MAX_BASE_INSTANCE - 1, read by the base instance attribute
+  VertexBufferId baseInstanceBufferId_;
+  GLResourceManager* gl_mgr_;
+};
+
+}  // namespace CS248
+
+#endif  // CS248_GEOMETRY_ARENA_H
@@ -3,65 +3,14 @@
 #include <iostream>
 #include "GL/glew.h"
 
+#include "frame_stats.h"
+
 namespace CS248 {
 namespace {
 
 using std::cerr;
 using std::endl;
 
-class FrameBufferCleanup : public Cleanup {
- public:
-  FrameBufferCleanup(FrameBufferId fbid) {
-  	glBindFramebuffer(GL_FRAMEBUFFER, fbid.id);
-  }
-  ~FrameBufferCleanup() {
-  	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-  }
-};
-
-class TextureCleanup : public Cleanup {
- public:
-  template<typename TextureTypeId>
-  TextureCleanup(GLenum texture_type, TextureTypeId texid) : texture_type_(texture_type) {
-  	glBindTexture(texture_type_, texid.id);
-  }
-  ~TextureCleanup() {
-  	glBindTexture(texture_type_, 0);
-  }
- private:
-  GLenum texture_type_;
-};
-
-class VertexArrayCleanup : public Cleanup {
- public:
-  VertexArrayCleanup(VertexArrayId vaid) {
-    glBindVertexArray(vaid.id);
-  }
-  ~VertexArrayCleanup() {
-    glBindVertexArray(0);
-  }
-};
-
-class VertexBufferCleanup : public Cleanup {
- public:
-  VertexBufferCleanup(VertexBufferId vbid) {
-    glBindBuffer(GL_ARRAY_BUFFER, vbid.id);
-  }
-  ~VertexBufferCleanup() {
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-  }
-};
-
-class ProgramCleanup : public Cleanup {
- public:
-  ProgramCleanup(ProgramId pid) {
-    glUseProgram(pid.id);
-  }
-  ~ProgramCleanup() {
-    glUseProgram(0);
-  }
-};
-
 bool createShaderOfType(const char* source, GLenum shaderType, ShaderId* out_sid) {
   ShaderId sid{glCreateShader(shaderType)};
   glShaderSource(sid.id, /*count=*/1, &source, /*length=*/NULL);
@@ -99,28 +48,138 @@ GLResourceManager* GLResourceManager::instance() {
   return singleton;
 }
 
-std::unique_ptr<Cleanup> GLResourceManager::bindFrameBuffer(FrameBufferId fbid) {
-  return std::unique_ptr<Cleanup>{ new FrameBufferCleanup(fbid) };
+GLResourceManager::GLResourceManager() {}
+
+ScopedBinding::~ScopedBinding() {
+  if (mgr_)
+    mgr_->restoreBinding(target_, unit_, previous_);
+}
+
+ScopedBinding GLResourceManager::bindFrameBuffer(FrameBufferId fbid) {
+  return bind(internal::FRAME_BUFFER_BINDING, 0, fbid.id);
+}
+
+ScopedBinding GLResourceManager::bindTexture(TextureId texid) {
+  return bind(internal::TEXTURE_2D_BINDING, 0, texid.id);
+}
+
+ScopedBinding GLResourceManager::bindTextureArray(TextureArrayId texaid) {
+  return bind(internal::TEXTURE_2D_ARRAY_BINDING, 0, texaid.id);
+}
+
+ScopedBinding GLResourceManager::bindVertexArray(VertexArrayId vaid) {
+  FrameStats::current().vertexArrayBinds++;
+  return bind(internal::VERTEX_ARRAY_BINDING, 0, vaid.id);
+}
+
+ScopedBinding GLResourceManager::bindVertexBuffer(VertexBufferId vbid) {
+  return bind(internal::ARRAY_BUFFER_BINDING, 0, vbid.id);
+}
+
+ScopedBinding GLResourceManager::bindUniformBuffer(UniformBufferId ubid) {
+  return bind(internal::UNIFORM_BUFFER_BINDING, 0, ubid.id);
+}
+
+ScopedBinding GLResourceManager::bindProgram(ProgramId pid) {
+  return bind(internal::PROGRAM_BINDING, 0, pid.id);
+}
+
+GLResourceManager::Binding& GLResourceManager::binding(internal::BindingTarget target, int unit) {
+  switch (target) {
+    case internal::PROGRAM_BINDING:          return program_;
+    case internal::FRAME_BUFFER_BINDING:     return frameBuffer_;
+    case internal::VERTEX_ARRAY_BINDING:     return vertexArray_;
+    case internal::ARRAY_BUFFER_BINDING:     return arrayBuffer_;
+    case internal::UNIFORM_BUFFER_BINDING:   return uniformBuffer_;
+    case internal::TEXTURE_2D_BINDING:       return textures_[unit];
+    case internal::TEXTURE_2D_ARRAY_BINDING: return textureArrays_[unit];
+  }
+  return program_;
+}
+
+ScopedBinding GLResourceManager::bind(internal::BindingTarget target, int unit, GLuint id) {
+  Binding& b = binding(target, unit);
+  GLuint previous = b.scoped;
+  b.scoped = id;
+  setBound(target, unit, id);
+  return ScopedBinding(this, target, unit, previous);
 }
 
-std::unique_ptr<Cleanup> GLResourceManager::bindTexture(TextureId texid) {
-  return std::unique_ptr<Cleanup>{ new TextureCleanup(GL_TEXTURE_2D, texid) };
+void GLResourceManager::restoreBinding(internal::BindingTarget target, int unit, GLuint previous) {
+  binding(target, unit).scoped = previous;
+  // leave the object bound when the surrounding scope does not need anything bound (see header)
+  if (previous != 0 || target == internal::FRAME_BUFFER_BINDING)
+    setBound(target, unit, previous);
 }
 
-std::unique_ptr<Cleanup> GLResourceManager::bindTextureArray(TextureArrayId texaid) {
-  return std::unique_ptr<Cleanup>{ new TextureCleanup(GL_TEXTURE_2D_ARRAY, texaid) };
+void GLResourceManager::setBound(internal::BindingTarget target, int unit, GLuint id) {
+  Binding& b = binding(target, unit);
+  if (b.bound == id) {
+    FrameStats::current().bindsElided++;
+    return;
+  }
+
+  switch (target) {
+    case internal::PROGRAM_BINDING:        glUseProgram(id); break;
+    case internal::FRAME_BUFFER_BINDING:   glBindFramebuffer(GL_FRAMEBUFFER, id); break;
+    case internal::VERTEX_ARRAY_BINDING:   glBindVertexArray(id); break;
+    case internal::ARRAY_BUFFER_BINDING:   glBindBuffer(GL_ARRAY_BUFFER, id); break;
+    case internal::UNIFORM_BUFFER_BINDING: glBindBuffer(GL_UNIFORM_BUFFER, id); break;
+    case internal::TEXTURE_2D_BINDING:
+      setActiveTextureUnit(unit);
+      glBindTexture(GL_TEXTURE_2D, id);
+      break;
+    case internal::TEXTURE_2D_ARRAY_BINDING:
+      setActiveTextureUnit(unit);
+      glBindTexture(GL_TEXTURE_2D_ARRAY, id);
+      break;
+  }
+  b.bound = id;
+  FrameStats::current().bindsIssued++;
 }
 
-std::unique_ptr<Cleanup> GLResourceManager::bindVertexArray(VertexArrayId vaid) {
-  return std::unique_ptr<Cleanup>{ new VertexArrayCleanup(vaid) };
+void GLResourceManager::setActiveTextureUnit(int unit) {
+  if (activeTextureUnit_ == (GLuint)unit) {
+    FrameStats::current().bindsElided++;
+    return;
+  }
+  glActiveTexture(GL_TEXTURE0 + unit);
+  activeTextureUnit_ = unit;
+  FrameStats::current().bindsIssued++;
 }
 
-std::unique_ptr<Cleanup> GLResourceManager::bindVertexBuffer(VertexBufferId vbid) {
-  return std::unique_ptr<Cleanup>{ new VertexBufferCleanup(vbid) };
+void GLResourceManager::invalidateBindings() {
+  Binding* bindings[] = {&program_, &frameBuffer_, &vertexArray_, &arrayBuffer_, &uniformBuffer_};
+  for (Binding* b : bindings)
+    b->bound = kUnknownBinding;
+  for (int i = 0; i < kMaxTrackedTextureUnits; i++) {
+    textures_[i].bound = kUnknownBinding;
+    textureArrays_[i].bound = kUnknownBinding;
+  }
+  activeTextureUnit_ = kUnknownBinding;
+  for (int i = 0; i < kMaxTrackedUniformBufferBindings; i++)
+    uniformBufferBindings_[i].buffer = kUnknownBinding;
+  for (int i = 0; i < kMaxTrackedStorageBufferBindings; i++)
+    storageBufferBindings_[i].buffer = kUnknownBinding;
+  drawIndirectBuffer_ = kUnknownBinding;
 }
 
-std::unique_ptr<Cleanup> GLResourceManager::bindProgram(ProgramId pid) {
-  return std::unique_ptr<Cleanup>{ new ProgramCleanup(pid) };
+void GLResourceManager::forgetBinding(internal::BindingTarget target, GLuint id) {
+  if (target == internal::TEXTURE_2D_BINDING || target == internal::TEXTURE_2D_ARRAY_BINDING) {
+    for (int i = 0; i < kMaxTrackedTextureUnits; i++) {
+      if (binding(target, i).bound == id)
+        binding(target, i).bound = kUnknownBinding;
+    }
+    return;
+  }
+  if (binding(target, 0).bound == id)
+    binding(target, 0).bound = kUnknownBinding;
+  if (target == internal::UNIFORM_BUFFER_BINDING) {
+    for (int i = 0; i < kMaxTrackedUniformBufferBindings; i++) {
+      if (uniformBufferBindings_[i].buffer == id)
+        uniformBufferBindings_[i].buffer = kUnknownBinding;
+    }
+  }
 }
 
 ProgramId GLResourceManager::createProgram() {
@@ -143,6 +202,22 @@ bool GLResourceManager::createFragmentShader(const char* source_code, ShaderId*
   return success;
 }
 
+bool GLResourceManager::createGeometryShader(const char* source_code, ShaderId* out_sid) {
+  bool success = createShaderOfType(source_code, GL_GEOMETRY_SHADER, out_sid);
+  if (!success) {
+    cerr << "Above Errors are for geometry shader" << endl;
+  }
+  return success;
+}
+
+bool GLResourceManager::createComputeShader(const char* source_code, ShaderId* out_sid) {
+  bool success = createShaderOfType(source_code, GL_COMPUTE_SHADER, out_sid);
+  if (!success) {
+    cerr << "Above Errors are for compute shader" << endl;
+  }
+  return success;
+}
+
 bool GLResourceManager::attachShadersAndLinkProgram(ProgramId pid, const std::vector<ShaderId>& sids) {
   for (const auto& sid : sids) {
     glAttachShader(pid.id, sid.id);
@@ -190,14 +265,87 @@ VertexArrayId GLResourceManager::createVertexArray() {
 }
 
 VertexBufferId GLResourceManager::createVertexBufferFromData(const float* data, int num) {
+  return createVertexBufferFromBytes(data, sizeof(float) * num);
+}
+
+VertexBufferId GLResourceManager::createVertexBufferFromBytes(const void* data, int size) {
   GLuint id;
   glGenBuffers(1, &id);
   VertexBufferId vbid{id};
   auto buffer_bind = bindVertexBuffer(vbid);
-  glBufferData(GL_ARRAY_BUFFER, sizeof(float) * num, (const void*) data, GL_STATIC_DRAW);
+  glBufferData(GL_ARRAY_BUFFER, size, data, GL_STATIC_DRAW);
   return vbid;
 }
 
+VertexBufferId GLResourceManager::createVertexBuffer(int size) {
+  return createVertexBufferFromBytes(/*data=*/NULL, size);
+}
+
+void GLResourceManager::updateVertexBuffer(VertexBufferId vbid, const void* data, int size, int offset) {
+  auto buffer_bind = bindVertexBuffer(vbid);
+  glBufferSubData(GL_ARRAY_BUFFER, offset, size, data);
+}
+
+// GL buffers are not typed. Index data is uploaded through the array buffer binding, since the
+// element array buffer binding belongs to the bound vertex array.
+IndexBufferId GLResourceManager::createIndexBuffer(int size) {
+  GLuint id;
+  glGenBuffers(1, &id);
+  auto buffer_bind = bind(internal::ARRAY_BUFFER_BINDING, 0, id);
+  glBufferData(GL_ARRAY_BUFFER, size, /*data=*/NULL, GL_STATIC_DRAW);
+  return {id};
+}
+
+void GLResourceManager::updateIndexBuffer(IndexBufferId ibid, const void* data, int size, int offset) {
+  auto buffer_bind = bind(internal::ARRAY_BUFFER_BINDING, 0, ibid.id);
+  glBufferSubData(GL_ARRAY_BUFFER, offset, size, data);
+}
+
+UniformBufferId GLResourceManager::createUniformBuffer(int size) {
+  GLuint id;
+  glGenBuffers(1, &id);
+  UniformBufferId ubid{id};
+  auto buffer_bind = bindUniformBuffer(ubid);
+  glBufferData(GL_UNIFORM_BUFFER, size, /*data=*/NULL, GL_DYNAMIC_DRAW);
+  return ubid;
+}
+
+void GLResourceManager::updateUniformBuffer(UniformBufferId ubid, const void* data, int size, int offset) {
+  auto buffer_bind = bindUniformBuffer(ubid);
+  glBufferSubData(GL_UNIFORM_BUFFER, offset, size, data);
+}
+
+int GLResourceManager::getUniformBufferOffsetAlignment() {
+  GLint alignment;
+  glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+  return alignment;
+}
+
+// Storage buffers are filled through the array buffer binding, like index buffers
+StorageBufferId GLResourceManager::createStorageBuffer(const void* data, int size) {
+  GLuint id;
+  glGenBuffers(1, &id);
+  auto buffer_bind = bind(internal::ARRAY_BUFFER_BINDING, 0, id);
+  glBufferData(GL_ARRAY_BUFFER, size, data, GL_DYNAMIC_DRAW);
+  return {id};
+}
+
+void GLResourceManager::updateStorageBuffer(StorageBufferId sbid, const void* data, int size, int offset) {
+  auto buffer_bind = bind(internal::ARRAY_BUFFER_BINDING, 0, sbid.id);
+  glBufferSubData(GL_ARRAY_BUFFER, offset, size, data);
+}
+
+void GLResourceManager::clearStorageBuffer(StorageBufferId sbid, int offset, int size) {
+  auto buffer_bind = bind(internal::ARRAY_BUFFER_BINDING, 0, sbid.id);
+  glClearBufferSubData(GL_ARRAY_BUFFER, GL_R32UI, offset, size, GL_RED_INTEGER, GL_UNSIGNED_INT, /*data=*/NULL);
+}
+
+int GLResourceManager::getStorageBufferOffsetAlignment() {
+  GLint alignment;
+  glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+  return alignment;
+}
+
 TextureId GLResourceManager::createTextureFromData(const unsigned char* data, int width, int height) {
   TextureId texid = createTexture();
   auto tex_bind = bindTexture(texid);
@@ -229,6 +377,13 @@ TextureId GLResourceManager::createDepthTextureFromFrameBuffer(FrameBufferId fbi
 }
 
 std::pair<TextureArrayId, TextureArrayId> GLResourceManager::createDepthAndColorTextureArrayFromFrameBuffers(const FrameBufferId* fbids, int num, int texture_size) {
+  TextureArrayId depth_id = createDepthTextureArray(num, texture_size);
+  TextureArrayId color_id = createColorTextureArray(num, texture_size);
+  attachTextureArrayLayers(fbids, num, depth_id, color_id);
+  return std::make_pair(depth_id, color_id);
+}
+
+TextureArrayId GLResourceManager::createDepthTextureArray(int num, int texture_size) {
   // Texture Array is just one texture
   TextureArrayId depth_id{createTexture().id};
   {
@@ -240,6 +395,10 @@ std::pair<TextureArrayId, TextureArrayId> GLResourceManager::createDepthAndColor
     glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE); 
   }
+  return depth_id;
+}
+
+TextureArrayId GLResourceManager::createColorTextureArray(int num, int texture_size) {
   TextureArrayId color_id{createTexture().id};
   {
     auto tex_bind = bindTextureArray(color_id);
@@ -250,12 +409,31 @@ std::pair<TextureArrayId, TextureArrayId> GLResourceManager::createDepthAndColor
     glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE); 
   }
+  return color_id;
+}
+
+void GLResourceManager::attachTextureArrayLayers(const FrameBufferId* fbids, int num, TextureArrayId depth_id, TextureArrayId color_id) {
+  // texture 0 detaches the color image
+  GLenum colorBuffer = color_id.id ? GL_COLOR_ATTACHMENT0 : GL_NONE;
   for (int i = 0; i < num; ++i) {
     auto fb_bind = bindFrameBuffer(fbids[i]);
     glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depth_id.id, /*level=*/0, /*layer=*/i);
     glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, color_id.id, /*level=*/0, /*layer=*/i);
+    glDrawBuffer(colorBuffer);
+    glReadBuffer(colorBuffer);
   }
-  return std::make_pair(depth_id, color_id);
+}
+
+void GLResourceManager::copyFrameBuffer(FrameBufferId src, FrameBufferId dst, int x, int y, int width, int height) {
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, src.id);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, dst.id);
+  // (the color bit is ignored if the frame buffers read and draw no color)
+  glBlitFramebuffer(x, y, x + width, y + height, x, y, x + width, y + height,
+                    GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT, GL_NEAREST);
+  FrameStats::current().bindsIssued += 2;
+  // the read and draw frame buffers now differ, so the frame buffer of the surrounding scope is bound again
+  frameBuffer_.bound = kUnknownBinding;
+  setBound(internal::FRAME_BUFFER_BINDING, 0, frameBuffer_.scoped);
 }
 
 
@@ -310,52 +488,48 @@ bool GLResourceManager::checkFrameBuffer(FrameBufferId fbid) {
   return true;
 }
 
-bool GLResourceManager::setTextureSampler(ProgramId pid, const std::string& paramName, TextureId texid, int textureUnit) {
-    bool success = true;
-    int textureLoc = glGetUniformLocation(pid.id, paramName.c_str());
-    GLenum glTextureUnitEnum = GL_TEXTURE0 + textureUnit;
-    if (textureLoc >= 0) {
-        // bind the texture object given by texid to the pipeline.
-        glActiveTexture(glTextureUnitEnum);
-        // Cannot unbind this texture as it will point the active unit to an invalid texture
-        glBindTexture(GL_TEXTURE_2D, texid.id);
-        // make sure the shader knows with texture unit is providing data for the corresponding
-        // shader sampler variable
-        glUniform1i(textureLoc, textureUnit);
-    } else {
-        success = false;
-    }
-    return success;
+void GLResourceManager::bindTextureToUnit(TextureId texid, int textureUnit) {
+  // bind the texture object given by texid to the pipeline.
+  // Cannot unbind this texture as it will point the active unit to an invalid texture
+  if (textureUnit >= kMaxTrackedTextureUnits) {
+    glActiveTexture(GL_TEXTURE0 + textureUnit);
+    activeTextureUnit_ = textureUnit;
+    glBindTexture(GL_TEXTURE_2D, texid.id);
+    return;
+  }
+  textures_[textureUnit].scoped = texid.id;
+  setBound(internal::TEXTURE_2D_BINDING, textureUnit, texid.id);
 }
 
-bool GLResourceManager::setTextureArraySampler(ProgramId pid, const std::string& paramName, TextureArrayId texaid, int textureUnit) {
-  bool success = true;
-  int textureLoc = glGetUniformLocation(pid.id, paramName.c_str());
-  GLenum glTextureUnitEnum = GL_TEXTURE0 + textureUnit;
-  if (textureLoc >= 0) {
-      // bind the texture object given by texid to the pipeline.
-      glActiveTexture(glTextureUnitEnum);
-      // Cannot unbind this texture as it will point the active unit to an invalid texture id 0.
-      glBindTexture(GL_TEXTURE_2D_ARRAY, texaid.id);
-      // make sure the shader knows with texture unit is providing data for the corresponding
-      // shader sampler variable
-      glUniform1i(textureLoc, textureUnit);
-  } else {
-      success = false;
+void GLResourceManager::bindTextureArrayToUnit(TextureArrayId texaid, int textureUnit) {
+  // bind the texture object given by texid to the pipeline.
+  // Cannot unbind this texture as it will point the active unit to an invalid texture id 0.
+  if (textureUnit >= kMaxTrackedTextureUnits) {
+    glActiveTexture(GL_TEXTURE0 + textureUnit);
+    activeTextureUnit_ = textureUnit;
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texaid.id);
+    return;
   }
-  return success;
+  textureArrays_[textureUnit].scoped = texaid.id;
+  setBound(internal::TEXTURE_2D_ARRAY_BINDING, textureUnit, texaid.id);
+}
+
+bool GLResourceManager::setVertexBuffer(GLint attribLoc, int fieldsPerAttribute, VertexBufferId vbid) {
+  return setVertexBuffer(attribLoc, fieldsPerAttribute, GL_FLOAT, /*normalized=*/false, /*stride=*/0, /*offset=*/0, vbid);
 }
 
-bool GLResourceManager::setVertexBuffer(ProgramId pid, const std::string& paramName, int fieldsPerAttribute, VertexBufferId vbid) {
+bool GLResourceManager::setVertexBuffer(GLint attribLoc, int fieldsPerAttribute, GLenum type, bool normalized,
+                                        int stride, int offset, VertexBufferId vbid) {
   bool success = true;
-  int attribLoc = glGetAttribLocation(pid.id, paramName.c_str());
   if (attribLoc >= 0) {
       // make the specified vertex buffer object the active one
       auto buffer_bind = bindVertexBuffer(vbid);
       // create a vertex attribute that connects the shader's input attribute to the
       // currently active vertex buffer object
-      glVertexAttribPointer(attribLoc, /*size=*/fieldsPerAttribute, GL_FLOAT, /*normalized=*/GL_FALSE, /*stride=*/0, /*pointer=*/0);
-      glEnableVertexAttribArray(attribLoc);      
+      glVertexAttribPointer(attribLoc, /*size=*/fieldsPerAttribute, type, normalized ? GL_TRUE : GL_FALSE,
+                            stride, /*pointer=*/(const void*)(size_t)offset);
+      glEnableVertexAttribArray(attribLoc);
+      FrameStats::current().vertexAttribPointerCalls++;
   } else {
       success = false;
   }
@@ -363,13 +537,119 @@ bool GLResourceManager::setVertexBuffer(ProgramId pid, const std::string& paramN
   return success;
 }
 
+bool GLResourceManager::setInstanceBuffer(GLint attribLoc, GLuint divisor, VertexBufferId vbid) {
+  if (attribLoc < 0)
+    return false;
+  auto buffer_bind = bindVertexBuffer(vbid);
+  glVertexAttribIPointer(attribLoc, /*size=*/1, GL_INT, /*stride=*/0, /*pointer=*/NULL);
+  glVertexAttribDivisor(attribLoc, divisor);
+  glEnableVertexAttribArray(attribLoc);
+  FrameStats::current().vertexAttribPointerCalls++;
+  return true;
+}
+
+void GLResourceManager::setIndexBuffer(IndexBufferId ibid) {
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibid.id);
+}
+
+void GLResourceManager::bindUniformBufferBase(UniformBufferId ubid, GLuint bindingPoint) {
+  bindIndexedUniformBuffer(ubid, bindingPoint, 0, -1);
+}
+
+void GLResourceManager::bindUniformBufferRange(UniformBufferId ubid, GLuint bindingPoint, int offset, int size) {
+  bindIndexedUniformBuffer(ubid, bindingPoint, offset, size);
+}
+
+bool GLResourceManager::sameIndexedBinding(IndexedBufferBinding* b, GLuint buffer, int offset, int size) {
+  if (b->buffer == buffer && b->offset == offset && b->size == size) {
+    FrameStats::current().bindsElided++;
+    return true;
+  }
+  b->buffer = buffer;
+  b->offset = offset;
+  b->size = size;
+  return false;
+}
+
+void GLResourceManager::bindIndexedUniformBuffer(UniformBufferId ubid, GLuint bindingPoint, int offset, int size) {
+  if (bindingPoint < kMaxTrackedUniformBufferBindings &&
+      sameIndexedBinding(&uniformBufferBindings_[bindingPoint], ubid.id, offset, size))
+    return;
+
+  if (size < 0)
+    glBindBufferBase(GL_UNIFORM_BUFFER, bindingPoint, ubid.id);
+  else
+    glBindBufferRange(GL_UNIFORM_BUFFER, bindingPoint, ubid.id, offset, size);
+  // binding an indexed target also binds the generic GL_UNIFORM_BUFFER target
+  uniformBuffer_.bound = ubid.id;
+  FrameStats::current().bindsIssued++;
+}
+
+void GLResourceManager::bindStorageBufferRange(StorageBufferId sbid, GLuint bindingPoint, int offset, int size) {
+  if (bindingPoint < kMaxTrackedStorageBufferBindings &&
+      sameIndexedBinding(&storageBufferBindings_[bindingPoint], sbid.id, offset, size))
+    return;
 
-void GLResourceManager::freeFrameBuffer(FrameBufferId fbid) { glDeleteFramebuffers(1, &fbid.id); }
-void GLResourceManager::freeVertexArray(VertexArrayId vaid) { glDeleteVertexArrays(1, &vaid.id); }
-void GLResourceManager::freeVertexBuffer(VertexBufferId vbid) { glDeleteBuffers(1, &vbid.id); }
-void GLResourceManager::freeTexture(TextureId texid) { glDeleteTextures(1, &texid.id); }
-void GLResourceManager::freeTextureArray(TextureArrayId texaid) { glDeleteTextures(1, &texaid.id); }
+  glBindBufferRange(GL_SHADER_STORAGE_BUFFER, bindingPoint, sbid.id, offset, size);
+  FrameStats::current().bindsIssued++;
+}
+
+void GLResourceManager::setDrawIndirectBuffer(StorageBufferId sbid) {
+  if (drawIndirectBuffer_ == sbid.id) {
+    FrameStats::current().bindsElided++;
+    return;
+  }
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, sbid.id);
+  drawIndirectBuffer_ = sbid.id;
+  FrameStats::current().bindsIssued++;
+}
+
+void GLResourceManager::freeFrameBuffer(FrameBufferId fbid) {
+  glDeleteFramebuffers(1, &fbid.id);
+  forgetBinding(internal::FRAME_BUFFER_BINDING, fbid.id);
+}
+void GLResourceManager::freeVertexArray(VertexArrayId vaid) {
+  glDeleteVertexArrays(1, &vaid.id);
+  forgetBinding(internal::VERTEX_ARRAY_BINDING, vaid.id);
+}
+void GLResourceManager::freeVertexBuffer(VertexBufferId vbid) {
+  glDeleteBuffers(1, &vbid.id);
+  // vertex and uniform buffers share names
+  forgetBinding(internal::ARRAY_BUFFER_BINDING, vbid.id);
+  forgetBinding(internal::UNIFORM_BUFFER_BINDING, vbid.id);
+}
+void GLResourceManager::freeIndexBuffer(IndexBufferId ibid) {
+  glDeleteBuffers(1, &ibid.id);
+  forgetBinding(internal::ARRAY_BUFFER_BINDING, ibid.id);
+  forgetBinding(internal::UNIFORM_BUFFER_BINDING, ibid.id);
+}
+void GLResourceManager::freeUniformBuffer(UniformBufferId ubid) {
+  glDeleteBuffers(1, &ubid.id);
+  forgetBinding(internal::ARRAY_BUFFER_BINDING, ubid.id);
+  forgetBinding(internal::UNIFORM_BUFFER_BINDING, ubid.id);
+}
+void GLResourceManager::freeStorageBuffer(StorageBufferId sbid) {
+  glDeleteBuffers(1, &sbid.id);
+  forgetBinding(internal::ARRAY_BUFFER_BINDING, sbid.id);
+  for (int i = 0; i < kMaxTrackedStorageBufferBindings; i++) {
+    if (storageBufferBindings_[i].buffer == sbid.id)
+      storageBufferBindings_[i].buffer = kUnknownBinding;
+  }
+  if (drawIndirectBuffer_ == sbid.id)
+    drawIndirectBuffer_ = kUnknownBinding;
+}
+void GLResourceManager::freeTexture(TextureId texid) {
+  glDeleteTextures(1, &texid.id);
+  forgetBinding(internal::TEXTURE_2D_BINDING, texid.id);
+}
+void GLResourceManager::freeTextureArray(TextureArrayId texaid) {
+  glDeleteTextures(1, &texaid.id);
+  forgetBinding(internal::TEXTURE_2D_ARRAY_BINDING, texaid.id);
+}
 void GLResourceManager::freeShader(ShaderId sid) { glDeleteShader(sid.id); }
-void GLResourceManager::freeProgram(ProgramId pid) { glDeleteProgram(pid.id); } 
+void GLResourceManager::freeProgram(ProgramId pid) {
+  glDeleteProgram(pid.id);
+  forgetBinding(internal::PROGRAM_BINDING, pid.id);
+}
 
 }  // namespace CS248
\ No newline at end of file
@@ -22,6 +22,20 @@ namespace internal {
   struct ShaderTag {};
   struct VertexArrayTag {};
   struct VertexBufferTag {};
+  struct IndexBufferTag {};
+  struct UniformBufferTag {};
+  struct StorageBufferTag {};
+
+  // The GL bindings tracked by GLResourceManager
+  enum BindingTarget {
+    PROGRAM_BINDING,
+    FRAME_BUFFER_BINDING,
+    VERTEX_ARRAY_BINDING,
+    ARRAY_BUFFER_BINDING,
+    UNIFORM_BUFFER_BINDING,
+    TEXTURE_2D_BINDING,         // per texture unit
+    TEXTURE_2D_ARRAY_BINDING,   // per texture unit
+  };
 
 }  // namespace internal
 
@@ -30,13 +44,47 @@ typedef internal::GLIntId<internal::ProgramTag> ProgramId;
 typedef internal::GLIntId<internal::ShaderTag> ShaderId;
 typedef internal::GLIntId<internal::VertexArrayTag> VertexArrayId;
 typedef internal::GLIntId<internal::VertexBufferTag> VertexBufferId;
+typedef internal::GLIntId<internal::IndexBufferTag> IndexBufferId;
+typedef internal::GLIntId<internal::UniformBufferTag> UniformBufferId;
+typedef internal::GLIntId<internal::StorageBufferTag> StorageBufferId;
 typedef internal::GLIntId<internal::TextureTag> TextureId;
 typedef internal::GLIntId<internal::TextureArrayTag> TextureArrayId;
 typedef internal::GLIntId<internal::FrameBufferTag> FrameBufferId;
 
-class Cleanup {
+// Location, type and placement within an interleaved vertex of one vertex attribute
+struct VertexAttributeLayout {
+  GLuint location;                // see VertexAttributeLocation in shader.h
+  int    components;
+  GLenum type;
+  bool   normalized;
+  int    offset;                  // in bytes
+};
+
+class GLResourceManager;
+
+// Returned by the GLResourceManager::bind* methods. When it goes out of scope, the binding that
+// was current when it was created is restored. It lives on the stack: it can be moved (e.g. returned
+// from a function) but not copied.
+class ScopedBinding {
  public:
-  virtual ~Cleanup() {}
+  ScopedBinding(ScopedBinding&& other)
+      : mgr_(other.mgr_), target_(other.target_), unit_(other.unit_), previous_(other.previous_) {
+    other.mgr_ = nullptr;
+  }
+  ~ScopedBinding();
+
+  ScopedBinding(const ScopedBinding&) = delete;
+  ScopedBinding& operator=(const ScopedBinding&) = delete;
+
+ private:
+  friend class GLResourceManager;
+  ScopedBinding(GLResourceManager* mgr, internal::BindingTarget target, int unit, GLuint previous)
+      : mgr_(mgr), target_(target), unit_(unit), previous_(previous) {}
+
+  GLResourceManager* mgr_;
+  internal::BindingTarget target_;
+  int unit_;
+  GLuint previous_;
 };
 
 // GLResourceManager is not thread-safe.
@@ -56,17 +104,54 @@ class GLResourceManager {
   // If unsuccessful, will print to stderr and out_sid will not be modified and function will return false.
   bool createVertexShader(const char* source_code, ShaderId* out_sid);
   bool createFragmentShader(const char* source_code, ShaderId* out_sid);
+  bool createGeometryShader(const char* source_code, ShaderId* out_sid);
+  // Needs GL 4.3 (see GpuCuller::isSupported).
+  bool createComputeShader(const char* source_code, ShaderId* out_sid);
 
   FrameBufferId createFrameBuffer();
   VertexArrayId createVertexArray();
   // Creates a vertex buffer by copying the given data buffer with `num` floats.
   VertexBufferId createVertexBufferFromData(const float* data, int num);
+  // Creates a vertex buffer by copying `size` bytes of arbitrary vertex data.
+  VertexBufferId createVertexBufferFromBytes(const void* data, int size);
+  // Creates a vertex buffer of `size` bytes with undefined contents, filled with updateVertexBuffer.
+  VertexBufferId createVertexBuffer(int size);
+  // Replaces `size` bytes of the vertex buffer, starting `offset` bytes into it.
+  void updateVertexBuffer(VertexBufferId vbid, const void* data, int size, int offset = 0);
+  // Same as the two above, for a buffer of vertex indices (see setIndexBuffer).
+  IndexBufferId createIndexBuffer(int size);
+  void updateIndexBuffer(IndexBufferId ibid, const void* data, int size, int offset = 0);
+  // Creates a uniform buffer of `size` bytes with undefined contents, meant to be updated every frame.
+  UniformBufferId createUniformBuffer(int size);
+  // Replaces `size` bytes of the uniform buffer, starting `offset` bytes into it.
+  void updateUniformBuffer(UniformBufferId ubid, const void* data, int size, int offset = 0);
+  // Alignment (in bytes) required for the offset of bindUniformBufferRange.
+  int getUniformBufferOffsetAlignment();
+  // Shader storage buffers are written by the GPU (compute shaders) and may also be the source of
+  // indirect draw commands. They need GL 4.3. The buffer has `size` bytes, initialized from `data`
+  // if it is not NULL.
+  StorageBufferId createStorageBuffer(const void* data, int size);
+  void updateStorageBuffer(StorageBufferId sbid, const void* data, int size, int offset = 0);
+  // Sets every 32-bit word of the `size` bytes starting at `offset` to zero.
+  void clearStorageBuffer(StorageBufferId sbid, int offset, int size);
+  // Alignment (in bytes) required for the offset of bindStorageBufferRange.
+  int getStorageBufferOffsetAlignment();
   // Creates a texture2D by copying the given data buffer of type unsigned char
   TextureId createTextureFromData(const unsigned char* data, int width, int height);
   // Create two Texture2D arrays from an array of `num` frame buffers.
   // The first texture array contains the depth images for each of the frame buffers.
   // The second texture array contains the color images for each of the frame buffers.
   std::pair<TextureArrayId, TextureArrayId> createDepthAndColorTextureArrayFromFrameBuffers(const FrameBufferId* fbids, int num, int texture_size);
+  // Create a Texture2D array of `num` depth (or color) images, `texture_size` square.
+  TextureArrayId createDepthTextureArray(int num, int texture_size);
+  TextureArrayId createColorTextureArray(int num, int texture_size);
+  // Attaches layer i of the texture arrays to frame buffer fbids[i]. Without a color array
+  // (color_id 0) the frame buffers only have a depth image, and draw and read no color.
+  void attachTextureArrayLayers(const FrameBufferId* fbids, int num, TextureArrayId depth_id, TextureArrayId color_id);
+  // Copies a rectangle of the depth and color images of frame buffer `src` to the same place in
+  // `dst` (e.g. to draw on top of a cached image); only depth if they have no color. The frame
+  // buffer bound is left as it was.
+  void copyFrameBuffer(FrameBufferId src, FrameBufferId dst, int x, int y, int width, int height);
 
   // Attach shaders to the program and link the program.
   // Shaders need to have successfully compiled.
@@ -79,14 +164,38 @@ class GLResourceManager {
   bool checkFrameBuffer(FrameBufferId fbid);
 
   // Methods to associate variables in the shader program to the allocated resources.
-  bool setTextureSampler(ProgramId pid, const std::string& paramName, TextureId texid, int textureUnit);
-  bool setTextureArraySampler(ProgramId pid, const std::string& paramName, TextureArrayId texaid, int textureUnit);
-  // Needs to have a valid VertexArray bound in current context.
-  bool setVertexBuffer(ProgramId pid, const std::string& paramName, int fieldsPerAttribute, VertexBufferId vbid);
+  // Binds the texture to the given texture unit. The sampler uniform of the shader program
+  // must be set to the unit separately (see Shader::setTextureSampler).
+  void bindTextureToUnit(TextureId texid, int textureUnit);
+  void bindTextureArrayToUnit(TextureArrayId texaid, int textureUnit);
+  // Variables are identified by their attribute location (see VertexAttributeLocation in shader.h,
+  // or Shader, which resolves the locations once when the program is linked).
+  // A negative location means the program does not use the variable and the function returns false.
+  // Needs to have a valid VertexArray bound in current context, which records the buffer.
+  bool setVertexBuffer(GLint attribLoc, int fieldsPerAttribute, VertexBufferId vbid);
+  // Same as above, for an attribute of the given component type stored `offset` bytes into every
+  // `stride`-byte vertex of an interleaved buffer. Normalized integer types are mapped to [0,1] or [-1,1].
+  bool setVertexBuffer(GLint attribLoc, int fieldsPerAttribute, GLenum type, bool normalized,
+                       int stride, int offset, VertexBufferId vbid);
+  // Same as above, for an integer attribute read from a buffer of GLints once every `divisor`
+  // instances, starting at the base instance of the draw (see glVertexAttribDivisor, GL 3.3).
+  bool setInstanceBuffer(GLint attribLoc, GLuint divisor, VertexBufferId vbid);
+  // Makes the index buffer the source of the indices of glDrawElements* calls.
+  // Needs to have a valid VertexArray bound in current context, which records the buffer.
+  void setIndexBuffer(IndexBufferId ibid);
+  // Makes the uniform buffer the source of the uniform blocks assigned to `bindingPoint`
+  // (see UniformBlockBinding in shader.h). The binding is global, not per program.
+  void bindUniformBufferBase(UniformBufferId ubid, GLuint bindingPoint);
+  // Same as above, but only the `size` bytes starting at `offset` are visible to the uniform blocks.
+  // `offset` must be a multiple of getUniformBufferOffsetAlignment().
+  void bindUniformBufferRange(UniformBufferId ubid, GLuint bindingPoint, int offset, int size);
+  // Same as above, for the storage blocks assigned to `bindingPoint` (see StorageBlockBinding in shader.h).
+  void bindStorageBufferRange(StorageBufferId sbid, GLuint bindingPoint, int offset, int size);
+  // Makes the storage buffer the source of the commands of glDraw*Indirect calls.
+  void setDrawIndirectBuffer(StorageBufferId sbid);
 
   // Methods to bind a resource to the current GL context.
-  // They all return a clean-up object that, upon going out of scope, will release the binding to the default.
-  // Caveat: nested scoping of the same resource does not revert back to the surrounding scope:
+  // They all return a ScopedBinding that, upon going out of scope, reverts to the surrounding scope:
   // {
   // 	// GLResourceManager* mgr;
   // 	// FrameBufferId fb1, fb2;
@@ -96,29 +205,83 @@ class GLResourceManager {
   // 	  auto c2 = mgr->bindFrameBuffer(fb2);
   // 	  // Do work on current framebuffer, which is fb2
   // 	}
-  // 	// Framebuffer binding is now reversed to default, which is 0, not fb1!
+  // 	// Framebuffer binding is now fb1 again
   // }
-  std::unique_ptr<Cleanup> bindProgram(ProgramId pid);
-  std::unique_ptr<Cleanup> bindFrameBuffer(FrameBufferId fbid);
-  std::unique_ptr<Cleanup> bindVertexArray(VertexArrayId vaid);
+  // The manager remembers what is bound, and skips binding an object that already is. Reverting to
+  // the default program, vertex array, buffer or texture (0) is deferred: the object stays bound
+  // until another one is needed, so that drawing the same object again does not bind it again.
+  // Frame buffers are always reverted, since they decide where draws go.
+  ScopedBinding bindProgram(ProgramId pid);
+  ScopedBinding bindFrameBuffer(FrameBufferId fbid);
+  ScopedBinding bindVertexArray(VertexArrayId vaid);
+
+  // Forgets what is bound, so that the next bind of every object is issued. Must be called after
+  // code that changes GL bindings without going through the manager (e.g. the on-screen text).
+  void invalidateBindings();
 
   // Methods to free the allocated resource
   void freeFrameBuffer(FrameBufferId fbid);
   void freeVertexArray(VertexArrayId vaid);
   void freeVertexBuffer(VertexBufferId vbid);
+  void freeIndexBuffer(IndexBufferId ibid);
+  void freeUniformBuffer(UniformBufferId ubid);
+  void freeStorageBuffer(StorageBufferId sbid);
   void freeTexture(TextureId texid);
   void freeTextureArray(TextureArrayId texaid);
   void freeShader(ShaderId sid);
   void freeProgram(ProgramId pid);
 
  private:
-  GLResourceManager() {}
+  friend class ScopedBinding;
+
+  GLResourceManager();
   TextureId createTexture();
   TextureId createDepthTextureFromFrameBuffer(FrameBufferId fbid, int texture_size);
   TextureId createColorTextureFromFrameBuffer(FrameBufferId fbid, int texture_size);
-  std::unique_ptr<Cleanup> bindTexture(TextureId texid);
-  std::unique_ptr<Cleanup> bindTextureArray(TextureArrayId texaid);
-  std::unique_ptr<Cleanup> bindVertexBuffer(VertexBufferId vbid);
+  ScopedBinding bindTexture(TextureId texid);
+  ScopedBinding bindTextureArray(TextureArrayId texaid);
+  ScopedBinding bindVertexBuffer(VertexBufferId vbid);
+  ScopedBinding bindUniformBuffer(UniformBufferId ubid);
+
+  // State tracking. `scoped` is the object the innermost ScopedBinding (or bindTexture*ToUnit)
+  // asked for, `bound` the object actually bound in GL, or kUnknownBinding.
+  static const GLuint kUnknownBinding = ~0u;
+  static const int kMaxTrackedTextureUnits = 16;
+  static const int kMaxTrackedUniformBufferBindings = 16;
+  static const int kMaxTrackedStorageBufferBindings = 8;
+
+  struct Binding {
+    GLuint scoped = 0;
+    GLuint bound = kUnknownBinding;
+  };
+  struct IndexedBufferBinding {
+    GLuint buffer = kUnknownBinding;
+    int offset = 0;
+    int size = 0;   // -1 for the whole buffer (glBindBufferBase)
+  };
+
+  Binding& binding(internal::BindingTarget target, int unit);
+  ScopedBinding bind(internal::BindingTarget target, int unit, GLuint id);
+  void restoreBinding(internal::BindingTarget target, int unit, GLuint previous);
+  void setBound(internal::BindingTarget target, int unit, GLuint id);
+  void setActiveTextureUnit(int unit);
+  void bindIndexedUniformBuffer(UniformBufferId ubid, GLuint bindingPoint, int offset, int size);
+  // true if `b` already holds the range, otherwise records it in `b`
+  static bool sameIndexedBinding(IndexedBufferBinding* b, GLuint buffer, int offset, int size);
+  // marks the bindings of a deleted object unknown, since GL may reuse its name
+  void forgetBinding(internal::BindingTarget target, GLuint id);
+
+  Binding program_;
+  Binding frameBuffer_;
+  Binding vertexArray_;
+  Binding arrayBuffer_;
+  Binding uniformBuffer_;
+  Binding textures_[kMaxTrackedTextureUnits];
+  Binding textureArrays_[kMaxTrackedTextureUnits];
+  GLuint activeTextureUnit_ = kUnknownBinding;
+  IndexedBufferBinding uniformBufferBindings_[kMaxTrackedUniformBufferBindings];
+  IndexedBufferBinding storageBufferBindings_[kMaxTrackedStorageBufferBindings];
+  GLuint drawIndirectBuffer_ = kUnknownBinding;
 };
 	
 }  // namespace CS248
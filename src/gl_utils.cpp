@@ -1,25 +1,95 @@
 #include "gl_utils.h"
 
+#include <cstdlib>
 #include <iostream>
-#include "GL/glew.h"
+
+#include "frame_stats.h"
 
 namespace CS248 {
 
 namespace {
   using std::cerr;
 	using std::endl;
+
+  bool validationEnabled = false;
+  bool debugOutputAvailable = false;
+
+  // last checkGLError message, and whether the callback reported an error since then
+  std::string checkpoint = "(start)";
+  bool errorSinceCheckpoint = false;
+
+  const char* debugTypeName(GLenum type) {
+    switch (type) {
+      case GL_DEBUG_TYPE_ERROR:               return "error";
+      case GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR: return "deprecated behavior";
+      case GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR:  return "undefined behavior";
+      case GL_DEBUG_TYPE_PORTABILITY:         return "portability";
+      case GL_DEBUG_TYPE_PERFORMANCE:         return "performance";
+      default:                                return "message";
+    }
+  }
+
+  void GLAPIENTRY debugMessageCallback(GLenum /*source*/, GLenum type, GLuint /*id*/, GLenum /*severity*/,
+                                       GLsizei /*length*/, const GLchar* message, const void* /*userParam*/) {
+    if (type == GL_DEBUG_TYPE_ERROR)
+      errorSinceCheckpoint = true;
+    cerr << "*** GL " << debugTypeName(type) << " after " << checkpoint << " : " << message << endl;
+  }
 }  // namespace
 
+void setGLValidationEnabled(bool enabled) {
+#ifdef CS248_GL_VALIDATION
+  validationEnabled = enabled;
+#else
+  if (enabled)
+    cerr << "Warning: GL validation is not compiled in (see the BUILD_GL_VALIDATION cmake option)" << endl;
+#endif
+}
+
+bool isGLValidationEnabled() {
+  return validationEnabled;
+}
+
+void initGLValidation() {
+  if (!validationEnabled)
+    return;
+
+  debugOutputAvailable = GLEW_KHR_debug || GLEW_VERSION_4_3;
+  if (!debugOutputAvailable) {
+    printf("GL validation: KHR_debug is not supported, polling glGetError\n");
+    return;
+  }
+
+  // synchronous output, so that messages are reported from within the offending call
+  glEnable(GL_DEBUG_OUTPUT);
+  glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+  glDebugMessageCallback(debugMessageCallback, NULL);
+  glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DEBUG_SEVERITY_NOTIFICATION, 0, NULL, GL_FALSE);
+  printf("GL validation: using KHR_debug messages\n");
+}
+
 void checkGLError(const std::string& str, bool abort_program_if_error) {
-  GLenum err;
+  if (!validationEnabled)
+    return;
+
   bool has_error = false;
-  do {
-    err = glGetError();
-    if (err != GL_NO_ERROR) {
-       cerr << "*** GL error:" << str << " : " << gluErrorString(err) << endl;
-       has_error = true;
-	  }
-  } while (err != GL_NO_ERROR);
+  if (debugOutputAvailable) {
+    // errors were already reported by the callback
+    has_error = errorSinceCheckpoint;
+  } else {
+    GLenum err;
+    do {
+      err = glGetError();
+      FrameStats::current().glErrorQueries++;
+      if (err != GL_NO_ERROR) {
+         cerr << "*** GL error:" << str << " : " << gluErrorString(err) << endl;
+         has_error = true;
+      }
+    } while (err != GL_NO_ERROR);
+  }
+  checkpoint = str;
+  errorSinceCheckpoint = false;
+
   if (has_error && abort_program_if_error) {
     exit(1);
   }
@@ -29,4 +99,18 @@ void checkGLError(const std::string& str) {
   checkGLError(str, /*abort_program_if_error=*/false);
 }
 
-}  // namespace CS248
\ No newline at end of file
+#ifdef CS248_GL_VALIDATION
+void checkGLError(const char* str) {
+  if (!validationEnabled)
+    return;
+  checkGLError(std::string(str), /*abort_program_if_error=*/false);
+}
+#endif
+
+void labelGLObject(GLenum identifier, GLuint name, const std::string& label) {
+  if (!validationEnabled || !debugOutputAvailable)
+    return;
+  glObjectLabel(identifier, name, label.size(), label.c_str());
+}
+
+}  // namespace CS248
@@ -3,11 +3,36 @@
 
 #include <string>
 
+#include "GL/glew.h"
+
 namespace CS248 {
 
+// GL validation reports GL errors and driver warnings. It is compiled in when CS248_GL_VALIDATION
+// is defined (the BUILD_GL_VALIDATION cmake option) and enabled at runtime with the -v option.
+//
+// If the context supports KHR_debug, the driver reports each message through a callback as it
+// happens, along with the last checkGLError checkpoint. Otherwise checkGLError polls glGetError.
+// When validation is disabled, neither checkGLError nor labelGLObject issues any GL call, so that
+// rendering does not wait for the GL to report errors.
+
+// Must be called before the GL context is created, which is then created as a debug context.
+void setGLValidationEnabled(bool enabled);
+bool isGLValidationEnabled();
+// Installs the message callback. Must be called once the GL context is current.
+void initGLValidation();
+
+#ifdef CS248_GL_VALIDATION
+void checkGLError(const char* msg);
+#else
+inline void checkGLError(const char*) {}
+#endif
 void checkGLError(const std::string& msg, bool abort_program_if_error);
 void checkGLError(const std::string& msg);
 
+// Names a GL object (identifier is GL_PROGRAM, GL_BUFFER, GL_VERTEX_ARRAY, GL_TEXTURE,
+// GL_FRAMEBUFFER...) in validation messages and in GL debuggers.
+void labelGLObject(GLenum identifier, GLuint name, const std::string& label);
+
 }  // namespace CS248
 
 #endif  // CS248_GL_UTILS_H
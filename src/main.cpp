@@ -5,6 +5,7 @@
 #include "CS248/tinyexr.h"
 
 #include "application.h"
+#include "gl_utils.h"
 
 #include <iostream>
 
@@ -24,17 +25,28 @@ void usage(const char* binaryName) {
     printf("Usage: %s [options] <scenefile>\n", binaryName);
     printf("Program Options:\n");
     printf("  -h               Print this help message\n");
+    printf("  -v               Validate OpenGL calls (report GL errors, slower)\n");
     printf("\n");
 }
 
 int main(int argc, char** argv) {
 
-    if (1 >= argc) {
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        if (string(argv[arg]) == "-v") {
+            setGLValidationEnabled(true);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (arg >= argc) {
         usage(argv[0]);
         return 1;
     }
 
-    string sceneFilePath = argv[1];
+    string sceneFilePath = argv[arg];
     msg("Input scene file: " << sceneFilePath);
 
     // parse scene
@@ -1,9 +1,12 @@
 #include "shader.h"
 
+#include <algorithm>
+#include <cstring>
 #include <fstream>
 #include <string>
 #include <iostream>
 
+#include "frame_stats.h"
 #include "gl_utils.h"
 
 namespace CS248 {
@@ -50,12 +53,79 @@ bool readFile(const std::string& filename, std::string& contents) {
     return true;
 }
 
+// names of the shared uniform blocks, indexed by UniformBlockBinding
+const char* uniformBlockNames[NUM_UNIFORM_BLOCK_BINDINGS] = {
+    "Lights",
+    "View",
+    "Transforms",
+    "Materials",
+    "ShadowLayers",
+};
+
+// names of the shader storage blocks, indexed by StorageBlockBinding
+const char* storageBlockNames[NUM_STORAGE_BLOCK_BINDINGS] = {
+    "CullObjects",
+    "Batches",
+    "BatchCounts",
+    "VisibleObjects",
+    "Commands",
+    "CommandBatches",
+};
+
+// names of the per-vertex input attributes, indexed by VertexAttributeLocation
+const char* vertexAttributeNames[NUM_VERTEX_ATTRIBUTE_LOCATIONS] = {
+    "vtx_position",
+    "vtx_normal",
+    "vtx_texcoord",
+    "vtx_tangent",
+    "vtx_normal_oct",
+    "vtx_tangent_oct",
+    "vtx_base_instance",
+};
+
+// returns the index of the named parameter in the table, adding an entry if necessary
+template<typename Parameter>
+int addParameter(const std::string& name, std::vector<Parameter>* params, std::map<std::string, int>* index) {
+    auto result = index->find(name);
+    if (result != index->end())
+        return result->second;
+    int i = params->size();
+    params->emplace_back();
+    params->back().name = name;
+    (*index)[name] = i;
+    return i;
+}
+
 }  // namespace
 
 
 
-Shader::Shader(std::string vertex_shader_filename, std::string fragment_shader_filename)
-    : vertexShaderFilename_(vertex_shader_filename), fragmentShaderFilename_(fragment_shader_filename) {
+Shader::Shader(std::string vertex_shader_filename, std::string fragment_shader_filename,
+               const std::vector<std::string>& defines)
+    : vertexShaderFilename_(vertex_shader_filename), fragmentShaderFilename_(fragment_shader_filename),
+      defines_(defines) {
+    gl_mgr_ = GLResourceManager::instance();
+    init();
+    bool success = createFullProgram();
+    if (!success && abort_if_error_during_init_) {
+      exit(1);
+    }
+}
+
+Shader::Shader(std::string vertex_shader_filename, std::string geometry_shader_filename,
+               std::string fragment_shader_filename, const std::vector<std::string>& defines)
+    : vertexShaderFilename_(vertex_shader_filename), fragmentShaderFilename_(fragment_shader_filename),
+      geometryShaderFilename_(geometry_shader_filename), defines_(defines) {
+    gl_mgr_ = GLResourceManager::instance();
+    init();
+    bool success = createFullProgram();
+    if (!success && abort_if_error_during_init_) {
+      exit(1);
+    }
+}
+
+Shader::Shader(std::string compute_shader_filename, const std::vector<std::string>& defines)
+    : computeShaderFilename_(compute_shader_filename), defines_(defines) {
     gl_mgr_ = GLResourceManager::instance();
     init();
     bool success = createFullProgram();
@@ -72,13 +142,47 @@ void Shader::init() {
     abort_if_error_during_init_ = true;
     vertexShaderId_ = ShaderId{0};
     fragmentShaderId_ = ShaderId{0};
+    geometryShaderId_ = ShaderId{0};
+    computeShaderId_ = ShaderId{0};
     programId_ = ProgramId{0};
-    paramNameToTextureUnit_.clear();
+    // forget the locations of the previous program, but keep the table entries so handles stay valid
+    for (Parameter& u : uniforms_) {
+        u.location = -1;
+        u.textureUnit = -1;
+        u.shadowSize = 0;
+        u.alias = -1;
+    }
+    for (Parameter& a : attributes_) {
+        a.location = -1;
+    }
+    activeVertexAttributes_ = 0;
+    numTextureUnits_ = 0;
 }
 
 // creates the shader program object.  This involves loading and compiling all shaders.
 bool Shader::createFullProgram() {
   programId_ = gl_mgr_->createProgram();
+
+  // a compute shader is the only shader of its program. The same source is often compiled with
+  // different defines, which the label tells apart.
+  if (!computeShaderFilename_.empty()) {
+    std::string label = computeShaderFilename_;
+    for (const std::string& define : defines_)
+      label += " " + define;
+    labelGLObject(GL_PROGRAM, programId_.id, label);
+    if (!createComputeShader(computeShaderFilename_)) {
+      cerr << computeShaderFilename_ << " failed" << endl;
+      return false;
+    }
+    if (!linkProgram()) {
+      cerr << "Failed to link " << computeShaderFilename_ << endl;
+      return false;
+    }
+    introspectProgram();
+    return true;
+  }
+
+  labelGLObject(GL_PROGRAM, programId_.id, vertexShaderFilename_ + " + " + fragmentShaderFilename_);
   bool success = true;
   // compile the vertex and fragment shader objects, and then attach them to the program object
   if (!createVertexShader(vertexShaderFilename_)) {
@@ -91,6 +195,11 @@ bool Shader::createFullProgram() {
     success = false;
   }
 
+  if (!geometryShaderFilename_.empty() && !createGeometryShader(geometryShaderFilename_)) {
+    cerr << geometryShaderFilename_ << " failed" << endl;
+    success = false;
+  }
+
 
   if (success) {
     // attach and link the compiled vertex shader with the compiled fragment shader to
@@ -101,6 +210,10 @@ bool Shader::createFullProgram() {
     }
   }
 
+  if (success) {
+    introspectProgram();
+  }
+
   return success;
 }
 
@@ -110,6 +223,8 @@ void Shader::cleanup() {
     // allocated objects, so that is why there are no "if exists" checks here. 
     gl_mgr_->freeShader(vertexShaderId_);
     gl_mgr_->freeShader(fragmentShaderId_);
+    gl_mgr_->freeShader(geometryShaderId_);
+    gl_mgr_->freeShader(computeShaderId_);
     gl_mgr_->freeProgram(programId_);
 }
 
@@ -120,6 +235,53 @@ void Shader::reload() {
     createFullProgram();
 }
 
+// static
+ShaderCache* ShaderCache::instance() {
+  // Object with static storage is never freed.
+  static ShaderCache* singleton = new ShaderCache();
+  return singleton;
+}
+
+Shader* ShaderCache::get(const std::string& vertex_shader_filename, const std::string& fragment_shader_filename,
+                         const std::vector<std::string>& defines) {
+  std::string key = vertex_shader_filename + "\n" + fragment_shader_filename;
+  for (const std::string& define : defines)
+    key += "\n" + define;
+
+  Shader*& shader = shaders_[key];
+  if (!shader)
+    shader = new Shader(vertex_shader_filename, fragment_shader_filename, defines);
+  return shader;
+}
+
+Shader* ShaderCache::get(const std::string& vertex_shader_filename, const std::string& geometry_shader_filename,
+                         const std::string& fragment_shader_filename, const std::vector<std::string>& defines) {
+  std::string key = vertex_shader_filename + "\n" + geometry_shader_filename + "\n" + fragment_shader_filename;
+  for (const std::string& define : defines)
+    key += "\n" + define;
+
+  Shader*& shader = shaders_[key];
+  if (!shader)
+    shader = new Shader(vertex_shader_filename, geometry_shader_filename, fragment_shader_filename, defines);
+  return shader;
+}
+
+Shader* ShaderCache::getCompute(const std::string& compute_shader_filename, const std::vector<std::string>& defines) {
+  std::string key = compute_shader_filename;
+  for (const std::string& define : defines)
+    key += "\n" + define;
+
+  Shader*& shader = shaders_[key];
+  if (!shader)
+    shader = new Shader(compute_shader_filename, defines);
+  return shader;
+}
+
+void ShaderCache::reloadAll() {
+  for (auto& entry : shaders_)
+    entry.second->reload();
+}
+
 
 
 bool Shader::prepareSourceCode(const std::string& filename, std::string* out_source) {
@@ -127,11 +289,18 @@ bool Shader::prepareSourceCode(const std::string& filename, std::string* out_sou
     return false;
   }
 #ifdef __APPLE__
-  std::string version = "#version 150\n";
+  std::string header = "#version 150\n";
 #else
-  std::string version = "#version 130\n";
+  std::string header = geometryShaderFilename_.empty() ? "#version 140\n" : "#version 150\n";
 #endif 
-  *out_source  = version + (*out_source);
+  // storage blocks are core in GLSL 4.30, which GPU culling (and compute shaders) need anyway
+  if (!computeShaderFilename_.empty() ||
+      std::find(defines_.begin(), defines_.end(), SHADER_GPU_CULLING_DEFINE) != defines_.end())
+    header = "#version 430\n";
+  for (const std::string& define : defines_) {
+    header += "#define " + define + "\n";
+  }
+  *out_source  = header + (*out_source);
   return true;
 }
 
@@ -161,124 +330,359 @@ bool Shader::createFragmentShader(const std::string& filename) {
   return true;
 }
 
+bool Shader::createGeometryShader(const std::string& filename) {
+  std::string contents;
+  if (!prepareSourceCode(filename, &contents)) {
+    cerr << "Failed to read " << filename << endl;
+    return false;
+  }
+  const char* source = contents.c_str();
+  if (!gl_mgr_->createGeometryShader(source, &geometryShaderId_)) {
+    return false;
+  }
+  return true;
+}
+
+bool Shader::createComputeShader(const std::string& filename) {
+  std::string contents;
+  if (!prepareSourceCode(filename, &contents)) {
+    cerr << "Failed to read " << filename << endl;
+    return false;
+  }
+  const char* source = contents.c_str();
+  if (!gl_mgr_->createComputeShader(source, &computeShaderId_)) {
+    return false;
+  }
+  return true;
+}
+
 bool Shader::linkProgram() {
+  if (!computeShaderFilename_.empty())
+    return gl_mgr_->attachShadersAndLinkProgram(programId_, {computeShaderId_});
+  // attribute locations only take effect at link time
+  for (int location = 0; location < NUM_VERTEX_ATTRIBUTE_LOCATIONS; location++) {
+    glBindAttribLocation(programId_.id, location, vertexAttributeNames[location]);
+  }
   std::vector<ShaderId> shaders = {vertexShaderId_, fragmentShaderId_};
+  if (!geometryShaderFilename_.empty())
+    shaders.push_back(geometryShaderId_);
   return gl_mgr_->attachShadersAndLinkProgram(programId_, shaders);
 }
 
-std::unique_ptr<Cleanup> Shader::bind() {
+ScopedBinding Shader::bind() {
   return gl_mgr_->bindProgram(programId_);
 }
 
-bool Shader::setScalarParameter(const std::string& paramName, int value) {
+// Fills the location tables from the active uniforms and attributes of the linked program, and
+// assigns the program's shared uniform blocks to their binding points.
+// This is the only place where locations are queried from GL.
+void Shader::introspectProgram() {
+
+    GLint numUniforms = 0;
+    GLint maxUniformNameLength = 0;
+    glGetProgramiv(programId_.id, GL_ACTIVE_UNIFORMS, &numUniforms);
+    glGetProgramiv(programId_.id, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxUniformNameLength);
+    std::vector<GLchar> name(std::max(maxUniformNameLength, 1));
+
+    for (GLint i = 0; i < numUniforms; i++) {
+        GLint size = 0;
+        GLenum type;
+        glGetActiveUniform(programId_.id, i, name.size(), /*length=*/NULL, &size, &type, name.data());
+        std::string uniformName(name.data());
+
+        // arrays of basic types are reported once as "array[0]". Add an entry for every element,
+        // and let the bare array name refer to the entry of the first element, as it refers to the
+        // same uniform in GL (so that both names share one shadow value). Names already in the
+        // table keep their entry, so that the handles resolved from them stay valid: if only the
+        // bare name has one, element 0 reuses it, and if both have their own, both get the
+        // location and are marked as aliases of each other.
+        const std::string arraySuffix = "[0]";
+        if (uniformName.size() > arraySuffix.size() &&
+            uniformName.compare(uniformName.size() - arraySuffix.size(), arraySuffix.size(), arraySuffix) == 0) {
+            std::string arrayName = uniformName.substr(0, uniformName.size() - arraySuffix.size());
+            auto bare = uniformIndex_.find(arrayName);
+            if (bare != uniformIndex_.end() && uniformIndex_.find(uniformName) == uniformIndex_.end())
+                uniformIndex_[uniformName] = bare->second;
+            for (GLint j = 0; j < size; j++) {
+                std::string elementName = arrayName + "[" + std::to_string(j) + "]";
+                int index = addParameter(elementName, &uniforms_, &uniformIndex_);
+                uniforms_[index].location = glGetUniformLocation(programId_.id, elementName.c_str());
+                FrameStats::current().locationQueries++;
+            }
+            int first = uniformIndex_[uniformName];
+            if (bare == uniformIndex_.end()) {
+                uniformIndex_[arrayName] = first;
+            } else if (bare->second != first) {
+                uniforms_[bare->second].location = uniforms_[first].location;
+                uniforms_[bare->second].alias = first;
+                uniforms_[first].alias = bare->second;
+            }
+        } else {
+            int index = addParameter(uniformName, &uniforms_, &uniformIndex_);
+            uniforms_[index].location = glGetUniformLocation(programId_.id, uniformName.c_str());
+            FrameStats::current().locationQueries++;
+        }
+    }
+
+    GLint numAttributes = 0;
+    GLint maxAttributeNameLength = 0;
+    glGetProgramiv(programId_.id, GL_ACTIVE_ATTRIBUTES, &numAttributes);
+    glGetProgramiv(programId_.id, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &maxAttributeNameLength);
+    name.resize(std::max(maxAttributeNameLength, 1));
+
+    for (GLint i = 0; i < numAttributes; i++) {
+        GLint size = 0;
+        GLenum type;
+        glGetActiveAttrib(programId_.id, i, name.size(), /*length=*/NULL, &size, &type, name.data());
+        int index = addParameter(std::string(name.data()), &attributes_, &attributeIndex_);
+        attributes_[index].location = glGetAttribLocation(programId_.id, name.data());
+        FrameStats::current().locationQueries++;
+
+        GLint location = attributes_[index].location;
+        if (location >= 0 && location < NUM_VERTEX_ATTRIBUTE_LOCATIONS) {
+            activeVertexAttributes_ |= 1u << location;
+        }
+    }
+
+    // connect the shared uniform blocks used by the program to their binding points
+    for (int binding = 0; binding < NUM_UNIFORM_BLOCK_BINDINGS; binding++) {
+        GLuint blockIndex = glGetUniformBlockIndex(programId_.id, uniformBlockNames[binding]);
+        if (blockIndex != GL_INVALID_INDEX) {
+            glUniformBlockBinding(programId_.id, blockIndex, binding);
+        }
+    }
+
+    // and the storage blocks, which only exist with GL 4.3
+    for (int binding = 0; GLEW_VERSION_4_3 && binding < NUM_STORAGE_BLOCK_BINDINGS; binding++) {
+        GLuint blockIndex = glGetProgramResourceIndex(programId_.id, GL_SHADER_STORAGE_BLOCK, storageBlockNames[binding]);
+        if (blockIndex != GL_INVALID_INDEX) {
+            glShaderStorageBlockBinding(programId_.id, blockIndex, binding);
+        }
+    }
+}
+
+UniformHandle Shader::getUniform(const std::string& paramName) {
+    UniformHandle param;
+    param.index = addParameter(paramName, &uniforms_, &uniformIndex_);
+    return param;
+}
+
+AttributeHandle Shader::getAttribute(const std::string& paramName) {
+    AttributeHandle param;
+    param.index = addParameter(paramName, &attributes_, &attributeIndex_);
+    return param;
+}
+
+UniformHandle Shader::findUniform(const std::string& name) const {
+    FrameStats::current().parameterNameLookups++;
+    UniformHandle param;
+    auto result = uniformIndex_.find(name);
+    if (result != uniformIndex_.end())
+        param.index = result->second;
+    return param;
+}
+
+AttributeHandle Shader::findAttribute(const std::string& name) const {
+    FrameStats::current().parameterNameLookups++;
+    AttributeHandle param;
+    auto result = attributeIndex_.find(name);
+    if (result != attributeIndex_.end())
+        param.index = result->second;
+    return param;
+}
+
+GLint Shader::uniformLocation(UniformHandle param) const {
+    if (param.index < 0 || param.index >= (int)uniforms_.size())
+        return -1;
+    return uniforms_[param.index].location;
+}
+
+GLint Shader::attributeLocation(AttributeHandle param) const {
+    if (param.index < 0 || param.index >= (int)attributes_.size())
+        return -1;
+    return attributes_[param.index].location;
+}
+
+// Returns true if the value differs from the one last uploaded to the uniform (in which case
+// the caller must upload it), and records it as the uniform's current value.
+bool Shader::updateShadowValue(UniformHandle param, const void* value, size_t size) {
+    Parameter& uniform = uniforms_[param.index];
+    if (uniform.shadowSize == size && memcmp(uniform.shadowValue, value, size) == 0) {
+        FrameStats::current().uniformUploadsSkipped++;
+        return false;
+    }
+    memcpy(uniform.shadowValue, value, size);
+    uniform.shadowSize = size;
+    if (uniform.alias >= 0)
+        uniforms_[uniform.alias].shadowSize = 0;
+    FrameStats::current().uniformUploads++;
+    return true;
+}
+
+bool Shader::setScalarParameter(UniformHandle param, int value) {
 
     bool success = true;
-    int uniformLocation = glGetUniformLocation(programId_.id, paramName.c_str());
+    GLint uniformLocation = this->uniformLocation(param);
 
-    if (uniformLocation >= 0)
-        glUniform1i(uniformLocation, value);
-    else
+    if (uniformLocation >= 0) {
+        if (updateShadowValue(param, &value, sizeof(value)))
+            glUniform1i(uniformLocation, value);
+    } else
         success = false;
 
     return success;
 }
 
-bool Shader::setScalarParameter(const std::string& paramName, float value) {
+bool Shader::setScalarParameter(UniformHandle param, float value) {
 
     bool success = true;
-    int uniformLocation = glGetUniformLocation(programId_.id, paramName.c_str());
+    GLint uniformLocation = this->uniformLocation(param);
 
-    if (uniformLocation >= 0)
-        glUniform1f(uniformLocation, value);
-    else
+    if (uniformLocation >= 0) {
+        if (updateShadowValue(param, &value, sizeof(value)))
+            glUniform1f(uniformLocation, value);
+    } else
         success = false;
 
     return success;
 }
 
-bool Shader::setVectorParameter(const std::string& paramName, const Vector3D& value) {
+bool Shader::setVectorParameter(UniformHandle param, const Vector3D& value) {
 
     bool success = true;
-    int uniformLocation = glGetUniformLocation(programId_.id, paramName.c_str());
+    float buf[3] = { (float)value.x, (float)value.y, (float)value.z };
+    GLint uniformLocation = this->uniformLocation(param);
 
-    if (uniformLocation >= 0)
-        glUniform3f(uniformLocation, value.x, value.y, value.z);
-    else 
+    if (uniformLocation >= 0) {
+        if (updateShadowValue(param, buf, sizeof(buf)))
+            glUniform3fv(uniformLocation, 1, buf);
+    } else 
         success = false;
 
     return success;
 }
 
-bool Shader::setVectorParameter(const std::string& paramName, const Vector4D& value) {
+bool Shader::setVectorParameter(UniformHandle param, const Vector4D& value) {
 
     bool success = true;
-    int uniformLocation = glGetUniformLocation(programId_.id, paramName.c_str());
+    float buf[4] = { (float)value.x, (float)value.y, (float)value.z, (float)value.w };
+    GLint uniformLocation = this->uniformLocation(param);
 
-    if (uniformLocation >= 0)
-        glUniform4f(uniformLocation, value.x, value.y, value.z, value.w);
-    else 
+    if (uniformLocation >= 0) {
+        if (updateShadowValue(param, buf, sizeof(buf)))
+            glUniform4fv(uniformLocation, 1, buf);
+    } else 
         success = false;
 
     return success;
 }
 
-bool Shader::setMatrixParameter(const std::string& paramName, const Matrix3x3& value) {
+bool Shader::setMatrixParameter(UniformHandle param, const Matrix3x3& value) {
 
     bool success = true;
 
     float buf[9];
     convertToGLMatrix(value, buf);
 
-    int uniformLocation = glGetUniformLocation(programId_.id, paramName.c_str());
+    GLint uniformLocation = this->uniformLocation(param);
 
-    if (uniformLocation >= 0)
-        glUniformMatrix3fv(uniformLocation, 1, GL_FALSE, buf);
-    else 
+    if (uniformLocation >= 0) {
+        if (updateShadowValue(param, buf, sizeof(buf)))
+            glUniformMatrix3fv(uniformLocation, 1, GL_FALSE, buf);
+    } else 
         success = false;
 
     return success;
 }
 
-bool Shader::setMatrixParameter(const std::string& paramName, const Matrix4x4& value) {
+bool Shader::setMatrixParameter(UniformHandle param, const Matrix4x4& value) {
 
     bool success = true;
 
     float buf[16];
     convertToGLMatrix(value, buf);
 
-    int uniformLocation = glGetUniformLocation(programId_.id, paramName.c_str());
+    GLint uniformLocation = this->uniformLocation(param);
 
-    if (uniformLocation >= 0)
-        glUniformMatrix4fv(uniformLocation, 1, GL_FALSE, buf);
-    else 
+    if (uniformLocation >= 0) {
+        if (updateShadowValue(param, buf, sizeof(buf)))
+            glUniformMatrix4fv(uniformLocation, 1, GL_FALSE, buf);
+    } else 
         success = false;
 
     return success;
 }
 
-bool Shader::setVertexBuffer(const std::string& paramName, int fieldsPerAttribute, VertexBufferId vertexBufferId) {
+bool Shader::setVertexBuffer(AttributeHandle param, int fieldsPerAttribute, VertexBufferId vertexBufferId) {
 
-    return gl_mgr_->setVertexBuffer(programId_, paramName, fieldsPerAttribute, vertexBufferId);
+    return gl_mgr_->setVertexBuffer(attributeLocation(param), fieldsPerAttribute, vertexBufferId);
 }
 
-int Shader::getTextureUnitForParam(const std::string& name) {
-  auto result = paramNameToTextureUnit_.find(name);
-  int textureUnit = -1;
-  if (result != paramNameToTextureUnit_.end()) {
-    textureUnit = result->second;
-  } else {
-    textureUnit = paramNameToTextureUnit_.size();
-    paramNameToTextureUnit_[name] = textureUnit;
+int Shader::getTextureUnitForParam(UniformHandle param) {
+  if (uniformLocation(param) < 0) {
+    return -1;
   }
-  return textureUnit;
+  Parameter& uniform = uniforms_[param.index];
+  if (uniform.textureUnit < 0) {
+    uniform.textureUnit = numTextureUnits_++;
+  }
+  return uniform.textureUnit;
+}
+
+bool Shader::setTextureSampler(UniformHandle param, TextureId textureId) {
+  int textureUnit = getTextureUnitForParam(param);
+  if (textureUnit < 0) {
+    return false;
+  }
+  gl_mgr_->bindTextureToUnit(textureId, textureUnit);
+  // make sure the shader knows with texture unit is providing data for the corresponding
+  // shader sampler variable
+  return setScalarParameter(param, textureUnit);
+}
+
+bool Shader::setTextureArraySampler(UniformHandle param, TextureArrayId textureArrayId) {
+  int textureUnit = getTextureUnitForParam(param);
+  if (textureUnit < 0) {
+    return false;
+  }
+  gl_mgr_->bindTextureArrayToUnit(textureArrayId, textureUnit);
+  return setScalarParameter(param, textureUnit);
+}
+
+bool Shader::setScalarParameter(const std::string& paramName, int value) {
+    return setScalarParameter(findUniform(paramName), value);
+}
+
+bool Shader::setScalarParameter(const std::string& paramName, float value) {
+    return setScalarParameter(findUniform(paramName), value);
+}
+
+bool Shader::setVectorParameter(const std::string& paramName, const Vector3D& value) {
+    return setVectorParameter(findUniform(paramName), value);
+}
+
+bool Shader::setVectorParameter(const std::string& paramName, const Vector4D& value) {
+    return setVectorParameter(findUniform(paramName), value);
+}
+
+bool Shader::setMatrixParameter(const std::string& paramName, const Matrix3x3& value) {
+    return setMatrixParameter(findUniform(paramName), value);
+}
+
+bool Shader::setMatrixParameter(const std::string& paramName, const Matrix4x4& value) {
+    return setMatrixParameter(findUniform(paramName), value);
+}
+
+bool Shader::setVertexBuffer(const std::string& paramName, int fieldsPerAttribute, VertexBufferId vertexBufferId) {
+    return setVertexBuffer(findAttribute(paramName), fieldsPerAttribute, vertexBufferId);
 }
 
 bool Shader::setTextureSampler(const std::string& paramName, TextureId textureId) {
-  return gl_mgr_->setTextureSampler(programId_, paramName, textureId, getTextureUnitForParam(paramName));
+  return setTextureSampler(findUniform(paramName), textureId);
 }
 
 bool Shader::setTextureArraySampler(const std::string& paramName, TextureArrayId textureArrayId) {
-    return gl_mgr_->setTextureArraySampler(programId_, paramName, textureArrayId, getTextureUnitForParam(paramName));
+    return setTextureArraySampler(findUniform(paramName), textureArrayId);
 }
 
 
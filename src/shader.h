@@ -2,6 +2,8 @@
 #define CS248_SHADER_H
 
 #include <map>
+#include <string>
+#include <vector>
 
 #include "CS248/matrix3x3.h"
 #include "CS248/matrix4x4.h"
@@ -14,6 +16,53 @@
 
 namespace CS248 {
 
+// Handles to the uniforms and vertex attributes of a shader program. A handle is resolved
+// by name once (see Shader::getUniform/getAttribute) and can then be used to set the
+// parameter without any name lookup. Handles remain valid when the shader is reloaded.
+struct UniformHandle { int index = -1; };
+struct AttributeHandle { int index = -1; };
+
+// Binding points of the uniform blocks shared by all shader programs. When a program is linked,
+// each uniform block it declares with one of the names below is assigned the matching binding
+// point, so one buffer bound there (GLResourceManager::bindUniformBufferBase) feeds every program.
+enum UniformBlockBinding {
+    LIGHTS_UNIFORM_BLOCK = 0,   // "Lights"
+    VIEW_UNIFORM_BLOCK,         // "View"
+    TRANSFORMS_UNIFORM_BLOCK,   // "Transforms"
+    MATERIALS_UNIFORM_BLOCK,    // "Materials" (each mesh binds its own palette before drawing)
+    SHADOW_LAYERS_UNIFORM_BLOCK, // "ShadowLayers" (the shadow maps of a layered shadow pass)
+    NUM_UNIFORM_BLOCK_BINDINGS
+};
+
+// Binding points of the shader storage blocks of the GPU culling pass (see GpuCuller), which
+// need GL 4.3. Programs are assigned them by block name like the uniform blocks; the compute
+// shaders declare them with layout qualifiers instead.
+// Programs compiled with SHADER_GPU_CULLING_DEFINE read them, and are compiled as GLSL 4.30.
+#define SHADER_GPU_CULLING_DEFINE "GPU_CULLING"
+enum StorageBlockBinding {
+    CULL_OBJECTS_STORAGE_BLOCK = 0, // "CullObjects"
+    BATCHES_STORAGE_BLOCK,          // "Batches"
+    BATCH_COUNTS_STORAGE_BLOCK,     // "BatchCounts"
+    VISIBLE_OBJECTS_STORAGE_BLOCK,  // "VisibleObjects" (also read by the vertex shaders)
+    COMMANDS_STORAGE_BLOCK,         // "Commands"
+    COMMAND_BATCHES_STORAGE_BLOCK,  // "CommandBatches"
+    NUM_STORAGE_BLOCK_BINDINGS
+};
+
+// Fixed locations of the per-vertex input attributes. They are bound by name before a program
+// is linked, so every program agrees on the vertex layout and a vertex array object set up once
+// (see Mesh) can be drawn with any of them.
+enum VertexAttributeLocation {
+    VTX_POSITION_LOCATION = 0,       // "vtx_position"
+    VTX_NORMAL_LOCATION,             // "vtx_normal"
+    VTX_TEXCOORD_LOCATION,           // "vtx_texcoord"
+    VTX_TANGENT_LOCATION,            // "vtx_tangent"
+    VTX_NORMAL_OCT_LOCATION,         // "vtx_normal_oct" (octahedral-encoded, see vertex_format.h)
+    VTX_TANGENT_OCT_LOCATION,        // "vtx_tangent_oct"
+    VTX_BASE_INSTANCE_LOCATION,      // "vtx_base_instance" (the base instance of the draw, see GeometryArena)
+    NUM_VERTEX_ATTRIBUTE_LOCATIONS
+};
+
 /**
  * A shader
  */
@@ -23,8 +72,19 @@ class Shader {
     // Constructor
     Shader();
 
-    // Constructor: loads and compiles the specified vertex and fragment shaders 
-    Shader(std::string vertex_shader_filename, std::string fragment_shader_filename);
+    // Constructor: loads and compiles the specified vertex and fragment shaders.
+    // Each of `defines` is #defined at the top of both shaders.
+    Shader(std::string vertex_shader_filename, std::string fragment_shader_filename,
+           const std::vector<std::string>& defines = std::vector<std::string>());
+
+    // Same as above, with a geometry shader between them. Geometry shaders need GLSL 1.50, which
+    // all three shaders are then compiled as.
+    Shader(std::string vertex_shader_filename, std::string geometry_shader_filename,
+           std::string fragment_shader_filename, const std::vector<std::string>& defines);
+
+    // Constructor: loads and compiles a compute shader, alone in its program (compute shaders
+    // need GLSL 4.30, which it is compiled as). The program is dispatched while bound.
+    Shader(std::string compute_shader_filename, const std::vector<std::string>& defines);
 
     // Destructor
     ~Shader();
@@ -32,10 +92,38 @@ class Shader {
     // reload the shaders and recompile
     void reload();
 
-    // bind the shader to the graphics pipeline (this shader will be used for subsequent draw calls until the returned cleanup goes out of scope)
-    std::unique_ptr<Cleanup> bind();
-
-    // the following are all for setting shading parameters
+    // bind the shader to the graphics pipeline (this shader will be used for subsequent draw calls until the returned binding goes out of scope)
+    ScopedBinding bind();
+
+    // resolve a handle to the named uniform or vertex attribute. Array elements are named
+    // "array[i]". The returned handle is valid even if the program does not (yet) use the parameter.
+    UniformHandle getUniform(const std::string& paramName);
+    AttributeHandle getAttribute(const std::string& paramName);
+
+    // true if the current program actually uses the parameter
+    bool isActive(UniformHandle param) const { return uniformLocation(param) >= 0; }
+    bool isActive(AttributeHandle param) const { return attributeLocation(param) >= 0; }
+
+    // the current GL program (changes when the shader is reloaded)
+    ProgramId getProgramId() const { return programId_; }
+
+    // true if the current program reads the vertex attribute at the given fixed location
+    bool usesVertexAttribute(VertexAttributeLocation location) const { return (activeVertexAttributes_ >> location) & 1; }
+
+    // the following are all for setting shading parameters.
+    // The shader keeps a copy of the last value uploaded to each uniform and skips the upload if
+    // the value did not change, so uniforms of this program must not be set with glUniform* directly.
+    bool setScalarParameter(UniformHandle param, int value);
+    bool setScalarParameter(UniformHandle param, float value);
+    bool setVectorParameter(UniformHandle param, const Vector3D& value);
+    bool setVectorParameter(UniformHandle param, const Vector4D& value);
+    bool setMatrixParameter(UniformHandle param, const Matrix3x3& value);
+    bool setMatrixParameter(UniformHandle param, const Matrix4x4& value);
+    bool setVertexBuffer(AttributeHandle param, int fieldsPerAttribute, VertexBufferId vertexBufferId);
+    bool setTextureSampler(UniformHandle param, TextureId textureId);
+    bool setTextureArraySampler(UniformHandle param, TextureArrayId textureArrayId);
+
+    // same as above, but looks up the parameter by name in the program's location table
     bool setScalarParameter(const std::string& paramName, int value);
     bool setScalarParameter(const std::string& paramName, float value);
     bool setVectorParameter(const std::string& paramName, const Vector3D& value);
@@ -54,25 +142,87 @@ class Shader {
     bool linkProgram();
     bool createVertexShader(const std::string& filename);
     bool createFragmentShader(const std::string& filename);
+    bool createGeometryShader(const std::string& filename);
+    bool createComputeShader(const std::string& filename);
     bool prepareSourceCode(const std::string& filename, std::string* out_source);
-    int getTextureUnitForParam(const std::string& name);
+    void introspectProgram();
+    UniformHandle findUniform(const std::string& name) const;
+    AttributeHandle findAttribute(const std::string& name) const;
+    GLint uniformLocation(UniformHandle param) const;
+    GLint attributeLocation(AttributeHandle param) const;
+    int getTextureUnitForParam(UniformHandle param);
+    bool updateShadowValue(UniformHandle param, const void* value, size_t size);
 
     GLResourceManager* gl_mgr_ = nullptr;
 
     // source filenames
     std::string vertexShaderFilename_;
     std::string fragmentShaderFilename_;
+    std::string geometryShaderFilename_;  // empty if there is no geometry shader
+    std::string computeShaderFilename_;   // set instead of the others for a compute shader
+
+    // preprocessor symbols defined in all shaders
+    std::vector<std::string> defines_;
 
     // IDs of the different Open GL objects associated with this shader program
     ShaderId vertexShaderId_;
     ShaderId fragmentShaderId_;
+    ShaderId geometryShaderId_;
+    ShaderId computeShaderId_;
     ProgramId programId_;
 
-    std::map<std::string, int> paramNameToTextureUnit_;
+    // location tables filled by introspecting the program after it is linked.
+    // Entries are never removed, so that handles (indices into the tables) stay valid across reloads.
+    struct Parameter {
+        std::string name;
+        GLint location = -1;
+        int textureUnit = -1;
+        // copy of the value last uploaded to the uniform (shadowSize is 0 if not known)
+        unsigned char shadowValue[16 * sizeof(float)];
+        size_t shadowSize = 0;
+        // the other entry of the same uniform, if any (see introspectProgram), whose shadow
+        // value an upload through this entry makes unknown
+        int alias = -1;
+    };
+    std::vector<Parameter> uniforms_;
+    std::vector<Parameter> attributes_;
+    // bit i is set if the attribute at VertexAttributeLocation i is active
+    unsigned int activeVertexAttributes_ = 0;
+    std::map<std::string, int> uniformIndex_;
+    std::map<std::string, int> attributeIndex_;
+    int numTextureUnits_ = 0;
 
     bool abort_if_error_during_init_ = true;
 };
 
+/**
+ * Shares one Shader between all the users of the same vertex shader, fragment shader and
+ * defines, so that objects drawn with the same shaders also draw with the same GL program
+ * (see RenderQueue). The cache owns the shaders, which live as long as the program.
+ */
+class ShaderCache {
+ public:
+    static ShaderCache* instance();
+
+    // returns the shader built from the given sources and defines, compiling it on first use
+    Shader* get(const std::string& vertex_shader_filename, const std::string& fragment_shader_filename,
+                const std::vector<std::string>& defines = std::vector<std::string>());
+    // same as above, with a geometry shader
+    Shader* get(const std::string& vertex_shader_filename, const std::string& geometry_shader_filename,
+                const std::string& fragment_shader_filename, const std::vector<std::string>& defines);
+    // returns the compute shader built from the given source and defines
+    Shader* getCompute(const std::string& compute_shader_filename, const std::vector<std::string>& defines);
+
+    // reloads every shader of the cache
+    void reloadAll();
+
+ private:
+    ShaderCache() {}
+
+    // keyed by the filenames and defines, separated by newlines
+    std::map<std::string, Shader*> shaders_;
+};
+
 }  // namespace CS248
 
 
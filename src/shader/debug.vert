@@ -1,9 +1,40 @@
-uniform mat4 mvp;                       // model-view-projection matrix
+// per-pass view parameters, uploaded by the scene at the start of every rendering pass
+#define MAX_NUM_SHADOWED_LIGHTS 24
+layout(std140) uniform View {
+    mat4 world_to_ndc;                  // world to normalized device coordinates of the current pass
+    vec3 camera_position;               // world space camera position
+    mat4 world_to_shadowlight[MAX_NUM_SHADOWED_LIGHTS];  // world to light space of each shadowed light
+};
+
+// per-object transforms, uploaded by the scene once per frame. object_index selects
+// the transforms of the object being drawn; the copies drawn by an instanced draw call
+// use the transforms that follow it (object_index + gl_InstanceID), or with GPU culling
+// the transforms listed there in visible_objects.
+#define MAX_OBJECTS_PER_TRANSFORM_CHUNK 128
+struct ObjectTransform {
+    mat4 obj2world;                     // vtx_position to world transform (includes dequantization)
+    mat3 obj2worldNorm;                 // object to world transform for normals
+};
+layout(std140) uniform Transforms {
+    ObjectTransform object_transforms[MAX_OBJECTS_PER_TRANSFORM_CHUNK];
+};
+uniform int object_index;
+#ifdef GPU_CULLING
+layout(std430) readonly buffer VisibleObjects {
+    int visible_objects[];
+};
+#define TRANSFORM_INDEX (visible_objects[object_index + gl_InstanceID])
+#else
+#define TRANSFORM_INDEX (object_index + gl_InstanceID)
+#endif
 
 // per vertex input attributes 
 in vec3 vtx_position;            // object space position
 
 void main(void)
 {
+    mat4 obj2world = object_transforms[TRANSFORM_INDEX].obj2world;
+    mat4 mvp = world_to_ndc * obj2world;
+
     gl_Position = mvp * vec4(vtx_position, 1);
 }
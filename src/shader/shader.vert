@@ -1,21 +1,62 @@
-uniform mat4 obj2world;                 // object to world transform
-uniform mat3 obj2worldNorm;             // object to world transform for normals
-uniform vec3 camera_position;           // world space camera position           
+// per-pass view parameters, uploaded by the scene at the start of every rendering pass
+#define MAX_NUM_SHADOWED_LIGHTS 24
+layout(std140) uniform View {
+    mat4 world_to_ndc;                  // world to normalized device coordinates of the current pass
+    vec3 camera_position;               // world space camera position
+    mat4 world_to_shadowlight[MAX_NUM_SHADOWED_LIGHTS];  // world to light space of each shadowed light
+};
 
-uniform mat4 mvp;                       // model-view-projection matrix
+// per-object transforms, uploaded by the scene once per frame. object_index selects
+// the transforms of the object being drawn; the copies drawn by an instanced draw call
+// use the transforms that follow it (object_index + gl_InstanceID), or with GPU culling
+// the transforms listed there in visible_objects.
+#define MAX_OBJECTS_PER_TRANSFORM_CHUNK 128
+struct ObjectTransform {
+    mat4 obj2world;                     // vtx_position to world transform (includes dequantization)
+    mat3 obj2worldNorm;                 // object to world transform for normals
+};
+layout(std140) uniform Transforms {
+    ObjectTransform object_transforms[MAX_OBJECTS_PER_TRANSFORM_CHUNK];
+};
+uniform int object_index;
+#ifdef GPU_CULLING
+layout(std430) readonly buffer VisibleObjects {
+    int visible_objects[];
+};
+#define TRANSFORM_INDEX (visible_objects[object_index + gl_InstanceID])
+// the submeshes are drawn by one multi-draw, each with the index of its material as base instance
+in int vtx_base_instance;
+flat out int material_index;
+#else
+#define TRANSFORM_INDEX (object_index + gl_InstanceID)
+#endif
 
 uniform bool useNormalMapping;         // true if normal mapping should be used
 
 // per vertex input attributes 
 in vec3 vtx_position;            // object space position
+#ifdef VTX_OCTAHEDRAL_NORMALS
+// octahedral-encoded normal and tangent (see vertex_format.cpp)
+in vec2 vtx_normal_oct;
+in vec2 vtx_tangent_oct;
+
+vec3 octDecode(vec2 e) {
+    vec3 v = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (v.z < 0.0)
+        v.xy = (1.0 - abs(v.yx)) * vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(v);
+}
+
+#define vtx_normal  octDecode(vtx_normal_oct)
+#define vtx_tangent octDecode(vtx_tangent_oct)
+#else
 in vec3 vtx_tangent;
 in vec3 vtx_normal;              // object space normal
+#endif
 in vec2 vtx_texcoord;
-in vec3 vtx_diffuse_color; 
 
 // per vertex outputs 
 out vec3 position;                  // world space position
-out vec3 vertex_diffuse_color;
 out vec2 texcoord;
 out vec3 dir2camera;                // world space vector from surface point to camera
 out vec3 normal;
@@ -23,6 +64,14 @@ out mat3 tan2world;                 // tangent space rotation matrix multiplied
 
 void main(void)
 {
+    int transform_index = TRANSFORM_INDEX;
+#ifdef GPU_CULLING
+    material_index = vtx_base_instance;
+#endif
+    mat4 obj2world = object_transforms[transform_index].obj2world;
+    mat3 obj2worldNorm = object_transforms[transform_index].obj2worldNorm;
+    mat4 mvp = world_to_ndc * obj2world;
+
     position = vec3(obj2world * vec4(vtx_position, 1));
 
     // TODO CS248 Part3: Normal Mapping
@@ -41,7 +90,6 @@ void main(void)
     
     normal = obj2worldNorm * vtx_normal;
 
-    vertex_diffuse_color = vtx_diffuse_color;
     texcoord = vtx_texcoord;
     dir2camera = camera_position - position;
     gl_Position = mvp * vec4(vtx_position, 1);
@@ -19,21 +19,26 @@ uniform sampler2D diffuseTextureSampler;
 
 //
 // lighting environment definition. Scenes may contain directional
-// and point light sources, as well as an environment map
+// and point light sources, as well as an environment map.
+// The light parameters are shared by all shader programs: the scene packs them into
+// a uniform buffer once per frame. The block layout must match the one in scene.cpp.
 //
 
-#define MAX_NUM_LIGHTS 10
-uniform int  num_directional_lights;
-uniform vec3 directional_light_vectors[MAX_NUM_LIGHTS];
+#define MAX_NUM_LIGHTS 24
+layout(std140) uniform Lights {
+    int   num_directional_lights;
+    int   num_point_lights;
+    int   num_spot_lights;
 
-uniform int  num_point_lights;
-uniform vec3 point_light_positions[MAX_NUM_LIGHTS];
+    vec3  directional_light_vectors[MAX_NUM_LIGHTS];
 
-uniform int   num_spot_lights;
-uniform vec3  spot_light_positions[MAX_NUM_LIGHTS];
-uniform vec3  spot_light_directions[MAX_NUM_LIGHTS];
-uniform vec3  spot_light_intensities[MAX_NUM_LIGHTS];
-uniform float spot_light_angles[MAX_NUM_LIGHTS];
+    vec3  point_light_positions[MAX_NUM_LIGHTS];
+
+    vec3  spot_light_positions[MAX_NUM_LIGHTS];
+    vec3  spot_light_directions[MAX_NUM_LIGHTS];
+    vec3  spot_light_intensities[MAX_NUM_LIGHTS];
+    float spot_light_angles[MAX_NUM_LIGHTS];
+};
 
 
 //
@@ -43,6 +48,18 @@ uniform float spot_light_angles[MAX_NUM_LIGHTS];
 // parameters to Phong BRDF
 uniform float spec_exp;
 
+// diffuse colors of the materials of the mesh. Each range of triangles that shares a material
+// is drawn separately, with material_index selecting its color.
+#define MAX_MESH_MATERIALS 64
+layout(std140) uniform Materials {
+    vec4 material_diffuse_colors[MAX_MESH_MATERIALS];
+};
+#ifdef GPU_CULLING
+flat in int material_index;             // from the draw of the submesh (see shader.vert)
+#else
+uniform int material_index;
+#endif
+
 // values that are varying per fragment (computed by the vertex shader)
 
 in vec3 position;     // surface position
@@ -50,7 +67,6 @@ in vec3 normal;
 in vec2 texcoord;     // surface texcoord (uv)
 in vec3 dir2camera;   // vector from surface point to camera
 in mat3 tan2world;    // tangent space to world space transform
-in vec3 vertex_diffuse_color; // surface color
 
 out vec4 fragColor;
 
@@ -127,7 +143,7 @@ void main(void)
     if (useTextureMapping) {
         diffuseColor = texture(diffuseTextureSampler, texcoord).rgb;
     } else {
-        diffuseColor = vertex_diffuse_color;
+        diffuseColor = material_diffuse_colors[material_index].rgb;
     }
 
     // perform normal map lookup if required
@@ -237,6 +253,9 @@ void main(void)
 
         // Render Shadows for all spot lights
         // TODO CS248 Part 5.2: Shadow Mapping: comute shadowing for spotlight i here 
+        // The maps of all lights are in layer 0 of the shadow texture array: the light space
+        // position of spotlight i (from world_to_shadowlight[i], which already includes the move
+        // into the light's tile of the atlas) gives the coordinates to sample at in that layer.
 
 
 	    vec3 L = normalize(-spot_light_directions[i]);
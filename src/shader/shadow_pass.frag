@@ -1,3 +1,5 @@
+#ifdef SHADOW_COLOR_MAPS
+// draws the normals into the color maps shown by the shadow map visualization
 in vec3 normal_vec; 
 out vec4 fragColor;
 void main() {
@@ -5,3 +7,8 @@ void main() {
    // gl_FragColor = vec4(1.0, 0, gl_FragCoord.z, 1.0);
    fragColor = vec4(color.x, color.y, color.z, 1.0);
 }
+#else
+// the shadow maps are depth only: there is nothing to shade
+void main() {
+}
+#endif
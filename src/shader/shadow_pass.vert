@@ -1,14 +1,81 @@
-uniform mat4 mvp;                       // ModelViewProjection Matrix
-uniform mat3 obj2worldNorm;
+// per-pass view parameters, uploaded by the scene at the start of every rendering pass
+#define MAX_NUM_SHADOWED_LIGHTS 24
+layout(std140) uniform View {
+    mat4 world_to_ndc;                  // world to normalized device coordinates of the current pass
+    vec3 camera_position;               // world space camera position
+    mat4 world_to_shadowlight[MAX_NUM_SHADOWED_LIGHTS];  // world to light space of each shadowed light
+};
+
+// per-object transforms, uploaded by the scene once per frame. object_index selects
+// the transforms of the object being drawn; the copies drawn by an instanced draw call
+// use the transforms that follow it (object_index + gl_InstanceID), or with GPU culling
+// the transforms listed there in visible_objects.
+#define MAX_OBJECTS_PER_TRANSFORM_CHUNK 128
+struct ObjectTransform {
+    mat4 obj2world;                     // vtx_position to world transform (includes dequantization)
+    mat3 obj2worldNorm;                 // object to world transform for normals
+};
+layout(std140) uniform Transforms {
+    ObjectTransform object_transforms[MAX_OBJECTS_PER_TRANSFORM_CHUNK];
+};
+uniform int object_index;
+#ifdef GPU_CULLING
+layout(std430) readonly buffer VisibleObjects {
+    int visible_objects[];
+};
+// the objects drawn with the same vertex array are drawn by one multi-draw, each with the index
+// of its first element of visible_objects as base instance (object_index is not used)
+in int vtx_base_instance;
+#define TRANSFORM_INDEX (visible_objects[vtx_base_instance + gl_InstanceID])
+#else
+#define TRANSFORM_INDEX (object_index + gl_InstanceID)
+#endif
 
 in vec3 vtx_position;            // object space position
+
+// the shadow maps only need depth: the normals are only read (and drawn into the color maps the
+// shadow map visualization shows) with SHADOW_COLOR_MAPS
+#ifdef SHADOW_COLOR_MAPS
+#ifdef VTX_OCTAHEDRAL_NORMALS
+// octahedral-encoded normal (see vertex_format.cpp)
+in vec2 vtx_normal_oct;
+
+vec3 octDecode(vec2 e) {
+    vec3 v = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (v.z < 0.0)
+        v.xy = (1.0 - abs(v.yx)) * vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(v);
+}
+
+#define vtx_normal  octDecode(vtx_normal_oct)
+#else
 in vec3 vtx_normal;
+#endif
 
+#ifdef LAYERED_SHADOWS
+// a layered pass draws every shadow map at once: the geometry shader (shadow_pass.geom) projects
+// the world space position into each of them, and passes the normal on as normal_vec
+out vec3 geom_normal_vec;
+#define normal_vec geom_normal_vec
+#else
 out vec3 normal_vec;
+#endif
+#endif
 
 void main() {
+   int transform_index = TRANSFORM_INDEX;
+   mat4 obj2world = object_transforms[transform_index].obj2world;
+
+#ifdef SHADOW_COLOR_MAPS
+   mat3 obj2worldNorm = object_transforms[transform_index].obj2worldNorm;
    normal_vec = obj2worldNorm * vtx_normal;
+#endif
+#ifdef LAYERED_SHADOWS
+   gl_Position = obj2world * vec4(vtx_position, 1);
+#else
+   mat4 mvp = world_to_ndc * obj2world;
    gl_Position = mvp * vec4(vtx_position, 1);
+#endif
 }
 
 
@@ -14,7 +14,7 @@ float linearize_depth(float depth)
 
 void main(void) {
 
-   float depth = texture(depthTextureArray, vec3(vTexCoord,0)).x;  // Using the first layer
+   float depth = texture(depthTextureArray, vec3(vTexCoord,0)).x;  // the whole atlas, in layer 0
    fragColor = vec4(depth, depth, depth, 1.0); // Grayscale depth image
 
    // vec3 color = texture(colorTextureArray, vec3(vTexCoord,0)).rgb;